@@ -0,0 +1,562 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "geometricmapcache.h"
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+
+/* Compact maps only depend on the geometry, so a map generated once can be
+ * reused by any element, in this process or a later one, that warps with
+ * the same parameters. Cached maps are serialized in a single buffer and the
+ * map arrays point into it, whether the buffer is in memory or a file
+ * mapped from the cache directory.
+ *
+ * Maps are immutable once generated and refcounted. Every cached map that
+ * is still used is in the live map table, so all elements with the same
+ * parameters share one map, and the recently used ones are kept a bit
+ * longer in case another element needs them again.
+ *
+ * Files are written by a single background thread, which also keeps the
+ * directory under MAP_CACHE_MAX_DISK_SIZE by removing the least recently
+ * used maps; mapping a file marks it as used. */
+
+GST_DEBUG_CATEGORY_STATIC (map_cache_debug);
+#define GST_CAT_DEFAULT map_cache_debug
+
+#define MAP_CACHE_MAGIC 0x47544d50      /* "GTMP" */
+#define MAP_CACHE_VERSION 1
+#define MAP_CACHE_SUFFIX ".gtmap"
+/* serialized maps kept in memory, the most recently used one is always
+ * kept even if it is bigger */
+#define MAP_CACHE_MAX_SIZE (64 * 1024 * 1024)
+/* files kept in the cache directory, the newest one is always kept */
+#define MAP_CACHE_MAX_DISK_SIZE (256 * 1024 * 1024)
+
+enum
+{
+  SECTION_MAP,
+  SECTION_FRAC,
+  SECTION_SPANS,
+  SECTION_CHROMA_MAP,
+  SECTION_CHROMA_FRAC,
+  SECTION_CHROMA_SPANS,
+  N_SECTIONS
+};
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  gint32 width;
+  gint32 height;
+  gint32 chroma_width;
+  gint32 chroma_height;
+  gint32 frac;
+  gint32 span_size;
+  gdouble valid_ratio;
+} MapCacheHeader;
+
+static GMutex map_cache_lock;
+/* key -> GstGeometricTransformMap, not holding a ref, maps remove
+ * themselves when their last ref is dropped */
+static GHashTable *live_maps;
+/* refs to the recently used GstGeometricTransformMap, most recent first */
+static GQueue map_cache = G_QUEUE_INIT;
+static gsize map_cache_size;
+/* writes MapCacheWrite jobs one at a time */
+static GThreadPool *map_cache_writer;
+
+typedef struct
+{
+  gchar *dir;
+  gchar *path;
+  GBytes *bytes;
+} MapCacheWrite;
+
+static void map_cache_write (MapCacheWrite * write, gpointer user_data);
+
+static void
+map_cache_init (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (map_cache_debug, "geometricmapcache", 0,
+        "Geometric transform map cache");
+    live_maps = g_hash_table_new (g_str_hash, g_str_equal);
+    map_cache_writer = g_thread_pool_new ((GFunc) map_cache_write, NULL, 1,
+        FALSE, NULL);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+/**
+ * gst_gm_map_new:
+ *
+ * Returns: a new empty map with one ref, for the caller to fill in before
+ *   it is shared
+ */
+GstGeometricTransformMap *
+gst_gm_map_new (void)
+{
+  GstGeometricTransformMap *map = g_new0 (GstGeometricTransformMap, 1);
+
+  map->ref_count = 1;
+
+  return map;
+}
+
+GstGeometricTransformMap *
+gst_gm_map_ref (GstGeometricTransformMap * map)
+{
+  g_atomic_int_inc (&map->ref_count);
+
+  return map;
+}
+
+void
+gst_gm_map_unref (GstGeometricTransformMap * map)
+{
+  if (map->key) {
+    /* live maps are looked up and reffed with the lock */
+    g_mutex_lock (&map_cache_lock);
+    if (!g_atomic_int_dec_and_test (&map->ref_count)) {
+      g_mutex_unlock (&map_cache_lock);
+      return;
+    }
+    if (g_hash_table_lookup (live_maps, map->key) == map)
+      g_hash_table_remove (live_maps, map->key);
+    g_mutex_unlock (&map_cache_lock);
+
+    GST_DEBUG ("releasing map %s", map->key);
+    g_free (map->key);
+  } else if (!g_atomic_int_dec_and_test (&map->ref_count)) {
+    return;
+  }
+
+  if (map->data) {
+    g_bytes_unref (map->data);
+  } else {
+    g_free (map->map);
+    g_free (map->chroma_map);
+    g_free (map->compact_map);
+    g_free (map->compact_chroma_map);
+    g_free (map->compact_frac);
+    g_free (map->compact_chroma_frac);
+    g_free (map->compact_spans);
+    g_free (map->compact_chroma_spans);
+  }
+  g_free (map);
+}
+
+/* Places the sections after the header, every one 16 bytes aligned.
+ * Returns the size of the serialized map. */
+static gsize
+map_cache_get_offsets (const GstGMMapLayout * layout, gsize * offsets,
+    gsize * sizes)
+{
+  gsize n_pixels = (gsize) layout->width * layout->height;
+  gsize n_chroma_pixels = (gsize) layout->chroma_width * layout->chroma_height;
+  gsize offset;
+  gint i;
+
+  sizes[SECTION_MAP] = n_pixels * 2 * sizeof (gint16);
+  sizes[SECTION_FRAC] = layout->frac ? n_pixels * 2 : 0;
+  sizes[SECTION_SPANS] = layout->height * sizeof (GstGeometricTransformSpan);
+  sizes[SECTION_CHROMA_MAP] = n_chroma_pixels * 2 * sizeof (gint16);
+  sizes[SECTION_CHROMA_FRAC] = layout->frac ? n_chroma_pixels * 2 : 0;
+  sizes[SECTION_CHROMA_SPANS] = layout->chroma_width ?
+      layout->chroma_height * sizeof (GstGeometricTransformSpan) : 0;
+
+  offset = GST_ROUND_UP_16 (sizeof (MapCacheHeader));
+  for (i = 0; i < N_SECTIONS; i++) {
+    offsets[i] = offset;
+    offset += GST_ROUND_UP_16 (sizes[i]);
+  }
+
+  return offset;
+}
+
+static GstGeometricTransformMap *
+map_cache_map_from_bytes (GBytes * bytes, const GstGMMapLayout * layout)
+{
+  GstGeometricTransformMap *map;
+  const MapCacheHeader *header;
+  gsize offsets[N_SECTIONS], sizes[N_SECTIONS];
+  guint8 *data;
+  gsize size;
+
+  data = (guint8 *) g_bytes_get_data (bytes, &size);
+  header = (const MapCacheHeader *) data;
+
+  /* also catches files written by another version or architecture */
+  if (size != map_cache_get_offsets (layout, offsets, sizes)
+      || header->magic != MAP_CACHE_MAGIC
+      || header->version != MAP_CACHE_VERSION
+      || header->width != layout->width || header->height != layout->height
+      || header->chroma_width != layout->chroma_width
+      || header->chroma_height != layout->chroma_height
+      || header->frac != (layout->frac ? 1 : 0)
+      || header->span_size != sizeof (GstGeometricTransformSpan))
+    return NULL;
+
+  map = gst_gm_map_new ();
+  map->data = g_bytes_ref (bytes);
+  map->compact_map = (gint16 *) (data + offsets[SECTION_MAP]);
+  map->compact_spans =
+      (GstGeometricTransformSpan *) (data + offsets[SECTION_SPANS]);
+  if (sizes[SECTION_FRAC])
+    map->compact_frac = data + offsets[SECTION_FRAC];
+  if (sizes[SECTION_CHROMA_MAP]) {
+    map->compact_chroma_map = (gint16 *) (data + offsets[SECTION_CHROMA_MAP]);
+    map->compact_chroma_spans =
+        (GstGeometricTransformSpan *) (data + offsets[SECTION_CHROMA_SPANS]);
+    if (sizes[SECTION_CHROMA_FRAC])
+      map->compact_chroma_frac = data + offsets[SECTION_CHROMA_FRAC];
+  }
+  map->valid_ratio = header->valid_ratio;
+
+  return map;
+}
+
+/* Every entry of a map section is a pixel of the input plane or negative,
+ * and every span lies inside the row. Maps read from files are checked
+ * before they are used, the remap loops index the input frames with them
+ * without any bound check. */
+static gboolean
+map_cache_check_section (const gint16 * map,
+    const GstGeometricTransformSpan * spans, gint width, gint height,
+    gint in_width, gint in_height)
+{
+  gsize i, n_pixels = (gsize) width * height;
+  gint y;
+
+  for (y = 0; y < height; y++) {
+    if (spans[y].start < 0 || spans[y].start > spans[y].end
+        || spans[y].end > width)
+      return FALSE;
+  }
+
+  for (i = 0; i < n_pixels; i++, map += 2) {
+    if (map[0] < 0)
+      continue;
+    if (map[0] >= in_width || map[1] < 0 || map[1] >= in_height)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+map_cache_check_map (const GstGeometricTransformMap * map,
+    const GstGMMapLayout * layout)
+{
+  if (!map_cache_check_section (map->compact_map, map->compact_spans,
+          layout->width, layout->height, layout->in_width, layout->in_height))
+    return FALSE;
+
+  if (map->compact_chroma_map
+      && !map_cache_check_section (map->compact_chroma_map,
+          map->compact_chroma_spans, layout->chroma_width,
+          layout->chroma_height, layout->in_chroma_width,
+          layout->in_chroma_height))
+    return FALSE;
+
+  return map->valid_ratio >= 0.0 && map->valid_ratio <= 1.0;
+}
+
+typedef struct
+{
+  gchar *path;
+  gint64 mtime;
+  gint64 size;
+} MapCacheFile;
+
+static gint
+map_cache_file_compare (const MapCacheFile * a, const MapCacheFile * b)
+{
+  return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/* Removes the least recently used maps of @dir until it is under
+ * MAP_CACHE_MAX_DISK_SIZE, never @keep */
+static void
+map_cache_trim (const gchar * dir, const gchar * keep)
+{
+  GArray *entries;
+  GDir *d;
+  const gchar *name;
+  gint64 total = 0;
+  guint i;
+
+  d = g_dir_open (dir, 0, NULL);
+  if (!d)
+    return;
+
+  entries = g_array_new (FALSE, FALSE, sizeof (MapCacheFile));
+  while ((name = g_dir_read_name (d))) {
+    MapCacheFile entry;
+    GStatBuf st;
+
+    if (!g_str_has_suffix (name, MAP_CACHE_SUFFIX))
+      continue;
+    entry.path = g_build_filename (dir, name, NULL);
+    if (g_stat (entry.path, &st) != 0) {
+      g_free (entry.path);
+      continue;
+    }
+    total += st.st_size;
+    if (g_strcmp0 (entry.path, keep) == 0) {
+      g_free (entry.path);
+      continue;
+    }
+    entry.mtime = st.st_mtime;
+    entry.size = st.st_size;
+    g_array_append_val (entries, entry);
+  }
+  g_dir_close (d);
+
+  g_array_sort (entries, (GCompareFunc) map_cache_file_compare);
+  for (i = 0; i < entries->len; i++) {
+    MapCacheFile *entry = &g_array_index (entries, MapCacheFile, i);
+
+    if (total > MAP_CACHE_MAX_DISK_SIZE && g_unlink (entry->path) == 0) {
+      GST_DEBUG ("evicted %s", entry->path);
+      total -= entry->size;
+    }
+    g_free (entry->path);
+  }
+  g_array_free (entries, TRUE);
+}
+
+/* Runs on map_cache_writer */
+static void
+map_cache_write (MapCacheWrite * write, gpointer user_data)
+{
+  gsize size;
+  const gchar *data = g_bytes_get_data (write->bytes, &size);
+  GError *err = NULL;
+
+  /* written to a temporary file first, other processes never see
+   * a partial map */
+  if (g_mkdir_with_parents (write->dir, 0755) != 0
+      || !g_file_set_contents (write->path, data, size, &err)) {
+    GST_WARNING ("failed to store %s: %s", write->path,
+        err ? err->message : g_strerror (errno));
+    g_clear_error (&err);
+  } else {
+    GST_DEBUG ("stored %s", write->path);
+    map_cache_trim (write->dir, write->path);
+  }
+
+  g_bytes_unref (write->bytes);
+  g_free (write->path);
+  g_free (write->dir);
+  g_free (write);
+}
+
+/* Makes @map, just created from @key, the live map for it and keeps a ref
+ * in the recently used maps. Returns the map to use, which is the live one
+ * if another element stored the same map meanwhile. */
+static GstGeometricTransformMap *
+map_cache_insert (const gchar * key, GstGeometricTransformMap * map)
+{
+  GstGeometricTransformMap *live;
+  GList *evicted = NULL;
+
+  g_mutex_lock (&map_cache_lock);
+  live = g_hash_table_lookup (live_maps, key);
+  if (live) {
+    gst_gm_map_ref (live);
+    g_mutex_unlock (&map_cache_lock);
+    gst_gm_map_unref (map);
+    return live;
+  }
+
+  map->key = g_strdup (key);
+  g_hash_table_insert (live_maps, map->key, map);
+
+  g_queue_push_head (&map_cache, gst_gm_map_ref (map));
+  map_cache_size += g_bytes_get_size (map->data);
+  while (map_cache_size > MAP_CACHE_MAX_SIZE && map_cache.length > 1) {
+    GstGeometricTransformMap *old = g_queue_pop_tail (&map_cache);
+
+    map_cache_size -= g_bytes_get_size (old->data);
+    evicted = g_list_prepend (evicted, old);
+  }
+  g_mutex_unlock (&map_cache_lock);
+
+  /* unreffing takes the lock */
+  g_list_free_full (evicted, (GDestroyNotify) gst_gm_map_unref);
+
+  return map;
+}
+
+/**
+ * gst_gm_map_cache_lookup:
+ * @key: hash of everything the map depends on
+ * @dir: (nullable): directory of the maps stored by previous processes
+ * @layout: the expected layout of the map
+ *
+ * Returns: (nullable): the map stored with @key, first looking in memory
+ *   then in @dir, or %NULL if there is none
+ */
+GstGeometricTransformMap *
+gst_gm_map_cache_lookup (const gchar * key, const gchar * dir,
+    const GstGMMapLayout * layout)
+{
+  GstGeometricTransformMap *map;
+  gchar *filename, *path;
+  GMappedFile *file;
+  GBytes *bytes;
+
+  map_cache_init ();
+
+  g_mutex_lock (&map_cache_lock);
+  map = g_hash_table_lookup (live_maps, key);
+  if (map) {
+    GList *l = g_queue_find (&map_cache, map);
+
+    /* mark as recently used */
+    if (l) {
+      g_queue_unlink (&map_cache, l);
+      g_queue_push_head_link (&map_cache, l);
+    }
+    gst_gm_map_ref (map);
+  }
+  g_mutex_unlock (&map_cache_lock);
+
+  if (map) {
+    GST_DEBUG ("sharing map %s", key);
+    return map;
+  }
+
+  if (!dir) {
+    GST_DEBUG ("no map for %s", key);
+    return NULL;
+  }
+
+  filename = g_strconcat (key, MAP_CACHE_SUFFIX, NULL);
+  path = g_build_filename (dir, filename, NULL);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  g_free (filename);
+
+  if (!file) {
+    GST_DEBUG ("no map for %s", key);
+    g_free (path);
+    return NULL;
+  }
+
+  bytes = g_mapped_file_get_bytes (file);
+  g_mapped_file_unref (file);
+  map = map_cache_map_from_bytes (bytes, layout);
+  g_bytes_unref (bytes);
+
+  if (map && !map_cache_check_map (map, layout))
+    g_clear_pointer (&map, gst_gm_map_unref);
+
+  if (!map) {
+    GST_WARNING ("ignoring invalid cached map %s", path);
+    g_free (path);
+    return NULL;
+  }
+
+  /* most recently used, for map_cache_trim() */
+  g_utime (path, NULL);
+  GST_DEBUG ("mapped %s", path);
+  g_free (path);
+
+  return map_cache_insert (key, map);
+}
+
+/**
+ * gst_gm_map_cache_store:
+ * @key: hash of everything the map depends on
+ * @dir: (nullable): directory to also store the map in, for later processes
+ * @layout: the layout of @map
+ * @map: a newly generated compact map
+ *
+ * Returns: (nullable): the shared map to use instead of @map, so that the
+ *   arrays are only kept once
+ */
+GstGeometricTransformMap *
+gst_gm_map_cache_store (const gchar * key, const gchar * dir,
+    const GstGMMapLayout * layout, const GstGeometricTransformMap * map)
+{
+  GstGeometricTransformMap *cached;
+  MapCacheHeader *header;
+  gsize offsets[N_SECTIONS], sizes[N_SECTIONS];
+  const void *sections[N_SECTIONS];
+  guint8 *data;
+  GBytes *bytes;
+  gsize size;
+  gint i;
+
+  map_cache_init ();
+
+  size = map_cache_get_offsets (layout, offsets, sizes);
+  data = g_malloc0 (size);
+
+  header = (MapCacheHeader *) data;
+  header->magic = MAP_CACHE_MAGIC;
+  header->version = MAP_CACHE_VERSION;
+  header->width = layout->width;
+  header->height = layout->height;
+  header->chroma_width = layout->chroma_width;
+  header->chroma_height = layout->chroma_height;
+  header->frac = layout->frac ? 1 : 0;
+  header->span_size = sizeof (GstGeometricTransformSpan);
+  header->valid_ratio = map->valid_ratio;
+
+  sections[SECTION_MAP] = map->compact_map;
+  sections[SECTION_FRAC] = map->compact_frac;
+  sections[SECTION_SPANS] = map->compact_spans;
+  sections[SECTION_CHROMA_MAP] = map->compact_chroma_map;
+  sections[SECTION_CHROMA_FRAC] = map->compact_chroma_frac;
+  sections[SECTION_CHROMA_SPANS] = map->compact_chroma_spans;
+  for (i = 0; i < N_SECTIONS; i++) {
+    if (sizes[i])
+      memcpy (data + offsets[i], sections[i], sizes[i]);
+  }
+
+  bytes = g_bytes_new_take (data, size);
+
+  /* the serialized map is immutable, the writer shares it */
+  if (dir) {
+    MapCacheWrite *write = g_new0 (MapCacheWrite, 1);
+    gchar *filename = g_strconcat (key, MAP_CACHE_SUFFIX, NULL);
+
+    write->dir = g_strdup (dir);
+    write->path = g_build_filename (dir, filename, NULL);
+    write->bytes = g_bytes_ref (bytes);
+    g_thread_pool_push (map_cache_writer, write, NULL);
+    g_free (filename);
+  }
+
+  cached = map_cache_map_from_bytes (bytes, layout);
+  g_bytes_unref (bytes);
+  if (!cached)
+    return NULL;
+
+  return map_cache_insert (key, cached);
+}
@@ -0,0 +1,68 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GEOMETRIC_MAP_CACHE_H__
+#define __GEOMETRIC_MAP_CACHE_H__
+
+#include <gst/gst.h>
+#include "gstgeometrictransform.h"
+
+G_BEGIN_DECLS
+
+/**
+ * GstGMMapLayout:
+ * @width: width of the luma map
+ * @height: height of the luma map
+ * @chroma_width: width of the chroma map, 0 when there is none
+ * @chroma_height: height of the chroma map, 0 when there is none
+ * @in_width: width of the input frames the luma map points into
+ * @in_height: height of the input frames
+ * @in_chroma_width: width of the input chroma planes, 0 without chroma map
+ * @in_chroma_height: height of the input chroma planes
+ * @frac: whether the maps have sub-pixel positions
+ *
+ * Which arrays of a compact #GstGeometricTransformMap are present, and
+ * their size.
+ */
+typedef struct
+{
+  gint width;
+  gint height;
+  gint chroma_width;
+  gint chroma_height;
+  gint in_width;
+  gint in_height;
+  gint in_chroma_width;
+  gint in_chroma_height;
+  gboolean frac;
+} GstGMMapLayout;
+
+GstGeometricTransformMap * gst_gm_map_new (void);
+GstGeometricTransformMap * gst_gm_map_ref (GstGeometricTransformMap * map);
+void gst_gm_map_unref (GstGeometricTransformMap * map);
+
+GstGeometricTransformMap * gst_gm_map_cache_lookup (const gchar * key,
+    const gchar * dir, const GstGMMapLayout * layout);
+
+GstGeometricTransformMap * gst_gm_map_cache_store (const gchar * key,
+    const gchar * dir, const GstGMMapLayout * layout,
+    const GstGeometricTransformMap * map);
+
+G_END_DECLS
+
+#endif /* __GEOMETRIC_MAP_CACHE_H__ */
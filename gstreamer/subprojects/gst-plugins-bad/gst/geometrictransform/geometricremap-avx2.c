@@ -0,0 +1,153 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "geometricremap.h"
+#include <immintrin.h>
+
+/* Input byte offsets of the next 8 map entries. @valid is set for the
+ * entries that have an input pixel. */
+static inline __m256i
+remap_offsets (const gint16 * map, __m256i stride, __m128i shift,
+    __m256i * valid)
+{
+  __m256i v = _mm256_loadu_si256 ((const __m256i *) map);
+  __m256i x = _mm256_srai_epi32 (_mm256_slli_epi32 (v, 16), 16);
+  __m256i y = _mm256_srai_epi32 (v, 16);
+
+  *valid = _mm256_cmpgt_epi32 (x, _mm256_set1_epi32 (-1));
+
+  return _mm256_add_epi32 (_mm256_mullo_epi32 (y, stride),
+      _mm256_sll_epi32 (x, shift));
+}
+
+/* The gathers load 4 bytes per pixel, which for 1 and 2 byte pixels could
+ * read past the end of the input plane. Such groups are done in C. */
+static inline gboolean
+remap_overreads (__m256i offsets, __m256i valid, __m256i limit)
+{
+  __m256i over = _mm256_and_si256 (valid, _mm256_cmpgt_epi32 (offsets, limit));
+
+  return !_mm256_testz_si256 (over, over);
+}
+
+void
+gst_gm_remap_row_u8_avx2 (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  const __m256i stride = _mm256_set1_epi32 (in_stride);
+  const __m128i shift = _mm_cvtsi32_si128 (0);
+  const __m256i limit = _mm256_set1_epi32 ((gint) in_size - 4);
+  /* low byte of every 32 bit lane, then both 128 bit lanes together */
+  const __m256i pick = _mm256_setr_epi8 (0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i merge = _mm256_setr_epi32 (0, 4, 0, 0, 0, 0, 0, 0);
+  gint x = 0;
+
+  if (in_size < 4)
+    goto tail;
+
+  for (; x + 8 <= width; x += 8, map += 16) {
+    __m256i valid, offsets, pixels;
+
+    offsets = remap_offsets (map, stride, shift, &valid);
+    if (remap_overreads (offsets, valid, limit)) {
+      gst_gm_remap_row_u8_c (out + x, in, in_stride, in_size, map, 8);
+      continue;
+    }
+
+    /* untouched pixels keep their current value */
+    pixels = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)
+            (out + x)));
+    pixels = _mm256_mask_i32gather_epi32 (pixels, (const int *) in, offsets,
+        valid, 1);
+    pixels = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (pixels, pick),
+        merge);
+    _mm_storel_epi64 ((__m128i *) (out + x), _mm256_castsi256_si128 (pixels));
+  }
+
+tail:
+  gst_gm_remap_row_u8_c (out + x, in, in_stride, in_size, map, width - x);
+}
+
+void
+gst_gm_remap_row_u16_avx2 (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  const __m256i stride = _mm256_set1_epi32 (in_stride);
+  const __m128i shift = _mm_cvtsi32_si128 (1);
+  const __m256i limit = _mm256_set1_epi32 ((gint) in_size - 4);
+  /* low 16 bits of every 32 bit lane, then both 128 bit lanes together */
+  const __m256i pick = _mm256_setr_epi8 (0, 1, 4, 5, 8, 9, 12, 13,
+      -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 4, 5, 8, 9, 12, 13,
+      -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i merge = _mm256_setr_epi32 (0, 1, 4, 5, 0, 0, 0, 0);
+  gint x = 0;
+
+  if (in_size < 4)
+    goto tail;
+
+  for (; x + 8 <= width; x += 8, map += 16) {
+    __m256i valid, offsets, pixels;
+
+    offsets = remap_offsets (map, stride, shift, &valid);
+    if (remap_overreads (offsets, valid, limit)) {
+      gst_gm_remap_row_u16_c (out + x * 2, in, in_stride, in_size, map, 8);
+      continue;
+    }
+
+    pixels = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)
+            (out + x * 2)));
+    pixels = _mm256_mask_i32gather_epi32 (pixels, (const int *) in, offsets,
+        valid, 1);
+    pixels = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (pixels, pick),
+        merge);
+    _mm_storeu_si128 ((__m128i *) (out + x * 2),
+        _mm256_castsi256_si128 (pixels));
+  }
+
+tail:
+  gst_gm_remap_row_u16_c (out + x * 2, in, in_stride, in_size, map,
+      width - x);
+}
+
+void
+gst_gm_remap_row_u32_avx2 (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  const __m256i stride = _mm256_set1_epi32 (in_stride);
+  const __m128i shift = _mm_cvtsi32_si128 (2);
+  gint x = 0;
+
+  for (; x + 8 <= width; x += 8, map += 16) {
+    __m256i valid, offsets, pixels;
+
+    offsets = remap_offsets (map, stride, shift, &valid);
+    pixels = _mm256_loadu_si256 ((const __m256i *) (out + x * 4));
+    pixels = _mm256_mask_i32gather_epi32 (pixels, (const int *) in, offsets,
+        valid, 1);
+    _mm256_storeu_si256 ((__m256i *) (out + x * 4), pixels);
+  }
+
+  gst_gm_remap_row_u32_c (out + x * 4, in, in_stride, in_size, map,
+      width - x);
+}
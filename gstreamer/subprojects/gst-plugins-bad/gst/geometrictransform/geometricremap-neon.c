@@ -0,0 +1,149 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "geometricremap.h"
+#include <arm_neon.h>
+
+/* NEON has no gather, but it has 64 byte table lookups. The maps of
+ * deskew and perspective are smooth: 16 neighbouring output pixels read
+ * from one or two input rows, a few dozen bytes apart. Those 16 pixels
+ * are then copied with one table lookup per input row, the window of that
+ * row being the table. Groups that read from more rows or from further
+ * apart are done in C. */
+
+#define BLOCK 16
+#define WINDOW 64
+
+/* Copies the pixels of the next BLOCK map entries into @out, @bpp bytes
+ * each. Returns FALSE, with @out untouched, if they don't fit in two
+ * windows. */
+static inline gboolean
+remap_block (guint8 * out, const guint8 * in, gint in_stride, gsize in_size,
+    const gint16 * map, gint bpp)
+{
+  const int16x8x2_t entries[2] = { vld2q_s16 (map), vld2q_s16 (map + 16) };
+  const int16x8_t none = vdupq_n_s16 (G_MAXINT16);
+  /* out of the table, leaves the output byte as it is */
+  const uint16x8_t outside = vdupq_n_u16 (0x80);
+  uint16x8_t left[2];
+  uint8x16_t pixels[2];
+  gint r, h;
+
+  /* untouched pixels keep their current value */
+  left[0] = vcgezq_s16 (entries[0].val[0]);
+  left[1] = vcgezq_s16 (entries[1].val[0]);
+  pixels[0] = vld1q_u8 (out);
+  if (bpp == 2)
+    pixels[1] = vld1q_u8 (out + 16);
+
+  for (r = 0; r < 2; r++) {
+    int16x8_t x[2];
+    uint16x8_t in_row[2];
+    gint16 y, x_min, x_max;
+    gsize offset;
+    uint8x16x4_t window;
+
+    y = MIN (vminvq_s16 (vbslq_s16 (left[0], entries[0].val[1], none)),
+        vminvq_s16 (vbslq_s16 (left[1], entries[1].val[1], none)));
+    if (y == G_MAXINT16)
+      break;
+
+    for (h = 0; h < 2; h++) {
+      in_row[h] = vandq_u16 (left[h], vceqq_s16 (entries[h].val[1],
+              vdupq_n_s16 (y)));
+      left[h] = vbicq_u16 (left[h], in_row[h]);
+    }
+
+    x_min = MIN (vminvq_s16 (vbslq_s16 (in_row[0], entries[0].val[0], none)),
+        vminvq_s16 (vbslq_s16 (in_row[1], entries[1].val[0], none)));
+    x_max = MAX (vmaxvq_s16 (vbslq_s16 (in_row[0], entries[0].val[0],
+                vdupq_n_s16 (-1))), vmaxvq_s16 (vbslq_s16 (in_row[1],
+                entries[1].val[0], vdupq_n_s16 (-1))));
+    offset = (gsize) y * in_stride + (gsize) x_min * bpp;
+    if ((x_max - x_min + 1) * bpp > WINDOW || offset + WINDOW > in_size)
+      return FALSE;
+
+    window.val[0] = vld1q_u8 (in + offset);
+    window.val[1] = vld1q_u8 (in + offset + 16);
+    window.val[2] = vld1q_u8 (in + offset + 32);
+    window.val[3] = vld1q_u8 (in + offset + 48);
+
+    /* byte offsets in the window, of the pixels on this row */
+    for (h = 0; h < 2; h++) {
+      x[h] = vsubq_s16 (entries[h].val[0], vdupq_n_s16 (x_min));
+      if (bpp == 2)
+        x[h] = vshlq_n_s16 (x[h], 1);
+      in_row[h] = vbslq_u16 (in_row[h], vreinterpretq_u16_s16 (x[h]),
+          outside);
+    }
+
+    if (bpp == 1) {
+      pixels[0] = vqtbx4q_u8 (pixels[0], window,
+          vcombine_u8 (vmovn_u16 (in_row[0]), vmovn_u16 (in_row[1])));
+    } else {
+      /* both bytes of a pixel: o | (o + 1) << 8 */
+      for (h = 0; h < 2; h++)
+        pixels[h] = vqtbx4q_u8 (pixels[h], window,
+            vreinterpretq_u8_u16 (vaddq_u16 (vmulq_n_u16 (in_row[h], 257),
+                    vdupq_n_u16 (256))));
+    }
+  }
+
+  if (vmaxvq_u16 (vorrq_u16 (left[0], left[1])))
+    return FALSE;
+
+  vst1q_u8 (out, pixels[0]);
+  if (bpp == 2)
+    vst1q_u8 (out + 16, pixels[1]);
+
+  return TRUE;
+}
+
+void
+gst_gm_remap_row_u8_neon (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  gint x = 0;
+
+  for (; x + BLOCK <= width; x += BLOCK, map += 2 * BLOCK) {
+    if (!remap_block (out + x, in, in_stride, in_size, map, 1))
+      gst_gm_remap_row_u8_c (out + x, in, in_stride, in_size, map, BLOCK);
+  }
+
+  gst_gm_remap_row_u8_c (out + x, in, in_stride, in_size, map, width - x);
+}
+
+void
+gst_gm_remap_row_u16_neon (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  gint x = 0;
+
+  for (; x + BLOCK <= width; x += BLOCK, map += 2 * BLOCK) {
+    if (!remap_block (out + x * 2, in, in_stride, in_size, map, 2))
+      gst_gm_remap_row_u16_c (out + x * 2, in, in_stride, in_size, map,
+          BLOCK);
+  }
+
+  gst_gm_remap_row_u16_c (out + x * 2, in, in_stride, in_size, map,
+      width - x);
+}
@@ -0,0 +1,204 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "geometricremap.h"
+#include <string.h>
+#include <math.h>
+
+GstGMRemapRowFunc gst_gm_remap_row_u8 = gst_gm_remap_row_u8_c;
+GstGMRemapRowFunc gst_gm_remap_row_u16 = gst_gm_remap_row_u16_c;
+GstGMRemapRowFunc gst_gm_remap_row_u32 = gst_gm_remap_row_u32_c;
+
+void
+gst_gm_remap_row_u8_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  gint x;
+
+  for (x = 0; x < width; x++, map += 2) {
+    if (map[0] >= 0)
+      out[x] = in[map[1] * in_stride + map[0]];
+  }
+}
+
+void
+gst_gm_remap_row_u16_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  gint x;
+
+  for (x = 0; x < width; x++, map += 2) {
+    if (map[0] >= 0)
+      memcpy (out + x * 2, in + map[1] * in_stride + map[0] * 2, 2);
+  }
+}
+
+void
+gst_gm_remap_row_u32_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width)
+{
+  gint x;
+
+  for (x = 0; x < width; x++, map += 2) {
+    if (map[0] >= 0)
+      memcpy (out + x * 4, in + map[1] * in_stride + map[0] * 4, 4);
+  }
+}
+
+/* bilinear weights are the fractions themselves, 8 bits each */
+void
+gst_gm_remap_row_bilinear (guint8 * out, const guint8 * in, gint in_stride,
+    gint in_width, gint in_height, gint pixel_stride, const gint16 * map,
+    const guint8 * frac, gint width)
+{
+  gint x, c;
+
+  for (x = 0; x < width; x++, map += 2, frac += 2, out += pixel_stride) {
+    const guint8 *p0, *p1;
+    gint wx1, wx0, wy1, wy0, dx;
+
+    if (map[0] < 0)
+      continue;
+
+    wx1 = frac[0];
+    wx0 = 256 - wx1;
+    wy1 = frac[1];
+    wy0 = 256 - wy1;
+
+    p0 = in + map[1] * in_stride + map[0] * pixel_stride;
+    p1 = map[1] + 1 < in_height ? p0 + in_stride : p0;
+    dx = map[0] + 1 < in_width ? pixel_stride : 0;
+
+    for (c = 0; c < pixel_stride; c++) {
+      gint top = p0[c] * wx0 + p0[c + dx] * wx1;
+      gint bottom = p1[c] * wx0 + p1[c + dx] * wx1;
+
+      out[c] = (top * wy0 + bottom * wy1 + (1 << 15)) >> 16;
+    }
+  }
+}
+
+/* Catmull-Rom weights of the 4 taps around every 1/256th fraction, in
+ * 1/1024th, filled by gst_gm_remap_init() */
+#define BICUBIC_SHIFT 10
+static gint16 bicubic_weights[256][4];
+
+static void
+gst_gm_remap_init_bicubic (void)
+{
+  const gdouble a = -0.5;
+  gint i, k;
+
+  for (i = 0; i < 256; i++) {
+    gdouble t = i / 256.0;
+    gdouble w[4];
+    gint sum = 0;
+
+    w[0] = ((a * (t + 1) - 5 * a) * (t + 1) + 8 * a) * (t + 1) - 4 * a;
+    w[1] = ((a + 2) * t - (a + 3)) * t * t + 1;
+    w[2] = ((a + 2) * (1 - t) - (a + 3)) * (1 - t) * (1 - t) + 1;
+    w[3] = 1.0 - w[0] - w[1] - w[2];
+
+    for (k = 0; k < 4; k++) {
+      bicubic_weights[i][k] = (gint16) floor (w[k] * (1 << BICUBIC_SHIFT) +
+          0.5);
+      sum += bicubic_weights[i][k];
+    }
+    /* make sure flat areas stay flat */
+    bicubic_weights[i][t < 0.5 ? 1 : 2] += (1 << BICUBIC_SHIFT) - sum;
+  }
+}
+
+void
+gst_gm_remap_row_bicubic (guint8 * out, const guint8 * in, gint in_stride,
+    gint in_width, gint in_height, gint pixel_stride, const gint16 * map,
+    const guint8 * frac, gint width)
+{
+  gint x, c, k;
+
+  for (x = 0; x < width; x++, map += 2, frac += 2, out += pixel_stride) {
+    const gint16 *wx, *wy;
+    const guint8 *rows[4];
+    gint cols[4];
+
+    if (map[0] < 0)
+      continue;
+
+    wx = bicubic_weights[frac[0]];
+    wy = bicubic_weights[frac[1]];
+
+    for (k = 0; k < 4; k++) {
+      cols[k] = CLAMP (map[0] - 1 + k, 0, in_width - 1) * pixel_stride;
+      rows[k] = in + CLAMP (map[1] - 1 + k, 0, in_height - 1) * in_stride;
+    }
+
+    for (c = 0; c < pixel_stride; c++) {
+      gint sum = 0;
+
+      for (k = 0; k < 4; k++) {
+        const guint8 *row = rows[k] + c;
+
+        sum += wy[k] * (row[cols[0]] * wx[0] + row[cols[1]] * wx[1] +
+            row[cols[2]] * wx[2] + row[cols[3]] * wx[3]);
+      }
+
+      sum = (sum + (1 << (2 * BICUBIC_SHIFT - 1))) >> (2 * BICUBIC_SHIFT);
+      out[c] = CLAMP (sum, 0, 255);
+    }
+  }
+}
+
+/* Picks the fastest implementations the CPU supports and returns the name
+ * of the instruction set in use. SSE4.1 has neither a gather nor a wide
+ * enough table lookup, a kernel for it is a scalar loop with extra
+ * shuffles. NEON has the lookup but no 4 byte one, 4 byte pixels stay in
+ * C there. */
+const gchar *
+gst_gm_remap_init (void)
+{
+  static const gchar *impl = NULL;
+
+  if (g_once_init_enter (&impl)) {
+    const gchar *name = "c";
+
+    gst_gm_remap_init_bicubic ();
+
+#if defined (HAVE_GM_REMAP_AVX2) && (defined (__GNUC__) || defined (__clang__))
+    if (__builtin_cpu_supports ("avx2")) {
+      gst_gm_remap_row_u8 = gst_gm_remap_row_u8_avx2;
+      gst_gm_remap_row_u16 = gst_gm_remap_row_u16_avx2;
+      gst_gm_remap_row_u32 = gst_gm_remap_row_u32_avx2;
+      name = "avx2";
+    }
+#endif
+#ifdef HAVE_GM_REMAP_NEON
+    /* always available on aarch64 */
+    gst_gm_remap_row_u8 = gst_gm_remap_row_u8_neon;
+    gst_gm_remap_row_u16 = gst_gm_remap_row_u16_neon;
+    name = "neon";
+#endif
+
+    g_once_init_leave (&impl, name);
+  }
+
+  return impl;
+}
@@ -0,0 +1,103 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GEOMETRIC_REMAP_H__
+#define __GEOMETRIC_REMAP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstGMRemapRowFunc:
+ * @out: the output row
+ * @in: the input plane
+ * @in_stride: row stride of @in
+ * @in_size: number of bytes that can be read from @in
+ * @map: @width compact map entries, (x, y) input pixels with x = -1 for
+ *   output pixels that must be left untouched
+ * @width: number of output pixels
+ *
+ * Copies the input pixel selected by @map to every output pixel of a row.
+ * All implementations of a given pixel size produce the exact same output.
+ */
+typedef void (*GstGMRemapRowFunc) (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+
+/* best implementation for 1, 2 and 4 bytes per pixel, set by
+ * gst_gm_remap_init() */
+extern GstGMRemapRowFunc gst_gm_remap_row_u8;
+extern GstGMRemapRowFunc gst_gm_remap_row_u16;
+extern GstGMRemapRowFunc gst_gm_remap_row_u32;
+
+const gchar * gst_gm_remap_init (void);
+
+/**
+ * GstGMInterpolateRowFunc:
+ * @out: the output row
+ * @in: the input plane
+ * @in_stride: row stride of @in
+ * @in_width: width of the input plane, in pixels
+ * @in_height: height of the input plane
+ * @pixel_stride: bytes per pixel, every byte is interpolated separately
+ * @map: @width compact map entries holding the input pixel at the top-left
+ *   of the sampled area, x = -1 for output pixels that must be left untouched
+ * @frac: @width (fx, fy) pairs, the position inside that pixel in 1/256th
+ * @width: number of output pixels
+ *
+ * Like #GstGMRemapRowFunc, but interpolates the neighbouring input pixels
+ * with fixed-point weights. Neighbours outside of the input plane are
+ * replaced by the closest edge pixel.
+ */
+typedef void (*GstGMInterpolateRowFunc) (guint8 * out, const guint8 * in,
+    gint in_stride, gint in_width, gint in_height, gint pixel_stride,
+    const gint16 * map, const guint8 * frac, gint width);
+
+void gst_gm_remap_row_bilinear (guint8 * out, const guint8 * in,
+    gint in_stride, gint in_width, gint in_height, gint pixel_stride,
+    const gint16 * map, const guint8 * frac, gint width);
+void gst_gm_remap_row_bicubic (guint8 * out, const guint8 * in,
+    gint in_stride, gint in_width, gint in_height, gint pixel_stride,
+    const gint16 * map, const guint8 * frac, gint width);
+
+void gst_gm_remap_row_u8_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width);
+void gst_gm_remap_row_u16_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width);
+void gst_gm_remap_row_u32_c (guint8 * out, const guint8 * in, gint in_stride,
+    gsize in_size, const gint16 * map, gint width);
+
+#ifdef HAVE_GM_REMAP_AVX2
+void gst_gm_remap_row_u8_avx2 (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+void gst_gm_remap_row_u16_avx2 (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+void gst_gm_remap_row_u32_avx2 (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+#endif
+
+#ifdef HAVE_GM_REMAP_NEON
+void gst_gm_remap_row_u8_neon (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+void gst_gm_remap_row_u16_neon (guint8 * out, const guint8 * in,
+    gint in_stride, gsize in_size, const gint16 * map, gint width);
+#endif
+
+G_END_DECLS
+
+#endif /* __GEOMETRIC_REMAP_H__ */
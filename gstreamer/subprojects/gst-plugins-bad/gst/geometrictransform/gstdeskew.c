@@ -0,0 +1,514 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-deskew
+ * @title: deskew
+ * @see_also: perspective, videoflip, videoscale
+ *
+ * The deskew element crops a quadrilateral area of the input, given by its 4
+ * corners, straightens it into a rectangle, flips or rotates it and scales
+ * it to the output size, all in one pass over the frame.
+ *
+ * The output size is negotiated with downstream. NV12 and NV21 input can be
+ * output as I420 or YV12 directly.
+ *
+ * ## Example launch line
+ * |[
+ * gst-launch-1.0 -v videotestsrc ! video/x-raw,format=NV12,width=1280,height=720 ! deskew points="<100.0,50.0,1200.0,80.0,1150.0,700.0,60.0,650.0>" video-direction=90r ! video/x-raw,format=I420,width=720,height=1280 ! videoconvert ! autovideosink
+ * ]|
+ *
+ */
+
+/* FIXME: suppress warnings for deprecated API such as GValueArray
+ * with newer GLib versions (>= 2.31.0), see gstperspective.c */
+#define GLIB_DISABLE_DEPRECATION_WARNINGS
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+
+#include "gstdeskew.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_deskew_debug);
+#define GST_CAT_DEFAULT gst_deskew_debug
+
+enum
+{
+  PROP_0,
+  PROP_POINTS,
+  PROP_VIDEO_DIRECTION
+};
+
+#define DEFAULT_VIDEO_DIRECTION GST_VIDEO_ORIENTATION_IDENTITY
+
+#define gst_deskew_parent_class parent_class
+G_DEFINE_TYPE (GstDeskew, gst_deskew, GST_TYPE_GEOMETRIC_TRANSFORM);
+GST_ELEMENT_REGISTER_DEFINE_WITH_CODE (deskew, "deskew",
+    GST_RANK_NONE, GST_TYPE_DESKEW,
+    GST_DEBUG_CATEGORY_INIT (gst_deskew_debug, "deskew", 0, "deskew"));
+
+static GValueArray *
+get_array_from_points (GstDeskew * self)
+{
+  GValue v = { 0, };
+  GValueArray *va;
+  int i;
+
+  va = g_value_array_new (1);
+
+  if (!self->have_points)
+    return va;
+
+  for (i = 0; i < 8; i++) {
+    g_value_init (&v, G_TYPE_DOUBLE);
+    g_value_set_double (&v, self->points[i]);
+    g_value_array_append (va, &v);
+    g_value_unset (&v);
+  }
+
+  return va;
+}
+
+static gboolean
+set_points_from_array (GstDeskew * self, GValueArray * va)
+{
+  guint i;
+
+  /* an empty array selects the whole frame */
+  if (!va || va->n_values == 0) {
+    self->have_points = FALSE;
+    return TRUE;
+  }
+
+  if (va->n_values != 8) {
+    GST_WARNING ("Invalid number of elements: %d", va->n_values);
+    return FALSE;
+  }
+
+  for (i = 0; i < va->n_values; i++) {
+    GValue *v = g_value_array_get_nth (va, i);
+    self->points[i] = g_value_get_double (v);
+  }
+  self->have_points = TRUE;
+
+  return TRUE;
+}
+
+static void
+gst_deskew_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstDeskew *deskew;
+  GstGeometricTransform *gt;
+
+  gt = GST_GEOMETRIC_TRANSFORM_CAST (object);
+  deskew = GST_DESKEW_CAST (object);
+
+  GST_OBJECT_LOCK (deskew);
+  switch (prop_id) {
+    case PROP_POINTS:
+      if (set_points_from_array (deskew, g_value_get_boxed (value)))
+        gst_geometric_transform_set_need_remap (gt);
+      break;
+    case PROP_VIDEO_DIRECTION:{
+      GstVideoOrientationMethod method = g_value_get_enum (value);
+
+      /* there are no tags to follow, and a rotation changes the caps */
+      if (method == GST_VIDEO_ORIENTATION_AUTO
+          || method == GST_VIDEO_ORIENTATION_CUSTOM) {
+        GST_WARNING_OBJECT (deskew, "Unsupported video direction %d", method);
+        break;
+      }
+      if (method != deskew->method) {
+        deskew->method = method;
+        gst_geometric_transform_set_need_remap (gt);
+      }
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (deskew);
+}
+
+static void
+gst_deskew_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstDeskew *deskew;
+
+  deskew = GST_DESKEW_CAST (object);
+
+  switch (prop_id) {
+    case PROP_POINTS:
+      GST_OBJECT_LOCK (deskew);
+      g_value_take_boxed (value, get_array_from_points (deskew));
+      GST_OBJECT_UNLOCK (deskew);
+      break;
+    case PROP_VIDEO_DIRECTION:
+      g_value_set_enum (value, deskew->method);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Appends @format to the @list of formats if it isn't in it already */
+static void
+gst_deskew_append_format (GValue * list, const gchar * format)
+{
+  GValue v = G_VALUE_INIT;
+  guint i;
+
+  for (i = 0; i < gst_value_list_get_size (list); i++) {
+    if (!g_strcmp0 (g_value_get_string (gst_value_list_get_value (list, i)),
+            format))
+      return;
+  }
+
+  g_value_init (&v, G_TYPE_STRING);
+  g_value_set_string (&v, format);
+  gst_value_list_append_and_take_value (list, &v);
+}
+
+static void
+gst_deskew_append_formats (GValue * list, const gchar * format,
+    GstPadDirection direction)
+{
+  gst_deskew_append_format (list, format);
+
+  /* NV12/NV21 chroma can be split into I420/YV12 while warping */
+  if (direction == GST_PAD_SINK && (!g_strcmp0 (format, "NV12")
+          || !g_strcmp0 (format, "NV21"))) {
+    gst_deskew_append_format (list, "I420");
+    gst_deskew_append_format (list, "YV12");
+  } else if (direction == GST_PAD_SRC && (!g_strcmp0 (format, "I420")
+          || !g_strcmp0 (format, "YV12"))) {
+    gst_deskew_append_format (list, "NV12");
+    gst_deskew_append_format (list, "NV21");
+  }
+}
+
+static GstCaps *
+gst_deskew_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *ret;
+  guint i, n;
+
+  ret = gst_caps_new_empty ();
+  n = gst_caps_get_size (caps);
+
+  for (i = 0; i < n; i++) {
+    GstStructure *structure = gst_caps_get_structure (caps, i);
+    GstCapsFeatures *features = gst_caps_get_features (caps, i);
+    const GValue *format;
+    GValue formats = G_VALUE_INIT;
+
+    if (i > 0 && gst_caps_is_subset_structure_full (ret, structure, features))
+      continue;
+
+    structure = gst_structure_copy (structure);
+
+    /* the frame is scaled and maybe rotated, any size can be produced */
+    gst_structure_set (structure,
+        "width", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+        "height", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+    gst_structure_remove_field (structure, "pixel-aspect-ratio");
+
+    format = gst_structure_get_value (structure, "format");
+    if (format) {
+      g_value_init (&formats, GST_TYPE_LIST);
+      if (G_VALUE_HOLDS_STRING (format)) {
+        gst_deskew_append_formats (&formats, g_value_get_string (format),
+            direction);
+      } else if (GST_VALUE_HOLDS_LIST (format)) {
+        guint j;
+
+        for (j = 0; j < gst_value_list_get_size (format); j++) {
+          const GValue *v = gst_value_list_get_value (format, j);
+
+          if (G_VALUE_HOLDS_STRING (v))
+            gst_deskew_append_formats (&formats, g_value_get_string (v),
+                direction);
+        }
+      }
+
+      if (gst_value_list_get_size (&formats) == 1) {
+        gst_structure_set_value (structure, "format",
+            gst_value_list_get_value (&formats, 0));
+        g_value_unset (&formats);
+      } else if (gst_value_list_get_size (&formats) > 1) {
+        gst_structure_take_value (structure, "format", &formats);
+      } else {
+        g_value_unset (&formats);
+      }
+    }
+
+    gst_caps_append_structure_full (ret, structure,
+        gst_caps_features_copy (features));
+  }
+
+  if (filter) {
+    GstCaps *intersection;
+
+    intersection =
+        gst_caps_intersect_full (filter, ret, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (ret);
+    ret = intersection;
+  }
+
+  GST_DEBUG_OBJECT (trans, "transformed %" GST_PTR_FORMAT " into %"
+      GST_PTR_FORMAT, caps, ret);
+
+  return ret;
+}
+
+static GstCaps *
+gst_deskew_fixate_caps (GstBaseTransform * trans, GstPadDirection direction,
+    GstCaps * caps, GstCaps * othercaps)
+{
+  GstStructure *ins, *outs;
+  const gchar *format;
+  gint width, height;
+
+  othercaps = gst_caps_truncate (othercaps);
+  othercaps = gst_caps_make_writable (othercaps);
+
+  ins = gst_caps_get_structure (caps, 0);
+  outs = gst_caps_get_structure (othercaps, 0);
+
+  /* keep the size and format if downstream doesn't care */
+  if (gst_structure_get_int (ins, "width", &width))
+    gst_structure_fixate_field_nearest_int (outs, "width", width);
+  if (gst_structure_get_int (ins, "height", &height))
+    gst_structure_fixate_field_nearest_int (outs, "height", height);
+  if ((format = gst_structure_get_string (ins, "format")))
+    gst_structure_fixate_field_string (outs, "format", format);
+
+  othercaps = gst_caps_fixate (othercaps);
+
+  GST_DEBUG_OBJECT (trans, "fixated to %" GST_PTR_FORMAT, othercaps);
+
+  return othercaps;
+}
+
+/* 3x3 matrix product, @r = @a * @b, row-major */
+static void
+matrix_multiply (gdouble * r, const gdouble * a, const gdouble * b)
+{
+  gdouble tmp[9];
+  gint i, j;
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      tmp[i * 3 + j] = a[i * 3] * b[j] + a[i * 3 + 1] * b[3 + j] +
+          a[i * 3 + 2] * b[6 + j];
+
+  memcpy (r, tmp, sizeof (tmp));
+}
+
+/* Unit square to quadrilateral homography, see "Fundamentals of Texture
+ * Mapping and Image Warping", Paul Heckbert, 1989 */
+static gboolean
+square_to_quad (const gdouble * p, gdouble * m)
+{
+  gdouble dx1 = p[2] - p[4], dx2 = p[6] - p[4];
+  gdouble dx3 = p[0] - p[2] + p[4] - p[6];
+  gdouble dy1 = p[3] - p[5], dy2 = p[7] - p[5];
+  gdouble dy3 = p[1] - p[3] + p[5] - p[7];
+  gdouble g = 0, h = 0;
+
+  if (dx3 != 0 || dy3 != 0) {
+    gdouble det = dx1 * dy2 - dx2 * dy1;
+
+    if (det == 0)
+      return FALSE;
+
+    g = (dx3 * dy2 - dx2 * dy3) / det;
+    h = (dx1 * dy3 - dx3 * dy1) / det;
+  }
+
+  m[0] = p[2] - p[0] + g * p[2];
+  m[1] = p[6] - p[0] + h * p[6];
+  m[2] = p[0];
+  m[3] = p[3] - p[1] + g * p[3];
+  m[4] = p[7] - p[1] + h * p[7];
+  m[5] = p[1];
+  m[6] = g;
+  m[7] = h;
+  m[8] = 1;
+
+  return TRUE;
+}
+
+/* (u, v) in the deskewed area of the output (s, t), both in [0, 1] */
+static void
+get_flip_matrix (GstVideoOrientationMethod method, gdouble * m)
+{
+  static const gdouble flips[][9] = {
+    /* identity */
+    {1, 0, 0, 0, 1, 0, 0, 0, 1},
+    /* 90r: u = t, v = 1 - s */
+    {0, 1, 0, -1, 0, 1, 0, 0, 1},
+    /* 180: u = 1 - s, v = 1 - t */
+    {-1, 0, 1, 0, -1, 1, 0, 0, 1},
+    /* 90l: u = 1 - t, v = s */
+    {0, -1, 1, 1, 0, 0, 0, 0, 1},
+    /* horiz: u = 1 - s, v = t */
+    {-1, 0, 1, 0, 1, 0, 0, 0, 1},
+    /* vert: u = s, v = 1 - t */
+    {1, 0, 0, 0, -1, 1, 0, 0, 1},
+    /* ul-lr: u = t, v = s */
+    {0, 1, 0, 1, 0, 0, 0, 0, 1},
+    /* ur-ll: u = 1 - t, v = 1 - s */
+    {0, -1, 1, -1, 0, 1, 0, 0, 1},
+  };
+
+  if (method > GST_VIDEO_ORIENTATION_UR_LL)
+    method = GST_VIDEO_ORIENTATION_IDENTITY;
+
+  memcpy (m, flips[method], sizeof (flips[method]));
+}
+
+static gboolean
+deskew_prepare (GstGeometricTransform * gt)
+{
+  GstDeskew *deskew = GST_DESKEW_CAST (gt);
+  gdouble quad[9], flip[9];
+  gdouble scale[9] = { 0, };
+  gdouble full_frame[8];
+  const gdouble *points = deskew->points;
+
+  if (!deskew->have_points) {
+    full_frame[0] = 0;
+    full_frame[1] = 0;
+    full_frame[2] = gt->in_width - 1;
+    full_frame[3] = 0;
+    full_frame[4] = gt->in_width - 1;
+    full_frame[5] = gt->in_height - 1;
+    full_frame[6] = 0;
+    full_frame[7] = gt->in_height - 1;
+    points = full_frame;
+  }
+
+  if (!square_to_quad (points, quad)) {
+    GST_WARNING_OBJECT (deskew, "Degenerate points, can't deskew");
+    return FALSE;
+  }
+
+  get_flip_matrix (deskew->method, flip);
+
+  /* output pixel to [0, 1], the corner pixels map to the corner points */
+  scale[0] = 1.0 / MAX (gt->width - 1, 1);
+  scale[4] = 1.0 / MAX (gt->height - 1, 1);
+  scale[8] = 1;
+
+  matrix_multiply (deskew->matrix, quad, flip);
+  matrix_multiply (deskew->matrix, deskew->matrix, scale);
+
+  return TRUE;
+}
+
+static gboolean
+deskew_map (GstGeometricTransform * gt, gint x, gint y, gdouble * in_x,
+    gdouble * in_y)
+{
+  GstDeskew *deskew = GST_DESKEW_CAST (gt);
+  const gdouble *m = deskew->matrix;
+  gdouble w;
+
+  w = m[6] * x + m[7] * y + m[8];
+
+  *in_x = (m[0] * x + m[1] * y + m[2]) / w;
+  *in_y = (m[3] * x + m[4] * y + m[5]) / w;
+
+  return TRUE;
+}
+
+static gboolean
+deskew_hash (GstGeometricTransform * gt, GChecksum * checksum)
+{
+  GstDeskew *deskew = GST_DESKEW_CAST (gt);
+
+  /* points, direction and size all end up in the matrix */
+  g_checksum_update (checksum, (const guchar *) deskew->matrix,
+      sizeof (deskew->matrix));
+
+  return TRUE;
+}
+
+static void
+gst_deskew_class_init (GstDeskewClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstBaseTransformClass *trans_class;
+  GstGeometricTransformClass *gstgt_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+  trans_class = (GstBaseTransformClass *) klass;
+  gstgt_class = (GstGeometricTransformClass *) klass;
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "deskew",
+      "Filter/Effect/Converter/Video/Scaler",
+      "Straighten, flip and scale a quadrilateral area of the video in one pass",
+      "binaryCameraRecorder developers");
+
+  gobject_class->set_property = gst_deskew_set_property;
+  gobject_class->get_property = gst_deskew_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_POINTS,
+      g_param_spec_value_array ("points",
+          "Points",
+          "Top-left, top-right, bottom-right and bottom-left corners of the area to deskew in input pixels, passed as an array of 8 elements x0, y0, x1, y1... (empty for the whole frame)",
+          g_param_spec_double ("Element",
+              "Point coordinate",
+              "Coordinate of a corner point",
+              -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_VIDEO_DIRECTION,
+      g_param_spec_enum ("video-direction", "Video direction",
+          "Flip or rotation applied after deskewing",
+          GST_TYPE_VIDEO_ORIENTATION_METHOD, DEFAULT_VIDEO_DIRECTION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  trans_class->transform_caps = GST_DEBUG_FUNCPTR (gst_deskew_transform_caps);
+  trans_class->fixate_caps = GST_DEBUG_FUNCPTR (gst_deskew_fixate_caps);
+
+  gstgt_class->prepare_func = deskew_prepare;
+  gstgt_class->map_func = deskew_map;
+  gstgt_class->hash_func = deskew_hash;
+}
+
+static void
+gst_deskew_init (GstDeskew * filter)
+{
+  filter->method = DEFAULT_VIDEO_DIRECTION;
+  filter->have_points = FALSE;
+}
@@ -0,0 +1,70 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_DESKEW_H__
+#define __GST_DESKEW_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include "gstgeometrictransform.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DESKEW \
+  (gst_deskew_get_type())
+#define GST_DESKEW(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_DESKEW,GstDeskew))
+#define GST_DESKEW_CAST(obj) \
+  ((GstDeskew *)(obj))
+#define GST_DESKEW_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_DESKEW,GstDeskewClass))
+#define GST_IS_DESKEW(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_DESKEW))
+#define GST_IS_DESKEW_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_DESKEW))
+
+typedef struct _GstDeskew      GstDeskew;
+typedef struct _GstDeskewClass GstDeskewClass;
+
+struct _GstDeskew
+{
+  GstGeometricTransform element;
+
+  /* top-left, top-right, bottom-right and bottom-left corners of the area
+   * to deskew, in input pixels, as (x, y) pairs */
+  gdouble points[8];
+  gboolean have_points;
+
+  GstVideoOrientationMethod method;
+
+  /* output pixel to input pixel, scale, flip and deskew combined */
+  gdouble matrix[9];
+};
+
+struct _GstDeskewClass
+{
+  GstGeometricTransformClass parent_class;
+};
+
+GType gst_deskew_get_type (void);
+
+GST_ELEMENT_REGISTER_DECLARE (deskew);
+
+G_END_DECLS
+
+#endif /* __GST_DESKEW_H__ */
@@ -23,6 +23,8 @@
 
 #include "gstgeometrictransform.h"
 #include "geometricmath.h"
+#include "geometricremap.h"
+#include "geometricmapcache.h"
 #include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (geometric_transform_debug);
@@ -33,7 +35,8 @@ GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ ARGB, BGR, BGRA, BGRx, RGB, "
-            "RGBA, RGBx, AYUV, xBGR, xRGB, GRAY8, GRAY16_BE, GRAY16_LE }"))
+            "RGBA, RGBx, AYUV, xBGR, xRGB, GRAY8, GRAY16_BE, GRAY16_LE, "
+            "I420, YV12, NV12, NV21, Y42B, Y444 }"))
     );
 
 static GstStaticPadTemplate gst_geometric_transform_sink_template =
@@ -41,7 +44,8 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ ARGB, BGR, BGRA, BGRx, RGB, "
-            "RGBA, RGBx, AYUV, xBGR, xRGB, GRAY8, GRAY16_BE, GRAY16_LE }"))
+            "RGBA, RGBx, AYUV, xBGR, xRGB, GRAY8, GRAY16_BE, GRAY16_LE, "
+            "I420, YV12, NV12, NV21, Y42B, Y444 }"))
     );
 
 static GstVideoFilterClass *parent_class = NULL;
@@ -49,7 +53,11 @@ static GstVideoFilterClass *parent_class = NULL;
 enum
 {
   PROP_0,
-  PROP_OFF_EDGE_PIXELS
+  PROP_OFF_EDGE_PIXELS,
+  PROP_N_THREADS,
+  PROP_INTERPOLATION,
+  PROP_VALID_RATIO,
+  PROP_MAP_CACHE_DIR
 };
 
 #define GST_GT_OFF_EDGES_PIXELS_METHOD_TYPE ( \
@@ -74,57 +82,568 @@ gst_geometric_transform_off_edges_pixels_method_get_type (void)
   return method_type;
 }
 
+#define GST_GT_INTERPOLATION_TYPE ( \
+    gst_geometric_transform_interpolation_get_type())
+static GType
+gst_geometric_transform_interpolation_get_type (void)
+{
+  static GType interpolation_type = 0;
+
+  static const GEnumValue interpolation_types[] = {
+    {GST_GT_INTERPOLATION_NEAREST, "Nearest neighbour", "nearest"},
+    {GST_GT_INTERPOLATION_BILINEAR, "Bilinear", "bilinear"},
+    {GST_GT_INTERPOLATION_BICUBIC, "Bicubic", "bicubic"},
+    {0, NULL, NULL}
+  };
+
+  if (!interpolation_type) {
+    interpolation_type =
+        g_enum_register_static ("GstGeometricTransformInterpolation",
+        interpolation_types);
+  }
+  return interpolation_type;
+}
+
 #define DEFAULT_OFF_EDGE_PIXELS GST_GT_OFF_EDGES_PIXELS_IGNORE
+#define DEFAULT_N_THREADS 1
+#define DEFAULT_INTERPOLATION GST_GT_INTERPOLATION_NEAREST
+#define DEFAULT_MAP_CACHE_DIR NULL
+
+/* Describes one plane of the frames being warped. Packed formats only have
+ * one; planar YUV formats have one per plane, with the chroma ones sampled
+ * through the subsampled chroma map. */
+typedef struct
+{
+  guint8 *in_data;
+  guint8 *out_data;
+  gint in_stride;
+  gint out_stride;
+  gint pixel_stride;
+  /* size of the output plane, and of the input one it is sampled from */
+  gint width;
+  gint height;
+  gint in_width;
+  gint in_height;
+  /* log2 of the plane subsampling, to go from plane to luma coordinates */
+  gint w_sub;
+  gint h_sub;
+  gdouble *map;
+  gint16 *compact_map;
+  const guint8 *compact_frac;
+  const GstGeometricTransformSpan *spans;
+  gint interpolation;
+  /* value to clear the plane with */
+  guint8 black;
+  /* set when the two bytes of every pixel go to separate output planes,
+   * out_data is not used then */
+  guint8 *split_out_data[2];
+  gint split_out_stride[2];
+} GstGeometricTransformPlane;
+
+/* A horizontal slice of the output frame, one per worker thread */
+typedef struct
+{
+  GstGeometricTransform *gt;
+  const GstGeometricTransformPlane *planes;
+  guint n_planes;
+  guint index;
+  guint n_bands;
+  /* row the split chroma of this band is warped into, NULL if not split */
+  guint8 *split_row;
+  gboolean ret;
+} GstGeometricTransformBand;
+
+static guint gst_geometric_transform_get_n_bands (GstGeometricTransform * gt);
+static void gst_geometric_transform_alloc_split_rows (GstGeometricTransform *
+    gt, guint n_bands);
+
+/* Applies the off-edge policy to an input position and truncates it to the
+ * input pixel to copy, @frac gets the position inside that pixel in 1/256th.
+ * Returns FALSE if there is nothing to copy. */
+static inline gboolean
+gst_geometric_transform_resolve_pixel (gint off_edge_pixels, gdouble in_x,
+    gdouble in_y, gint width, gint height, gint * pixel_x, gint * pixel_y,
+    guint8 * frac)
+{
+  switch (off_edge_pixels) {
+    case GST_GT_OFF_EDGES_PIXELS_CLAMP:
+      in_x = CLAMP (in_x, 0, width - 1);
+      in_y = CLAMP (in_y, 0, height - 1);
+      break;
+
+    case GST_GT_OFF_EDGES_PIXELS_WRAP:
+      in_x = gst_gm_mod_float (in_x, width);
+      in_y = gst_gm_mod_float (in_y, height);
+      if (in_x < 0)
+        in_x += width;
+      if (in_y < 0)
+        in_y += height;
+      break;
+
+    default:
+      break;
+  }
+
+  *pixel_x = (gint) in_x;
+  *pixel_y = (gint) in_y;
+
+  if (frac) {
+    frac[0] = CLAMP ((gint) ((in_x - *pixel_x) * 256), 0, 255);
+    frac[1] = CLAMP ((gint) ((in_y - *pixel_y) * 256), 0, 255);
+  }
+
+  return *pixel_x >= 0 && *pixel_x < width && *pixel_y >= 0
+      && *pixel_y < height;
+}
+
+static inline void
+gst_geometric_transform_resolve_compact (gint off_edge_pixels, gdouble in_x,
+    gdouble in_y, gint width, gint height, gint16 * entry, guint8 * frac)
+{
+  gint pixel_x, pixel_y;
+
+  if (gst_geometric_transform_resolve_pixel (off_edge_pixels, in_x, in_y,
+          width, height, &pixel_x, &pixel_y, frac)) {
+    entry[0] = pixel_x;
+    entry[1] = pixel_y;
+  } else {
+    entry[0] = entry[1] = -1;
+  }
+}
 
 /* must be called with the object lock */
-static gboolean
-gst_geometric_transform_generate_map (GstGeometricTransform * gt)
+static void
+gst_geometric_transform_free_maps (GstGeometricTransform * gt)
+{
+  g_clear_pointer (&gt->current_map, gst_gm_map_unref);
+  g_clear_pointer (&gt->next_map, gst_gm_map_unref);
+}
+
+/* Finds the span of every row of a compact map, and counts the output
+ * pixels that have an input pixel */
+static GstGeometricTransformSpan *
+gst_geometric_transform_generate_spans (const gint16 * map, gint width,
+    gint height, guint64 * n_valid)
+{
+  GstGeometricTransformSpan *spans = g_new (GstGeometricTransformSpan, height);
+  gint x, y;
+
+  *n_valid = 0;
+
+  for (y = 0; y < height; y++) {
+    GstGeometricTransformSpan *span = &spans[y];
+    gint n = 0;
+
+    span->start = span->end = 0;
+    for (x = 0; x < width; x++, map += 2) {
+      if (map[0] < 0)
+        continue;
+      if (n++ == 0)
+        span->start = x;
+      span->end = x + 1;
+    }
+    span->holes = n != span->end - span->start;
+    *n_valid += n;
+  }
+
+  return spans;
+}
+
+/* must be called with the object lock */
+static gint
+gst_geometric_transform_get_interpolation (GstGeometricTransform * gt)
+{
+  /* the interpolating loops take gint16 coordinates, like the compact map */
+  if (!gt->can_interpolate || gt->in_width > G_MAXINT16
+      || gt->in_height > G_MAXINT16)
+    return GST_GT_INTERPOLATION_NEAREST;
+
+  return gt->interpolation;
+}
+
+/* derive the chroma map from the luma one, so that both planes use exactly
+ * the same transform */
+static void
+gst_geometric_transform_generate_chroma_map (GstGeometricTransform * gt,
+    GstGeometricTransformMap * map)
+{
+  gint x, y;
+  gdouble *ptr;
+  gdouble x_scale, y_scale;
+
+  if (!gt->planar_yuv || (gt->chroma_w_sub == 0 && gt->chroma_h_sub == 0))
+    return;
+
+  x_scale = 1.0 / (1 << gt->chroma_w_sub);
+  y_scale = 1.0 / (1 << gt->chroma_h_sub);
+
+  map->chroma_map =
+      g_malloc0 (sizeof (gdouble) * gt->chroma_width * gt->chroma_height * 2);
+  ptr = map->chroma_map;
+
+  for (y = 0; y < gt->chroma_height; y++) {
+    gdouble *luma_row = map->map + (y << gt->chroma_h_sub) * gt->width * 2;
+
+    for (x = 0; x < gt->chroma_width; x++) {
+      gdouble *luma = luma_row + (x << gt->chroma_w_sub) * 2;
+
+      ptr[0] = luma[0] * x_scale;
+      ptr[1] = luma[1] * y_scale;
+      ptr += 2;
+    }
+  }
+}
+
+/* Generates a map for the current size and properties. Only reads the
+ * element, so it can run without the object lock while frames are warped
+ * with the previous map, see gst_geometric_transform_remap_thread(). */
+static GstGeometricTransformMap *
+gst_geometric_transform_map_new (GstGeometricTransform * gt)
 {
   gint x, y;
   gdouble in_x, in_y;
-  gboolean ret = TRUE;
   GstGeometricTransformClass *klass;
-  gdouble *ptr;
+  GstGeometricTransformMap *map;
+  gdouble *ptr = NULL;
+  gint16 *compact_ptr = NULL;
+  gint16 *compact_chroma_ptr = NULL;
+  guint8 *frac_ptr = NULL;
+  guint8 *chroma_frac_ptr = NULL;
+  gboolean compact, chroma_subsampled, interpolate;
+  gint off_edge_pixels;
+  gint x_mask, y_mask;
+  gdouble x_scale, y_scale;
 
   GST_INFO_OBJECT (gt, "Generating new transform map");
 
-  /* cleanup old map */
-  g_free (gt->map);
-  gt->map = NULL;
-
   klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
 
   /* subclass must have defined the map_func */
-  g_return_val_if_fail (klass->map_func, FALSE);
-
-  /*
-   * (x,y) pairs of the inverse mapping
-   */
-  gt->map = g_malloc0 (sizeof (gdouble) * gt->width * gt->height * 2);
-  ptr = gt->map;
+  g_return_val_if_fail (klass->map_func, NULL);
+
+  map = gst_gm_map_new ();
+
+  off_edge_pixels = gt->off_edge_pixels;
+  chroma_subsampled = gt->planar_yuv &&
+      (gt->chroma_w_sub != 0 || gt->chroma_h_sub != 0);
+  x_mask = (1 << gt->chroma_w_sub) - 1;
+  y_mask = (1 << gt->chroma_h_sub) - 1;
+  x_scale = 1.0 / (1 << gt->chroma_w_sub);
+  y_scale = 1.0 / (1 << gt->chroma_h_sub);
+
+  /* The compact map stores the final input pixel of every output pixel as
+   * a pair of gint16, 4 times less memory to walk per frame than the
+   * gdouble pairs, which are only kept for frames too big for it. */
+  compact = gt->in_width <= G_MAXINT16 && gt->in_height <= G_MAXINT16;
+  interpolate = gst_geometric_transform_get_interpolation (gt) !=
+      GST_GT_INTERPOLATION_NEAREST;
+
+  if (compact) {
+    map->compact_map = g_new (gint16, gt->width * gt->height * 2);
+    compact_ptr = map->compact_map;
+    if (interpolate) {
+      map->compact_frac = g_new (guint8, gt->width * gt->height * 2);
+      frac_ptr = map->compact_frac;
+    }
+    if (chroma_subsampled) {
+      map->compact_chroma_map =
+          g_new (gint16, gt->chroma_width * gt->chroma_height * 2);
+      compact_chroma_ptr = map->compact_chroma_map;
+      if (interpolate) {
+        map->compact_chroma_frac =
+            g_new (guint8, gt->chroma_width * gt->chroma_height * 2);
+        chroma_frac_ptr = map->compact_chroma_frac;
+      }
+    }
+  } else {
+    /*
+     * (x,y) pairs of the inverse mapping
+     */
+    map->map = g_malloc0 (sizeof (gdouble) * gt->width * gt->height * 2);
+    ptr = map->map;
+  }
 
   for (y = 0; y < gt->height; y++) {
     for (x = 0; x < gt->width; x++) {
       if (!klass->map_func (gt, x, y, &in_x, &in_y)) {
         /* child should have warned */
-        ret = FALSE;
-        goto end;
+        GST_WARNING_OBJECT (gt, "Generating transform map failed");
+        gst_gm_map_unref (map);
+        return NULL;
       }
 
-      ptr[0] = in_x;
-      ptr[1] = in_y;
-      ptr += 2;
+      if (compact) {
+        gst_geometric_transform_resolve_compact (off_edge_pixels, in_x,
+            in_y, gt->in_width, gt->in_height, compact_ptr, frac_ptr);
+        compact_ptr += 2;
+        if (frac_ptr)
+          frac_ptr += 2;
+
+        /* chroma samples use the luma sample at their top-left corner */
+        if (chroma_subsampled && (x & x_mask) == 0 && (y & y_mask) == 0) {
+          gst_geometric_transform_resolve_compact (off_edge_pixels,
+              in_x * x_scale, in_y * y_scale, gt->in_chroma_width,
+              gt->in_chroma_height, compact_chroma_ptr, chroma_frac_ptr);
+          compact_chroma_ptr += 2;
+          if (chroma_frac_ptr)
+            chroma_frac_ptr += 2;
+        }
+      } else {
+        ptr[0] = in_x;
+        ptr[1] = in_y;
+        ptr += 2;
+      }
     }
   }
 
-end:
-  if (!ret) {
-    GST_WARNING_OBJECT (gt, "Generating transform map failed");
-    g_free (gt->map);
-    gt->map = NULL;
-  } else
-    gt->needs_remap = FALSE;
-  return ret;
+  if (compact) {
+    guint64 n_valid, n_chroma_valid;
+
+    map->compact_spans =
+        gst_geometric_transform_generate_spans (map->compact_map, gt->width,
+        gt->height, &n_valid);
+    if (map->compact_chroma_map)
+      map->compact_chroma_spans =
+          gst_geometric_transform_generate_spans (map->compact_chroma_map,
+          gt->chroma_width, gt->chroma_height, &n_chroma_valid);
+
+    map->valid_ratio = (gdouble) n_valid / ((guint64) gt->width * gt->height);
+    GST_INFO_OBJECT (gt, "%.1f%% of the output pixels are warped",
+        map->valid_ratio * 100);
+  } else {
+    gst_geometric_transform_generate_chroma_map (gt, map);
+    map->valid_ratio = 1.0;
+  }
+
+  return map;
+}
+
+/* Returns the map cache key for the current parameters, or NULL if the
+ * map can't be cached.
+ * must be called with the object lock, after the prepare_func */
+static gchar *
+gst_geometric_transform_get_map_key (GstGeometricTransform * gt)
+{
+  GstGeometricTransformClass *klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
+  GChecksum *checksum;
+  gchar *key = NULL;
+  gint32 params[9];
+
+  /* only compact maps are cached */
+  if (!klass->hash_func || gt->in_width > G_MAXINT16
+      || gt->in_height > G_MAXINT16)
+    return NULL;
+
+  params[0] = gt->width;
+  params[1] = gt->height;
+  params[2] = gt->in_width;
+  params[3] = gt->in_height;
+  params[4] = gt->format;
+  params[5] = gt->off_edge_pixels;
+  /* bilinear and bicubic sample the same positions, they share the map */
+  params[6] = gst_geometric_transform_get_interpolation (gt) !=
+      GST_GT_INTERPOLATION_NEAREST;
+  params[7] = gt->chroma_w_sub;
+  params[8] = gt->chroma_h_sub;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *) G_OBJECT_TYPE_NAME (gt), -1);
+  g_checksum_update (checksum, (const guchar *) params, sizeof (params));
+  if (klass->hash_func (gt, checksum))
+    key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+static void
+gst_geometric_transform_get_map_layout (GstGeometricTransform * gt,
+    GstGMMapLayout * layout)
+{
+  gboolean chroma_subsampled = gt->planar_yuv &&
+      (gt->chroma_w_sub != 0 || gt->chroma_h_sub != 0);
+
+  layout->width = gt->width;
+  layout->height = gt->height;
+  layout->chroma_width = chroma_subsampled ? gt->chroma_width : 0;
+  layout->chroma_height = chroma_subsampled ? gt->chroma_height : 0;
+  layout->in_width = gt->in_width;
+  layout->in_height = gt->in_height;
+  layout->in_chroma_width = chroma_subsampled ? gt->in_chroma_width : 0;
+  layout->in_chroma_height = chroma_subsampled ? gt->in_chroma_height : 0;
+  layout->frac = gst_geometric_transform_get_interpolation (gt) !=
+      GST_GT_INTERPOLATION_NEAREST;
+}
+
+/* Like gst_geometric_transform_map_new(), but returns the map of the other
+ * elements with the same @key, or the one in the map cache, if there is
+ * one. Sets @generated when the map is a new one, which isn't shared until
+ * gst_geometric_transform_map_share() is called on it. */
+static GstGeometricTransformMap *
+gst_geometric_transform_map_get (GstGeometricTransform * gt, const gchar * key,
+    const gchar * cache_dir, gboolean * generated)
+{
+  GstGeometricTransformMap *map;
+  GstGMMapLayout layout;
+
+  *generated = FALSE;
+  if (key) {
+    gst_geometric_transform_get_map_layout (gt, &layout);
+    map = gst_gm_map_cache_lookup (key, cache_dir, &layout);
+    if (map) {
+      GST_INFO_OBJECT (gt, "Using cached transform map");
+      return map;
+    }
+  }
+
+  map = gst_geometric_transform_map_new (gt);
+  *generated = map != NULL;
+  return map;
+}
+
+/* Shares a map generated for @key with the other elements and stores it in
+ * the map cache. Returns the map to use, which is the one already shared
+ * if another element was faster.
+ * must be called with the object lock, with the parameters @map was
+ * generated with */
+static GstGeometricTransformMap *
+gst_geometric_transform_map_share (GstGeometricTransform * gt,
+    const gchar * key, const gchar * cache_dir, GstGeometricTransformMap * map)
+{
+  GstGeometricTransformMap *cached;
+  GstGMMapLayout layout;
+
+  if (!key)
+    return map;
+
+  gst_geometric_transform_get_map_layout (gt, &layout);
+  cached = gst_gm_map_cache_store (key, cache_dir, &layout, map);
+  if (cached) {
+    gst_gm_map_unref (map);
+    map = cached;
+  }
+
+  return map;
+}
+
+/* Replaces the maps with a new one right away.
+ * must be called with the object lock */
+static gboolean
+gst_geometric_transform_generate_map (GstGeometricTransform * gt)
+{
+  GstGeometricTransformMap *map;
+  gboolean generated;
+  gchar *key;
+
+  /* cleanup old map */
+  gst_geometric_transform_free_maps (gt);
+
+  key = gst_geometric_transform_get_map_key (gt);
+  map = gst_geometric_transform_map_get (gt, key, gt->map_cache_dir,
+      &generated);
+  if (generated)
+    map = gst_geometric_transform_map_share (gt, key, gt->map_cache_dir, map);
+  g_free (key);
+  if (!map)
+    return FALSE;
+
+  gt->current_map = map;
+  gt->needs_remap = FALSE;
+  return TRUE;
+}
+
+static gpointer
+gst_geometric_transform_remap_thread (gpointer data)
+{
+  GstGeometricTransform *gt = data;
+  GstGeometricTransformClass *klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
+  GstGeometricTransformMap *map;
+
+  GST_OBJECT_LOCK (gt);
+  while (!gt->remap_cancel) {
+    guint cookie = gt->remap_cookie;
+    gboolean prepared = !klass->prepare_func || klass->prepare_func (gt);
+    gchar *key = prepared ? gst_geometric_transform_get_map_key (gt) : NULL;
+    gchar *cache_dir = g_strdup (gt->map_cache_dir);
+    gboolean generated = FALSE;
+
+    /* the prepare_func copied whatever the map_func reads */
+    GST_OBJECT_UNLOCK (gt);
+    map = prepared ? gst_geometric_transform_map_get (gt, key, cache_dir,
+        &generated) : NULL;
+    GST_OBJECT_LOCK (gt);
+
+    if (cookie != gt->remap_cookie) {
+      /* the properties changed meanwhile, start over. The map may mix the
+       * old and new ones, it is never shared. */
+      g_clear_pointer (&map, gst_gm_map_unref);
+      g_free (cache_dir);
+      g_free (key);
+      continue;
+    }
+
+    if (generated)
+      map = gst_geometric_transform_map_share (gt, key, cache_dir, map);
+    g_free (cache_dir);
+    g_free (key);
+
+    if (map) {
+      g_clear_pointer (&gt->next_map, gst_gm_map_unref);
+      gt->next_map = map;
+    } else {
+      GST_WARNING_OBJECT (gt, "Keeping the previous transform map");
+    }
+    break;
+  }
+  gt->remap_running = FALSE;
+  GST_OBJECT_UNLOCK (gt);
+
+  return NULL;
+}
+
+/* Generates a new map off the streaming thread, transform_frame keeps using
+ * the current one until it is done.
+ * must be called with the object lock */
+static void
+gst_geometric_transform_start_remap (GstGeometricTransform * gt)
+{
+  gt->needs_remap = FALSE;
+
+  /* a running thread notices the new cookie and starts over */
+  if (gt->remap_running)
+    return;
+
+  /* the previous thread is done, this doesn't block */
+  if (gt->remap_thread)
+    g_thread_join (gt->remap_thread);
+
+  gt->remap_running = TRUE;
+  gt->remap_thread = g_thread_new ("gt-remap",
+      gst_geometric_transform_remap_thread, gt);
+}
+
+/* Waits for the map generation thread to be gone.
+ * must be called without the object lock */
+static void
+gst_geometric_transform_stop_remap (GstGeometricTransform * gt)
+{
+  GThread *thread;
+
+  GST_OBJECT_LOCK (gt);
+  thread = gt->remap_thread;
+  gt->remap_thread = NULL;
+  gt->remap_cancel = TRUE;
+  /* the map it was generating is still needed */
+  if (gt->remap_running)
+    gt->needs_remap = TRUE;
+  GST_OBJECT_UNLOCK (gt);
+
+  if (thread)
+    g_thread_join (thread);
+
+  GST_OBJECT_LOCK (gt);
+  gt->remap_cancel = FALSE;
+  GST_OBJECT_UNLOCK (gt);
 }
 
 static gboolean
@@ -135,23 +654,84 @@ gst_geometric_transform_set_info (GstVideoFilter * vfilter, GstCaps * incaps,
   gboolean ret = TRUE;
   gint old_width;
   gint old_height;
+  gint old_in_width;
+  gint old_in_height;
+  gint old_chroma_w_sub;
+  gint old_chroma_h_sub;
+  gboolean old_planar_yuv;
+  gboolean old_can_interpolate;
   GstGeometricTransformClass *klass;
 
   gt = GST_GEOMETRIC_TRANSFORM_CAST (vfilter);
   klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
 
+  /* the map generation thread reads the size */
+  gst_geometric_transform_stop_remap (gt);
+
   old_width = gt->width;
   old_height = gt->height;
+  old_in_width = gt->in_width;
+  old_in_height = gt->in_height;
+  old_planar_yuv = gt->planar_yuv;
+  old_chroma_w_sub = gt->chroma_w_sub;
+  old_chroma_h_sub = gt->chroma_h_sub;
+  old_can_interpolate = gt->can_interpolate;
+
+  if (GST_VIDEO_INFO_FORMAT (in_info) != GST_VIDEO_INFO_FORMAT (out_info)) {
+    /* the only conversion done while warping: splitting NV12/NV21 chroma */
+    if (GST_VIDEO_INFO_N_PLANES (in_info) != 2
+        || GST_VIDEO_INFO_N_PLANES (out_info) != 3
+        || !GST_VIDEO_INFO_IS_YUV (in_info) || !GST_VIDEO_INFO_IS_YUV (out_info)
+        || GST_VIDEO_INFO_COMP_DEPTH (in_info, 0) != 8
+        || GST_VIDEO_INFO_COMP_DEPTH (out_info, 0) != 8
+        || GST_VIDEO_FORMAT_INFO_W_SUB (in_info->finfo, 1) !=
+        GST_VIDEO_FORMAT_INFO_W_SUB (out_info->finfo, 1)
+        || GST_VIDEO_FORMAT_INFO_H_SUB (in_info->finfo, 1) !=
+        GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, 1)) {
+      GST_ERROR_OBJECT (gt, "Can't convert from %s to %s",
+          GST_VIDEO_INFO_NAME (in_info), GST_VIDEO_INFO_NAME (out_info));
+      return FALSE;
+    }
+    gt->split_chroma = TRUE;
+  } else {
+    gt->split_chroma = FALSE;
+  }
 
-  gt->width = in_info->width;
-  gt->height = in_info->height;
+  gt->width = out_info->width;
+  gt->height = out_info->height;
+  gt->in_width = in_info->width;
+  gt->in_height = in_info->height;
+  gt->format = GST_VIDEO_INFO_FORMAT (in_info);
   gt->row_stride = in_info->stride[0];
   gt->pixel_stride = GST_VIDEO_INFO_COMP_PSTRIDE (in_info, 0);
 
+  gt->planar_yuv = GST_VIDEO_INFO_IS_YUV (in_info)
+      && GST_VIDEO_INFO_N_PLANES (in_info) > 1;
+  if (gt->planar_yuv) {
+    gt->chroma_w_sub = GST_VIDEO_FORMAT_INFO_W_SUB (in_info->finfo, 1);
+    gt->chroma_h_sub = GST_VIDEO_FORMAT_INFO_H_SUB (in_info->finfo, 1);
+    gt->chroma_width = GST_VIDEO_INFO_COMP_WIDTH (out_info, 1);
+    gt->chroma_height = GST_VIDEO_INFO_COMP_HEIGHT (out_info, 1);
+    gt->in_chroma_width = GST_VIDEO_INFO_COMP_WIDTH (in_info, 1);
+    gt->in_chroma_height = GST_VIDEO_INFO_COMP_HEIGHT (in_info, 1);
+  } else {
+    gt->chroma_w_sub = gt->chroma_h_sub = 0;
+    gt->chroma_width = gt->chroma_height = 0;
+    gt->in_chroma_width = gt->in_chroma_height = 0;
+  }
+
+  /* interpolation works on every byte separately */
+  gt->can_interpolate = GST_VIDEO_INFO_COMP_DEPTH (in_info, 0) == 8;
+
   /* regenerate the map */
   GST_OBJECT_LOCK (gt);
-  if (gt->map == NULL || old_width == 0 || old_height == 0
-      || gt->width != old_width || gt->height != old_height) {
+  if (gt->current_map == NULL || old_width == 0 || old_height == 0
+      || gt->width != old_width || gt->height != old_height
+      || gt->in_width != old_in_width || gt->in_height != old_in_height
+      || gt->planar_yuv != old_planar_yuv
+      || gt->chroma_w_sub != old_chroma_w_sub
+      || gt->chroma_h_sub != old_chroma_h_sub
+      || gt->can_interpolate != old_can_interpolate) {
     if (klass->prepare_func)
       if (!klass->prepare_func (gt)) {
         GST_OBJECT_UNLOCK (gt);
@@ -160,52 +740,238 @@ gst_geometric_transform_set_info (GstVideoFilter * vfilter, GstCaps * incaps,
     if (gt->precalc_map)
       gst_geometric_transform_generate_map (gt);
   }
+  gst_geometric_transform_alloc_split_rows (gt,
+      gst_geometric_transform_get_n_bands (gt));
   GST_OBJECT_UNLOCK (gt);
   return ret;
 }
 
+/* Scatters a row of interleaved 2 byte pixels to the two split planes */
 static void
-gst_geometric_transform_do_map (GstGeometricTransform * gt, guint8 * in_data,
-    guint8 * out_data, gint x, gint y, gdouble in_x, gdouble in_y)
+gst_geometric_transform_split_row (const GstGeometricTransformPlane * plane,
+    const guint8 * row, gint x, gint y, gint width)
 {
-  gint in_offset;
-  gint out_offset;
-
-  out_offset = y * gt->row_stride + x * gt->pixel_stride;
+  guint8 *out0 = plane->split_out_data[0] + y * plane->split_out_stride[0];
+  guint8 *out1 = plane->split_out_data[1] + y * plane->split_out_stride[1];
+  gint i;
+
+  for (i = x; i < x + width; i++) {
+    out0[i] = row[0];
+    out1[i] = row[1];
+    row += 2;
+  }
+}
 
-  /* operate on out of edge pixels */
-  switch (gt->off_edge_pixels) {
-    case GST_GT_OFF_EDGES_PIXELS_CLAMP:
-      in_x = CLAMP (in_x, 0, gt->width - 1);
-      in_y = CLAMP (in_y, 0, gt->height - 1);
+static void
+gst_geometric_transform_do_map (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint x, gint y, gdouble in_x,
+    gdouble in_y)
+{
+  gint in_offset;
+  guint8 *out;
+  gint trunc_x, trunc_y;
+  gint16 entry[2];
+  guint8 frac[2];
+  guint8 split_pixel[2];
+  GstGMInterpolateRowFunc interpolate_row;
+
+  /* only set the values if the values are valid */
+  if (!gst_geometric_transform_resolve_pixel (gt->off_edge_pixels, in_x, in_y,
+          plane->in_width, plane->in_height, &trunc_x, &trunc_y, frac))
+    return;
+
+  if (plane->split_out_data[0])
+    out = split_pixel;
+  else
+    out = plane->out_data + y * plane->out_stride + x * plane->pixel_stride;
+
+  switch (plane->interpolation) {
+    case GST_GT_INTERPOLATION_BILINEAR:
+      interpolate_row = gst_gm_remap_row_bilinear;
       break;
-
-    case GST_GT_OFF_EDGES_PIXELS_WRAP:
-      in_x = gst_gm_mod_float (in_x, gt->width);
-      in_y = gst_gm_mod_float (in_y, gt->height);
-      if (in_x < 0)
-        in_x += gt->width;
-      if (in_y < 0)
-        in_y += gt->height;
+    case GST_GT_INTERPOLATION_BICUBIC:
+      interpolate_row = gst_gm_remap_row_bicubic;
       break;
-
     default:
+      interpolate_row = NULL;
       break;
   }
 
-  {
-    gint trunc_x = (gint) in_x;
-    gint trunc_y = (gint) in_y;
-    /* only set the values if the values are valid */
-    if (trunc_x >= 0 && trunc_x < gt->width && trunc_y >= 0 &&
-        trunc_y < gt->height) {
-      in_offset = trunc_y * gt->row_stride + trunc_x * gt->pixel_stride;
+  if (interpolate_row) {
+    /* a one pixel row */
+    entry[0] = trunc_x;
+    entry[1] = trunc_y;
+    interpolate_row (out, plane->in_data, plane->in_stride, plane->in_width,
+        plane->in_height, plane->pixel_stride, entry, frac, 1);
+  } else {
+    in_offset = trunc_y * plane->in_stride + trunc_x * plane->pixel_stride;
+
+    memcpy (out, plane->in_data + in_offset, plane->pixel_stride);
+  }
+
+  if (plane->split_out_data[0])
+    gst_geometric_transform_split_row (plane, split_pixel, x, y, 1);
+}
+
+/* Clears pixels [x_start, x_end) of row @y of the output plane */
+static void
+gst_geometric_transform_fill_black_span (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint y, gint x_start, gint x_end)
+{
+  guint8 *out_data;
+  gint x, k;
+
+  if (x_start >= x_end)
+    return;
+
+  if (plane->split_out_data[0]) {
+    for (k = 0; k < 2; k++)
+      memset (plane->split_out_data[k] + y * plane->split_out_stride[k] +
+          x_start, plane->black, x_end - x_start);
+    return;
+  }
+
+  out_data = plane->out_data + y * plane->out_stride;
+
+  if (gt->format == GST_VIDEO_FORMAT_AYUV) {
+    for (x = x_start; x < x_end; x++)
+      GST_WRITE_UINT32_BE (out_data + x * 4, 0xff108080);
+  } else {
+    memset (out_data + x_start * plane->pixel_stride, plane->black,
+        (x_end - x_start) * plane->pixel_stride);
+  }
+}
+
+/* Warps rows [y_start, y_end) of the plane, only the span of each row goes
+ * through the remap loops and the rest is cleared. @tmp_row holds one
+ * output row when the plane is split. */
+static void
+gst_geometric_transform_remap_plane_compact (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint y_start, gint y_end,
+    guint8 * tmp_row)
+{
+  gint pixel_stride = plane->pixel_stride;
+  GstGMRemapRowFunc remap_row = NULL;
+  GstGMInterpolateRowFunc interpolate_row = NULL;
+  gsize in_size;
+  gint x, y;
+
+  if (plane->compact_frac) {
+    interpolate_row = plane->interpolation == GST_GT_INTERPOLATION_BICUBIC ?
+        gst_gm_remap_row_bicubic : gst_gm_remap_row_bilinear;
+  } else {
+    switch (pixel_stride) {
+      case 1:
+        remap_row = gst_gm_remap_row_u8;
+        break;
+      case 2:
+        remap_row = gst_gm_remap_row_u16;
+        break;
+      case 4:
+        remap_row = gst_gm_remap_row_u32;
+        break;
+      default:
+        break;
+    }
+  }
+
+  /* the SIMD kernels must not read past the last input pixel */
+  in_size = (plane->in_height - 1) * (gsize) plane->in_stride +
+      plane->in_width * pixel_stride;
+
+  for (y = y_start; y < y_end; y++) {
+    const GstGeometricTransformSpan *span = &plane->spans[y];
+    const gint16 *ptr = plane->compact_map +
+        ((gsize) y * plane->width + span->start) * 2;
+    gint width = span->end - span->start;
+    guint8 *out;
+
+    gst_geometric_transform_fill_black_span (gt, plane, y, 0, span->start);
+    gst_geometric_transform_fill_black_span (gt, plane, y, span->end,
+        plane->width);
+
+    if (width == 0)
+      continue;
+
+    /* the remap loops leave the pixels without input untouched */
+    if (plane->split_out_data[0]) {
+      out = tmp_row;
+      if (span->holes)
+        memset (out, plane->black, width * pixel_stride);
+    } else {
+      out = plane->out_data + y * plane->out_stride +
+          span->start * pixel_stride;
+      if (span->holes)
+        gst_geometric_transform_fill_black_span (gt, plane, y, span->start,
+            span->end);
+    }
 
-      memcpy (out_data + out_offset, in_data + in_offset, gt->pixel_stride);
+    if (interpolate_row) {
+      const guint8 *frac = plane->compact_frac +
+          ((gsize) y * plane->width + span->start) * 2;
+
+      interpolate_row (out, plane->in_data, plane->in_stride, plane->in_width,
+          plane->in_height, pixel_stride, ptr, frac, width);
+    } else if (remap_row) {
+      remap_row (out, plane->in_data, plane->in_stride, in_size, ptr, width);
+    } else {
+      for (x = 0; x < width; x++, ptr += 2) {
+        if (ptr[0] >= 0)
+          memcpy (out + x * pixel_stride, plane->in_data +
+              ptr[1] * plane->in_stride + ptr[0] * pixel_stride, pixel_stride);
+      }
     }
+
+    if (plane->split_out_data[0])
+      gst_geometric_transform_split_row (plane, tmp_row, span->start, y,
+          width);
   }
 }
 
+/* gdouble fallback for frames too big for the compact map */
+static void
+gst_geometric_transform_remap_plane (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint y_start, gint y_end)
+{
+  const gdouble *ptr = plane->map + y_start * plane->width * 2;
+  gint x, y;
+
+  for (y = y_start; y < y_end; y++) {
+    for (x = 0; x < plane->width; x++) {
+      /* do the mapping */
+      gst_geometric_transform_do_map (gt, plane, x, y, ptr[0], ptr[1]);
+      ptr += 2;
+    }
+  }
+}
+
+/* for subclasses that don't use a precalculated map */
+static gboolean
+gst_geometric_transform_map_plane (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint y_start, gint y_end)
+{
+  GstGeometricTransformClass *klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
+  gint x, y;
+
+  for (y = y_start; y < y_end; y++) {
+    for (x = 0; x < plane->width; x++) {
+      gdouble in_x, in_y;
+
+      if (!klass->map_func (gt, x << plane->w_sub, y << plane->h_sub,
+              &in_x, &in_y)) {
+        GST_WARNING_OBJECT (gt, "Failed to do mapping for %d %d", x, y);
+        return FALSE;
+      }
+
+      in_x /= 1 << plane->w_sub;
+      in_y /= 1 << plane->h_sub;
+      gst_geometric_transform_do_map (gt, plane, x, y, in_x, in_y);
+    }
+  }
+
+  return TRUE;
+}
+
 static void
 gst_geometric_transform_before_transform (GstBaseTransform * trans,
     GstBuffer * outbuf)
@@ -223,70 +989,373 @@ gst_geometric_transform_before_transform (GstBaseTransform * trans,
     gst_object_sync_values (GST_OBJECT (gt), stream_time);
 }
 
+/* Fills @planes from the frames and returns how many there are */
+static guint
+gst_geometric_transform_get_planes (GstGeometricTransform * gt,
+    GstVideoFrame * in_frame, GstVideoFrame * out_frame,
+    GstGeometricTransformPlane * planes)
+{
+  const GstVideoFormatInfo *finfo = in_frame->info.finfo;
+  GstGeometricTransformMap no_map = { NULL, };
+  const GstGeometricTransformMap *map;
+  guint n_planes, i, c;
+  gint interpolation;
+
+  n_planes = gt->planar_yuv ? GST_VIDEO_FRAME_N_PLANES (in_frame) : 1;
+  interpolation = gst_geometric_transform_get_interpolation (gt);
+  /* subclasses without a precalculated map have none */
+  map = gt->current_map ? gt->current_map : &no_map;
+
+  for (i = 0; i < n_planes; i++) {
+    GstGeometricTransformPlane *plane = &planes[i];
+
+    /* first component stored in this plane, NV12 chroma has two */
+    for (c = 0; c < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); c++)
+      if (GST_VIDEO_FORMAT_INFO_PLANE (finfo, c) == i)
+        break;
+
+    plane->in_data = GST_VIDEO_FRAME_PLANE_DATA (in_frame, i);
+    plane->in_stride = GST_VIDEO_FRAME_PLANE_STRIDE (in_frame, i);
+    plane->interpolation = interpolation;
+    plane->split_out_data[0] = plane->split_out_data[1] = NULL;
+
+    if (gt->split_chroma && i > 0) {
+      guint k;
+
+      /* byte k of every input pixel goes to the component stored at
+       * offset k of the input plane */
+      for (k = c; k < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); k++) {
+        gint offset = GST_VIDEO_FORMAT_INFO_POFFSET (finfo, k);
+
+        if (GST_VIDEO_FORMAT_INFO_PLANE (finfo, k) != i)
+          continue;
+        plane->split_out_data[offset] =
+            GST_VIDEO_FRAME_COMP_DATA (out_frame, k);
+        plane->split_out_stride[offset] =
+            GST_VIDEO_FRAME_COMP_STRIDE (out_frame, k);
+      }
+      plane->out_data = NULL;
+      plane->out_stride = 0;
+    } else {
+      plane->out_data = GST_VIDEO_FRAME_PLANE_DATA (out_frame, i);
+      plane->out_stride = GST_VIDEO_FRAME_PLANE_STRIDE (out_frame, i);
+    }
+
+    if (i == 0) {
+      plane->pixel_stride = gt->pixel_stride;
+      plane->width = gt->width;
+      plane->height = gt->height;
+      plane->in_width = gt->in_width;
+      plane->in_height = gt->in_height;
+      plane->w_sub = plane->h_sub = 0;
+      plane->map = map->map;
+      plane->compact_map = map->compact_map;
+      plane->compact_frac = map->compact_frac;
+      plane->spans = map->compact_spans;
+      /* 0x10 is black for Y */
+      plane->black = gt->planar_yuv ? 0x10 : 0;
+    } else {
+      plane->pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE (in_frame, c);
+      plane->width = gt->chroma_width;
+      plane->height = gt->chroma_height;
+      plane->in_width = gt->in_chroma_width;
+      plane->in_height = gt->in_chroma_height;
+      plane->w_sub = gt->chroma_w_sub;
+      plane->h_sub = gt->chroma_h_sub;
+      plane->map = map->chroma_map ? map->chroma_map : map->map;
+      plane->compact_map = map->compact_chroma_map ?
+          map->compact_chroma_map : map->compact_map;
+      plane->compact_frac = map->compact_chroma_map ?
+          map->compact_chroma_frac : map->compact_frac;
+      plane->spans = map->compact_chroma_map ?
+          map->compact_chroma_spans : map->compact_spans;
+      /* 0x80 is black for Cr and Cb */
+      plane->black = 0x80;
+    }
+  }
+
+  return n_planes;
+}
+
+static void
+gst_geometric_transform_fill_black (GstGeometricTransform * gt,
+    const GstGeometricTransformPlane * plane, gint y_start, gint y_end)
+{
+  guint8 *out_data = plane->out_data + y_start * plane->out_stride;
+  gint x, y, k;
+
+  if (plane->split_out_data[0]) {
+    for (k = 0; k < 2; k++)
+      memset (plane->split_out_data[k] + y_start * plane->split_out_stride[k],
+          plane->black, (y_end - y_start) * plane->split_out_stride[k]);
+  } else if (gt->format == GST_VIDEO_FORMAT_AYUV) {
+    /* in AYUV black is not just all zeros:
+     * 0x10 is black for Y,
+     * 0x80 is black for Cr and Cb */
+    for (y = y_start; y < y_end; y++) {
+      for (x = 0; x < plane->width; x++)
+        GST_WRITE_UINT32_BE (out_data + x * 4, 0xff108080);
+      out_data += plane->out_stride;
+    }
+  } else {
+    memset (out_data, plane->black, (y_end - y_start) * plane->out_stride);
+  }
+}
+
+/* Processes one horizontal band of every plane, possibly from a worker
+ * thread. Called with the object lock held by the streaming thread. */
+static void
+gst_geometric_transform_process_band (GstGeometricTransformBand * band)
+{
+  GstGeometricTransform *gt = band->gt;
+  guint i;
+
+  for (i = 0; i < band->n_planes; i++) {
+    const GstGeometricTransformPlane *plane = &band->planes[i];
+    gint y_start = plane->height * band->index / band->n_bands;
+    gint y_end = plane->height * (band->index + 1) / band->n_bands;
+
+    if (gt->precalc_map && plane->compact_map) {
+      gst_geometric_transform_remap_plane_compact (gt, plane, y_start, y_end,
+          plane->split_out_data[0] ? band->split_row : NULL);
+      continue;
+    }
+
+    gst_geometric_transform_fill_black (gt, plane, y_start, y_end);
+
+    if (!gt->precalc_map) {
+      if (!gst_geometric_transform_map_plane (gt, plane, y_start, y_end)) {
+        band->ret = FALSE;
+        return;
+      }
+    } else {
+      gst_geometric_transform_remap_plane (gt, plane, y_start, y_end);
+    }
+  }
+}
+
+/* based on the one in video-converter.c */
+static void
+gst_parallelized_task_thread_func (gpointer data)
+{
+  GstParallelizedTaskRunner *runner = data;
+  gint idx;
+
+  g_mutex_lock (&runner->lock);
+  idx = runner->n_todo--;
+  g_assert (runner->n_todo >= -1);
+  g_mutex_unlock (&runner->lock);
+
+  g_assert (runner->func != NULL);
+
+  runner->func (runner->task_data[idx]);
+}
+
+static void
+gst_parallelized_task_runner_join (GstParallelizedTaskRunner * self)
+{
+  gboolean joined = FALSE;
+
+  while (!joined) {
+    g_mutex_lock (&self->lock);
+    if (!(joined = gst_vec_deque_is_empty (self->tasks))) {
+      gpointer task = gst_vec_deque_pop_head (self->tasks);
+      g_mutex_unlock (&self->lock);
+      gst_task_pool_join (self->pool, task);
+    } else {
+      g_mutex_unlock (&self->lock);
+    }
+  }
+}
+
+static void
+gst_parallelized_task_runner_free (GstParallelizedTaskRunner * self)
+{
+  gst_parallelized_task_runner_join (self);
+
+  gst_vec_deque_free (self->tasks);
+  gst_task_pool_cleanup (self->pool);
+  gst_object_unref (self->pool);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
+
+static GstParallelizedTaskRunner *
+gst_parallelized_task_runner_new (guint n_threads)
+{
+  GstParallelizedTaskRunner *self;
+
+  self = g_new0 (GstParallelizedTaskRunner, 1);
+
+  self->pool = gst_shared_task_pool_new ();
+  gst_shared_task_pool_set_max_threads (GST_SHARED_TASK_POOL (self->pool),
+      n_threads);
+  gst_task_pool_prepare (self->pool, NULL);
+
+  self->tasks = gst_vec_deque_new (n_threads);
+  self->n_threads = n_threads;
+  self->n_todo = -1;
+  g_mutex_init (&self->lock);
+
+  return self;
+}
+
+/* runs func on every task_data entry, the last one in the calling thread,
+ * and returns once all of them are done */
+static void
+gst_parallelized_task_runner_run (GstParallelizedTaskRunner * self,
+    GstParallelizedTaskFunc func, gpointer * task_data)
+{
+  guint i;
+
+  self->func = func;
+  self->task_data = task_data;
+
+  g_mutex_lock (&self->lock);
+  self->n_todo = self->n_threads - 2;
+  for (i = 1; i < self->n_threads; i++) {
+    gpointer task =
+        gst_task_pool_push (self->pool, gst_parallelized_task_thread_func,
+        self, NULL);
+
+    /* NULL is only returned if the pool was not prepared */
+    g_assert (task != NULL);
+    gst_vec_deque_push_tail (self->tasks, task);
+  }
+  g_mutex_unlock (&self->lock);
+
+  self->func (self->task_data[self->n_threads - 1]);
+
+  gst_parallelized_task_runner_join (self);
+
+  self->func = NULL;
+  self->task_data = NULL;
+}
+
+/* must be called with the object lock */
+static guint
+gst_geometric_transform_get_n_bands (GstGeometricTransform * gt)
+{
+  guint n_threads = gt->n_threads;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  /* not worth waking up threads for less than 64 lines each */
+  n_threads = MIN (n_threads, (guint) MAX (gt->height / 64, 1));
+
+  if (n_threads > 1 && (!gt->task_runner
+          || gt->task_runner->n_threads != n_threads)) {
+    if (gt->task_runner)
+      gst_parallelized_task_runner_free (gt->task_runner);
+    gt->task_runner = gst_parallelized_task_runner_new (n_threads);
+  }
+
+  return n_threads;
+}
+
+/* must be called with the object lock */
+static void
+gst_geometric_transform_alloc_split_rows (GstGeometricTransform * gt,
+    guint n_bands)
+{
+  gsize size;
+
+  if (!gt->split_chroma) {
+    g_clear_pointer (&gt->split_rows, g_free);
+    gt->n_split_rows = 0;
+    gt->split_row_size = 0;
+    return;
+  }
+
+  /* a row of interleaved 2 byte chroma pixels, on its own cache lines */
+  size = GST_ROUND_UP_64 (gt->chroma_width * 2);
+  if (gt->split_rows && gt->n_split_rows >= n_bands
+      && gt->split_row_size == size)
+    return;
+
+  g_free (gt->split_rows);
+  gt->split_rows = g_malloc (size * n_bands);
+  gt->n_split_rows = n_bands;
+  gt->split_row_size = size;
+}
+
 static GstFlowReturn
 gst_geometric_transform_transform_frame (GstVideoFilter * vfilter,
     GstVideoFrame * in_frame, GstVideoFrame * out_frame)
 {
   GstGeometricTransform *gt;
   GstGeometricTransformClass *klass;
-  gint x, y, i;
+  GstGeometricTransformPlane planes[GST_VIDEO_MAX_PLANES];
+  GstGeometricTransformBand *bands;
+  GstGeometricTransformBand **bands_p;
+  guint n_planes, n_bands, i;
   GstFlowReturn ret = GST_FLOW_OK;
-  gdouble *ptr;
-  guint8 *in_data;
-  guint8 *out_data;
 
   gt = GST_GEOMETRIC_TRANSFORM_CAST (vfilter);
   klass = GST_GEOMETRIC_TRANSFORM_GET_CLASS (gt);
 
-  in_data = GST_VIDEO_FRAME_PLANE_DATA (in_frame, 0);
-  out_data = GST_VIDEO_FRAME_PLANE_DATA (out_frame, 0);
-
-  if (GST_VIDEO_FRAME_FORMAT (out_frame) == GST_VIDEO_FORMAT_AYUV) {
-    /* in AYUV black is not just all zeros:
-     * 0x10 is black for Y,
-     * 0x80 is black for Cr and Cb */
-    for (i = 0; i < out_frame->map[0].size; i += 4)
-      GST_WRITE_UINT32_BE (out_data + i, 0xff108080);
-  } else {
-    memset (out_data, 0, out_frame->map[0].size);
-  }
-
   GST_OBJECT_LOCK (gt);
   if (gt->precalc_map) {
     if (gt->needs_remap) {
-      if (klass->prepare_func)
-        if (!klass->prepare_func (gt)) {
-          ret = FALSE;
-          goto end;
-        }
-      gst_geometric_transform_generate_map (gt);
-    }
-    g_return_val_if_fail (gt->map, GST_FLOW_ERROR);
-    ptr = gt->map;
-    for (y = 0; y < gt->height; y++) {
-      for (x = 0; x < gt->width; x++) {
-        /* do the mapping */
-        gst_geometric_transform_do_map (gt, in_data, out_data, x, y, ptr[0],
-            ptr[1]);
-        ptr += 2;
+      if (gt->current_map) {
+        /* keep warping with the current map meanwhile */
+        gst_geometric_transform_start_remap (gt);
+      } else {
+        if (klass->prepare_func)
+          if (!klass->prepare_func (gt)) {
+            ret = GST_FLOW_ERROR;
+            goto end;
+          }
+        gst_geometric_transform_generate_map (gt);
       }
     }
-  } else {
-    for (y = 0; y < gt->height; y++) {
-      for (x = 0; x < gt->width; x++) {
-        gdouble in_x, in_y;
-
-        if (klass->map_func (gt, x, y, &in_x, &in_y)) {
-          gst_geometric_transform_do_map (gt, in_data, out_data, x, y, in_x,
-              in_y);
-        } else {
-          GST_WARNING_OBJECT (gt, "Failed to do mapping for %d %d", x, y);
-          ret = GST_FLOW_ERROR;
-          goto end;
-        }
-      }
+
+    /* swap in the map generated by the remap thread */
+    if (gt->next_map) {
+      g_clear_pointer (&gt->current_map, gst_gm_map_unref);
+      gt->current_map = gt->next_map;
+      gt->next_map = NULL;
+      GST_DEBUG_OBJECT (gt, "Switched to the new transform map");
+    }
+
+    if (!gt->current_map) {
+      ret = GST_FLOW_ERROR;
+      goto end;
     }
   }
+
+  n_planes =
+      gst_geometric_transform_get_planes (gt, in_frame, out_frame, planes);
+  n_bands = gst_geometric_transform_get_n_bands (gt);
+  gst_geometric_transform_alloc_split_rows (gt, n_bands);
+
+  bands = g_newa (GstGeometricTransformBand, n_bands);
+  bands_p = g_newa (GstGeometricTransformBand *, n_bands);
+  for (i = 0; i < n_bands; i++) {
+    bands[i].gt = gt;
+    bands[i].planes = planes;
+    bands[i].n_planes = n_planes;
+    bands[i].index = i;
+    bands[i].n_bands = n_bands;
+    bands[i].split_row = gt->split_rows ?
+        gt->split_rows + i * gt->split_row_size : NULL;
+    bands[i].ret = TRUE;
+    bands_p[i] = &bands[i];
+  }
+
+  if (n_bands > 1)
+    gst_parallelized_task_runner_run (gt->task_runner,
+        (GstParallelizedTaskFunc) gst_geometric_transform_process_band,
+        (gpointer *) bands_p);
+  else
+    gst_geometric_transform_process_band (&bands[0]);
+
+  for (i = 0; i < n_bands; i++) {
+    if (!bands[i].ret)
+      ret = GST_FLOW_ERROR;
+  }
+
 end:
   GST_OBJECT_UNLOCK (gt);
   return ret;
@@ -301,9 +1370,38 @@ gst_geometric_transform_set_property (GObject * object, guint prop_id,
   gt = GST_GEOMETRIC_TRANSFORM_CAST (object);
 
   switch (prop_id) {
-    case PROP_OFF_EDGE_PIXELS:
+    case PROP_OFF_EDGE_PIXELS:{
+      gint off_edge_pixels = g_value_get_enum (value);
+
+      GST_OBJECT_LOCK (gt);
+      /* the compact map has the off-edge policy baked in */
+      if (off_edge_pixels != gt->off_edge_pixels) {
+        gt->off_edge_pixels = off_edge_pixels;
+        gst_geometric_transform_set_need_remap (gt);
+      }
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    }
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (gt);
+      gt->n_threads = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    case PROP_INTERPOLATION:{
+      gint interpolation = g_value_get_enum (value);
+
+      GST_OBJECT_LOCK (gt);
+      if (interpolation != gt->interpolation) {
+        gt->interpolation = interpolation;
+        gst_geometric_transform_set_need_remap (gt);
+      }
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    }
+    case PROP_MAP_CACHE_DIR:
       GST_OBJECT_LOCK (gt);
-      gt->off_edge_pixels = g_value_get_enum (value);
+      g_free (gt->map_cache_dir);
+      gt->map_cache_dir = g_value_dup_string (value);
       GST_OBJECT_UNLOCK (gt);
       break;
     default:
@@ -324,12 +1422,41 @@ gst_geometric_transform_get_property (GObject * object, guint prop_id,
     case PROP_OFF_EDGE_PIXELS:
       g_value_set_enum (value, gt->off_edge_pixels);
       break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (gt);
+      g_value_set_uint (value, gt->n_threads);
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    case PROP_INTERPOLATION:
+      g_value_set_enum (value, gt->interpolation);
+      break;
+    case PROP_VALID_RATIO:
+      GST_OBJECT_LOCK (gt);
+      g_value_set_double (value,
+          gt->current_map ? gt->current_map->valid_ratio : 1.0);
+      GST_OBJECT_UNLOCK (gt);
+      break;
+    case PROP_MAP_CACHE_DIR:
+      GST_OBJECT_LOCK (gt);
+      g_value_set_string (value, gt->map_cache_dir);
+      GST_OBJECT_UNLOCK (gt);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+static void
+gst_geometric_transform_finalize (GObject * object)
+{
+  GstGeometricTransform *gt = GST_GEOMETRIC_TRANSFORM_CAST (object);
+
+  g_free (gt->map_cache_dir);
+  g_free (gt->split_rows);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
 
 static gboolean
 gst_geometric_transform_stop (GstBaseTransform * trans)
@@ -338,11 +1465,19 @@ gst_geometric_transform_stop (GstBaseTransform * trans)
 
   GST_INFO_OBJECT (gt, "Deleting transform map");
 
+  gst_geometric_transform_stop_remap (gt);
+
   gt->width = 0;
   gt->height = 0;
+  gt->in_width = 0;
+  gt->in_height = 0;
+
+  gst_geometric_transform_free_maps (gt);
 
-  g_free (gt->map);
-  gt->map = NULL;
+  if (gt->task_runner) {
+    gst_parallelized_task_runner_free (gt->task_runner);
+    gt->task_runner = NULL;
+  }
 
   return TRUE;
 }
@@ -373,6 +1508,7 @@ gst_geometric_transform_class_init (gpointer klass, gpointer class_data)
 
   obj_class->set_property = gst_geometric_transform_set_property;
   obj_class->get_property = gst_geometric_transform_get_property;
+  obj_class->finalize = gst_geometric_transform_finalize;
 
   trans_class->stop = GST_DEBUG_FUNCPTR (gst_geometric_transform_stop);
   trans_class->before_transform =
@@ -389,8 +1525,36 @@ gst_geometric_transform_class_init (gpointer klass, gpointer class_data)
           GST_GT_OFF_EDGES_PIXELS_METHOD_TYPE, DEFAULT_OFF_EDGE_PIXELS,
           GST_PARAM_CONTROLLABLE | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Maximum number of threads to split each frame across (0 = auto)",
+          0, G_MAXUINT, DEFAULT_N_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_INTERPOLATION,
+      g_param_spec_enum ("interpolation", "Interpolation",
+          "How to sample the input pixels around each mapped position",
+          GST_GT_INTERPOLATION_TYPE, DEFAULT_INTERPOLATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_VALID_RATIO,
+      g_param_spec_double ("valid-ratio", "Valid ratio",
+          "Fraction of the output pixels that are warped, the others are "
+          "only cleared", 0.0, 1.0, 1.0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_MAP_CACHE_DIR,
+      g_param_spec_string ("map-cache-dir", "Map cache directory",
+          "Directory where the generated maps are stored and reused from "
+          "across processes, the least recently used ones are removed above "
+          "256 MiB (NULL = only cache them in memory)",
+          DEFAULT_MAP_CACHE_DIR, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_type_mark_as_plugin_api (GST_GT_OFF_EDGES_PIXELS_METHOD_TYPE, 0);
+  gst_type_mark_as_plugin_api (GST_GT_INTERPOLATION_TYPE, 0);
   gst_type_mark_as_plugin_api (GST_TYPE_GEOMETRIC_TRANSFORM, 0);
+
+  GST_INFO ("using %s remap kernels", gst_gm_remap_init ());
 }
 
 static void
@@ -399,6 +1563,9 @@ gst_geometric_transform_init (GTypeInstance * instance, gpointer g_class)
   GstGeometricTransform *gt = GST_GEOMETRIC_TRANSFORM_CAST (instance);
 
   gt->off_edge_pixels = DEFAULT_OFF_EDGE_PIXELS;
+  gt->n_threads = DEFAULT_N_THREADS;
+  gt->interpolation = DEFAULT_INTERPOLATION;
+  gt->map_cache_dir = DEFAULT_MAP_CACHE_DIR;
   gt->precalc_map = TRUE;
   gt->needs_remap = TRUE;
 }
@@ -438,4 +1605,5 @@ void
 gst_geometric_transform_set_need_remap (GstGeometricTransform * gt)
 {
   gt->needs_remap = TRUE;
+  gt->remap_cookie++;
 }
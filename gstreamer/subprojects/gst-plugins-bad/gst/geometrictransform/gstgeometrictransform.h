@@ -46,9 +46,83 @@ enum
   GST_GT_OFF_EDGES_PIXELS_WRAP
 };
 
+enum
+{
+  GST_GT_INTERPOLATION_NEAREST = 0,
+  GST_GT_INTERPOLATION_BILINEAR,
+  GST_GT_INTERPOLATION_BICUBIC
+};
+
 typedef struct _GstGeometricTransform GstGeometricTransform;
 typedef struct _GstGeometricTransformClass GstGeometricTransformClass;
 
+/* based on the one in video-converter.c */
+typedef void (*GstParallelizedTaskFunc) (gpointer user_data);
+
+typedef struct _GstParallelizedTaskRunner GstParallelizedTaskRunner;
+
+struct _GstParallelizedTaskRunner
+{
+  GstTaskPool *pool;
+  guint n_threads;
+
+  GstVecDeque *tasks;
+
+  GstParallelizedTaskFunc func;
+  gpointer *task_data;
+
+  GMutex lock;
+  gint n_todo;
+};
+
+/* Output pixels of a compact map row that have an input pixel all lie in
+ * [start, end), holes is set when some pixels in between don't */
+typedef struct
+{
+  gint start;
+  gint end;
+  gboolean holes;
+} GstGeometricTransformSpan;
+
+/* A precalculated map and everything derived from it. Generated and
+ * swapped as a whole, so frames keep being warped with the previous one
+ * while a new one is built. Immutable once generated and refcounted, see
+ * geometricmapcache.c, elements warping with the same parameters share one
+ * map. */
+typedef struct
+{
+  gint ref_count;
+  /* cache key of shared maps, NULL for maps private to an element */
+  gchar *key;
+
+  gdouble *map;
+  gdouble *chroma_map;
+
+  /* Input pixel (x, y) of every output pixel, with the off-edge policy
+   * already applied and -1 for pixels that stay black. Used instead of the
+   * gdouble maps whenever the frame fits in 16 bit coordinates. */
+  gint16 *compact_map;
+  gint16 *compact_chroma_map;
+
+  /* Sub-pixel position (fx, fy) in 1/256th of a pixel of every compact map
+   * entry, only generated when interpolating */
+  guint8 *compact_frac;
+  guint8 *compact_chroma_frac;
+
+  /* one span per row of the compact maps, only the pixels outside of it
+   * are cleared and only the ones inside are warped */
+  GstGeometricTransformSpan *compact_spans;
+  GstGeometricTransformSpan *compact_chroma_spans;
+
+  /* fraction of the output pixels warped every frame, the ones outside of
+   * the spans are only cleared */
+  gdouble valid_ratio;
+
+  /* set when the map comes from the map cache, the arrays point into it
+   * and must not be modified */
+  GBytes *data;
+} GstGeometricTransformMap;
+
 /**
  * GstGeometricTransformMapFunc:
  *
@@ -70,13 +144,31 @@ typedef gboolean (*GstGeometricTransformMapFunc) (GstGeometricTransform * gt,
  * GstGeometricTransformPrepareFunc:
  *
  * Called right before starting to calculate the mapping so that
- * instances might precalculate some values.
+ * instances might precalculate some values. The map_func may then run
+ * without the object lock, on another thread: whatever it reads that
+ * properties can change must be copied here.
  *
  * Called with the object lock
  */
 typedef gboolean (*GstGeometricTransformPrepareFunc) (
     GstGeometricTransform * gt);
 
+/**
+ * GstGeometricTransformHashFunc:
+ *
+ * Adds the subclass parameters the mapping depends on to @checksum. The
+ * frame size and format and the base class properties are already in.
+ * Maps are only cached for subclasses that have one.
+ *
+ * @gt: The #GstGeometricTransform
+ * @checksum: The checksum the cache key is computed with
+ * Returns: True if the map can be cached, false otherwise
+ *
+ * Called with the object lock, after the prepare_func
+ */
+typedef gboolean (*GstGeometricTransformHashFunc) (GstGeometricTransform * gt,
+    GChecksum * checksum);
+
 /**
  * GstGeometricTransform:
  *
@@ -85,11 +177,30 @@ typedef gboolean (*GstGeometricTransformPrepareFunc) (
 struct _GstGeometricTransform {
   GstVideoFilter videofilter;
 
+  /* size of the output frames, the map has one entry per output pixel */
   gint width, height;
+  /* size of the input frames, only differs from width and height for
+   * subclasses that also scale */
+  gint in_width, in_height;
   GstVideoFormat format;
   gint pixel_stride;
   gint row_stride;
 
+  /* Planar and semi-planar YUV formats are warped plane by plane. The chroma
+   * planes are sampled through a second map derived from the luma one. */
+  gboolean planar_yuv;
+  gint chroma_w_sub, chroma_h_sub;
+  gint chroma_width, chroma_height;
+  gint in_chroma_width, in_chroma_height;
+  /* NV12/NV21 input and I420/YV12 output, the interleaved chroma plane is
+   * split while it is warped */
+  gboolean split_chroma;
+  /* one row per band the split chroma is warped into before being
+   * scattered, allocated with the caps and grown when n-threads changes */
+  guint8 *split_rows;
+  guint n_split_rows;
+  gsize split_row_size;
+
   /* Must be set on NULL state.
    * Useful for subclasses that use don't want to use a fixed precalculated
    * pixel mapping table. Like 'diffuse' that uses random values for each pic.
@@ -99,8 +210,31 @@ struct _GstGeometricTransform {
 
   /* properties */
   gint off_edge_pixels;
-
-  gdouble *map;
+  guint n_threads;
+  gint interpolation;
+
+  /* interpolation the current format allows, nearest for formats with more
+   * than 8 bits per component */
+  gboolean can_interpolate;
+
+  /* splits each frame in horizontal bands when n_threads > 1 */
+  GstParallelizedTaskRunner *task_runner;
+
+  /* map used by transform_frame, and a newer one generated off the
+   * streaming thread, swapped in at the next frame */
+  GstGeometricTransformMap *current_map;
+  GstGeometricTransformMap *next_map;
+
+  GThread *remap_thread;
+  gboolean remap_running;
+  gboolean remap_cancel;
+  /* bumped by gst_geometric_transform_set_need_remap(), a map generated
+   * while it changed is outdated */
+  guint remap_cookie;
+
+  /* where maps are stored for later processes, NULL to only keep them in
+   * memory */
+  gchar *map_cache_dir;
 };
 
 struct _GstGeometricTransformClass {
@@ -108,6 +242,7 @@ struct _GstGeometricTransformClass {
 
   GstGeometricTransformMapFunc map_func;
   GstGeometricTransformPrepareFunc prepare_func;
+  GstGeometricTransformHashFunc hash_func;
 };
 
 GType gst_geometric_transform_get_type (void);
@@ -73,6 +73,7 @@
 #endif
 
 #include <gst/gst.h>
+#include <string.h>
 
 #include "gstperspective.h"
 
@@ -180,6 +181,17 @@ gst_perspective_get_property (GObject * object, guint prop_id,
   }
 }
 
+static gboolean
+perspective_prepare (GstGeometricTransform * gt)
+{
+  GstPerspective *perspective = GST_PERSPECTIVE_CAST (gt);
+
+  memcpy (perspective->map_matrix, perspective->matrix,
+      sizeof (perspective->matrix));
+
+  return TRUE;
+}
+
 static gboolean
 perspective_map (GstGeometricTransform * gt, gint x, gint y, gdouble * in_x,
     gdouble * in_y)
@@ -188,7 +200,7 @@ perspective_map (GstGeometricTransform * gt, gint x, gint y, gdouble * in_x,
   gdouble *m;
   gdouble xp, yp, w, xi, yi;
 
-  m = perspective->matrix;
+  m = perspective->map_matrix;
 
   /* Matrix multiplication */
   xp = (m[0] * x + m[1] * y + m[2]);
@@ -209,6 +221,17 @@ perspective_map (GstGeometricTransform * gt, gint x, gint y, gdouble * in_x,
   return TRUE;
 }
 
+static gboolean
+perspective_hash (GstGeometricTransform * gt, GChecksum * checksum)
+{
+  GstPerspective *perspective = GST_PERSPECTIVE_CAST (gt);
+
+  g_checksum_update (checksum, (const guchar *) perspective->map_matrix,
+      sizeof (perspective->map_matrix));
+
+  return TRUE;
+}
+
 static void
 gst_perspective_class_init (GstPerspectiveClass * klass)
 {
@@ -240,7 +263,9 @@ gst_perspective_class_init (GstPerspectiveClass * klass)
               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  gstgt_class->prepare_func = perspective_prepare;
   gstgt_class->map_func = perspective_map;
+  gstgt_class->hash_func = perspective_hash;
 }
 
 static void
@@ -72,6 +72,9 @@ struct _GstPerspective
   GstGeometricTransform element;
 
   gdouble matrix[9];
+  /* matrix as of the last prepare_func, the map is generated from it
+   * without the object lock */
+  gdouble map_matrix[9];
 };
 
 struct _GstPerspectiveClass
@@ -0,0 +1,335 @@
+/* GStreamer
+ *
+ * unit test for deskew
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/video/video.h>
+
+#define IN_WIDTH 64
+#define IN_HEIGHT 48
+
+/* The area to deskew: QUAD_WIDTH x QUAD_HEIGHT input pixels at QUAD_X,
+ * QUAD_Y. The corner points are at the pixel centres so that every output
+ * pixel maps half a pixel away from any rounding boundary, and nearest
+ * sampling picks exactly one input pixel. */
+#define QUAD_X 10
+#define QUAD_Y 6
+#define QUAD_WIDTH 24
+#define QUAD_HEIGHT 16
+#define QUAD_POINTS "<10.5, 6.5, 33.5, 6.5, 33.5, 21.5, 10.5, 21.5>"
+
+#define NV12_CAPS "video/x-raw, format=NV12, width=64, height=48, " \
+  "framerate=30/1"
+
+typedef struct
+{
+  const gchar *direction;
+  gboolean rotated;             /* the output is QUAD_HEIGHT x QUAD_WIDTH */
+} Flip;
+
+static const Flip flips[] = {
+  {"identity", FALSE}, {"90r", TRUE}, {"180", FALSE}, {"90l", TRUE},
+  {"horiz", FALSE}, {"vert", FALSE}, {"ul-lr", TRUE}, {"ur-ll", TRUE},
+};
+
+/* The pixel of the quad, from its top-left corner, that the output pixel
+ * (x, y) shows after flipping, see get_flip_matrix() in gstdeskew.c */
+static void
+flip_pixel (guint flip, gint x, gint y, gint * u, gint * v)
+{
+  const gint w = QUAD_WIDTH - 1, h = QUAD_HEIGHT - 1;
+
+  switch (flip) {
+    case 0:
+      *u = x, *v = y;
+      break;
+    case 1:
+      *u = y, *v = h - x;
+      break;
+    case 2:
+      *u = w - x, *v = h - y;
+      break;
+    case 3:
+      *u = w - y, *v = x;
+      break;
+    case 4:
+      *u = w - x, *v = y;
+      break;
+    case 5:
+      *u = x, *v = h - y;
+      break;
+    case 6:
+      *u = y, *v = x;
+      break;
+    default:
+      *u = w - y, *v = h - x;
+      break;
+  }
+}
+
+/* An NV12 frame of random pixels, @info describes it */
+static GstBuffer *
+create_nv12_frame (GRand * rand, GstVideoInfo * info)
+{
+  GstBuffer *buffer;
+  GstVideoFrame frame;
+  guint p;
+  gint x, y;
+
+  gst_video_info_set_format (info, GST_VIDEO_FORMAT_NV12, IN_WIDTH,
+      IN_HEIGHT);
+  buffer = gst_buffer_new_and_alloc (GST_VIDEO_INFO_SIZE (info));
+  fail_unless (gst_video_frame_map (&frame, info, buffer, GST_MAP_WRITE));
+
+  for (p = 0; p < 2; p++) {
+    guint8 *data = GST_VIDEO_FRAME_PLANE_DATA (&frame, p);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, p);
+
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (&frame, p); y++)
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (&frame, p) * (p + 1); x++)
+        data[y * stride + x] = g_rand_int_range (rand, 0, 256);
+  }
+
+  gst_video_frame_unmap (&frame);
+  GST_BUFFER_PTS (buffer) = 0;
+  GST_BUFFER_DURATION (buffer) = GST_SECOND / 30;
+
+  return buffer;
+}
+
+static GstHarness *
+create_deskew (const gchar * points, const gchar * direction)
+{
+  GstHarness *h = gst_harness_new ("deskew");
+
+  if (points)
+    gst_util_set_object_arg (G_OBJECT (h->element), "points", points);
+  gst_util_set_object_arg (G_OBJECT (h->element), "video-direction",
+      direction);
+  gst_util_set_object_arg (G_OBJECT (h->element), "interpolation",
+      "nearest");
+
+  return h;
+}
+
+/* The caps the element settled on with downstream */
+static void
+check_output_caps (GstHarness * h, const gchar * expected)
+{
+  GstCaps *caps = gst_pad_get_current_caps (h->sinkpad);
+  GstCaps *expected_caps = gst_caps_from_string (expected);
+
+  fail_unless (caps != NULL);
+  fail_unless (gst_caps_is_subset (caps, expected_caps),
+      "negotiated %" GST_PTR_FORMAT ", expected %" GST_PTR_FORMAT, caps,
+      expected_caps);
+
+  gst_caps_unref (expected_caps);
+  gst_caps_unref (caps);
+}
+
+/* Every flip of the quad, NV12 in and I420 out: each luma pixel must be
+ * the quad pixel it was flipped from, each chroma pixel the U and V of the
+ * NV12 chroma sample under the top-left luma pixel of its 2x2 block. */
+GST_START_TEST (test_flips_split_chroma)
+{
+  GRand *rand = g_rand_new_with_seed (0x5eed);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (flips); i++) {
+    gint out_width = flips[i].rotated ? QUAD_HEIGHT : QUAD_WIDTH;
+    gint out_height = flips[i].rotated ? QUAD_WIDTH : QUAD_HEIGHT;
+    GstHarness *h = create_deskew (QUAD_POINTS, flips[i].direction);
+    gchar *out_caps = g_strdup_printf ("video/x-raw, format=I420, width=%d, "
+        "height=%d", out_width, out_height);
+    GstVideoInfo in_info, out_info;
+    GstVideoFrame in, out;
+    GstBuffer *in_buffer, *out_buffer;
+    gint x, y, u, v;
+
+    gst_harness_set_caps_str (h, NV12_CAPS, out_caps);
+    in_buffer = create_nv12_frame (rand, &in_info);
+    fail_unless (gst_video_frame_map (&in, &in_info, in_buffer,
+            GST_MAP_READ));
+
+    fail_unless_equals_int (gst_harness_push (h, gst_buffer_ref (in_buffer)),
+        GST_FLOW_OK);
+    out_buffer = gst_harness_pull (h);
+    fail_unless (out_buffer != NULL);
+    check_output_caps (h, out_caps);
+
+    gst_video_info_set_format (&out_info, GST_VIDEO_FORMAT_I420, out_width,
+        out_height);
+    fail_unless (gst_video_frame_map (&out, &out_info, out_buffer,
+            GST_MAP_READ));
+
+    for (y = 0; y < out_height; y++) {
+      const guint8 *out_row = GST_VIDEO_FRAME_PLANE_DATA (&out, 0) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&out, 0);
+
+      for (x = 0; x < out_width; x++) {
+        flip_pixel (i, x, y, &u, &v);
+        fail_unless_equals_int (out_row[x],
+            ((const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&in, 0))
+            [(QUAD_Y + v) * GST_VIDEO_FRAME_PLANE_STRIDE (&in, 0) + QUAD_X +
+                u]);
+      }
+    }
+
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (&out, 1); y++) {
+      const guint8 *u_row = GST_VIDEO_FRAME_PLANE_DATA (&out, 1) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&out, 1);
+      const guint8 *v_row = GST_VIDEO_FRAME_PLANE_DATA (&out, 2) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&out, 2);
+
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (&out, 1); x++) {
+        const guint8 *uv;
+
+        flip_pixel (i, 2 * x, 2 * y, &u, &v);
+        uv = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&in, 1) +
+            (QUAD_Y + v) / 2 * GST_VIDEO_FRAME_PLANE_STRIDE (&in, 1) +
+            (QUAD_X + u) / 2 * 2;
+        fail_unless_equals_int (u_row[x], uv[0]);
+        fail_unless_equals_int (v_row[x], uv[1]);
+      }
+    }
+
+    gst_video_frame_unmap (&out);
+    gst_video_frame_unmap (&in);
+    gst_buffer_unref (out_buffer);
+    gst_buffer_unref (in_buffer);
+    g_free (out_caps);
+    gst_harness_teardown (h);
+  }
+
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* The corner pixels of the output are the corner points, whatever the
+ * shape of the quad */
+GST_START_TEST (test_skewed_quad_corners)
+{
+  static const gint corners[4][4] = {
+    /* output x, y, input x, y */
+    {0, 0, 10, 6}, {19, 0, 50, 2}, {19, 29, 45, 40}, {0, 29, 3, 30},
+  };
+  GRand *rand = g_rand_new_with_seed (0x5eed);
+  GstHarness *h = create_deskew ("<10.5, 6.5, 50.5, 2.5, 45.5, 40.5, 3.5, "
+      "30.5>", "identity");
+  GstVideoInfo in_info, out_info;
+  GstVideoFrame in, out;
+  GstBuffer *in_buffer, *out_buffer;
+  guint i;
+
+  gst_harness_set_caps_str (h, NV12_CAPS,
+      "video/x-raw, format=NV12, width=20, height=30");
+  in_buffer = create_nv12_frame (rand, &in_info);
+  fail_unless_equals_int (gst_harness_push (h, gst_buffer_ref (in_buffer)),
+      GST_FLOW_OK);
+  out_buffer = gst_harness_pull (h);
+
+  gst_video_info_set_format (&out_info, GST_VIDEO_FORMAT_NV12, 20, 30);
+  fail_unless (gst_video_frame_map (&in, &in_info, in_buffer, GST_MAP_READ));
+  fail_unless (gst_video_frame_map (&out, &out_info, out_buffer,
+          GST_MAP_READ));
+
+  for (i = 0; i < G_N_ELEMENTS (corners); i++) {
+    const guint8 *out_y = GST_VIDEO_FRAME_PLANE_DATA (&out, 0);
+    const guint8 *in_y = GST_VIDEO_FRAME_PLANE_DATA (&in, 0);
+
+    fail_unless_equals_int (out_y[corners[i][1] *
+            GST_VIDEO_FRAME_PLANE_STRIDE (&out, 0) + corners[i][0]],
+        in_y[corners[i][3] * GST_VIDEO_FRAME_PLANE_STRIDE (&in, 0) +
+            corners[i][2]]);
+  }
+
+  gst_video_frame_unmap (&out);
+  gst_video_frame_unmap (&in);
+  gst_buffer_unref (out_buffer);
+  gst_buffer_unref (in_buffer);
+  gst_harness_teardown (h);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* @expected NULL for caps the element must refuse */
+static void
+check_negotiation (const gchar * downstream, const gchar * expected)
+{
+  GstHarness *h = create_deskew (QUAD_POINTS, "90r");
+  GRand *rand = g_rand_new_with_seed (0x5eed);
+  GstVideoInfo info;
+  GstFlowReturn ret;
+
+  gst_harness_set_caps_str (h, NV12_CAPS, downstream);
+  ret = gst_harness_push (h, create_nv12_frame (rand, &info));
+  if (expected) {
+    fail_unless_equals_int (ret, GST_FLOW_OK);
+    gst_buffer_unref (gst_harness_pull (h));
+    check_output_caps (h, expected);
+  } else {
+    fail_unless_equals_int (ret, GST_FLOW_NOT_NEGOTIATED);
+  }
+
+  gst_harness_teardown (h);
+  g_rand_free (rand);
+}
+
+/* Downstream picks the size and format, what it leaves open keeps the
+ * input's. NV12 can only become I420 or YV12 on the way. */
+GST_START_TEST (test_output_negotiation)
+{
+  check_negotiation ("video/x-raw", NV12_CAPS);
+  check_negotiation ("video/x-raw, format=I420",
+      "video/x-raw, format=I420, width=64, height=48, framerate=30/1");
+  check_negotiation ("video/x-raw, format=YV12, width=[1, 20]",
+      "video/x-raw, format=YV12, width=20, height=48, framerate=30/1");
+  check_negotiation ("video/x-raw, width=160, height=90",
+      "video/x-raw, format=NV12, width=160, height=90, framerate=30/1");
+  check_negotiation ("video/x-raw, format={ RGBx, I420 }, width=16, "
+      "height=24", "video/x-raw, format=I420, width=16, height=24, "
+      "framerate=30/1");
+  check_negotiation ("video/x-raw, format={ RGBx, NV21 }", NULL);
+}
+
+GST_END_TEST;
+
+static Suite *
+deskew_suite (void)
+{
+  Suite *s = suite_create ("deskew");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_flips_split_chroma);
+  tcase_add_test (tc_chain, test_skewed_quad_corners);
+  tcase_add_test (tc_chain, test_output_negotiation);
+
+  return s;
+}
+
+GST_CHECK_MAIN (deskew);
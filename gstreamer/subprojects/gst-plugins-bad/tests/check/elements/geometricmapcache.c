@@ -0,0 +1,218 @@
+/* GStreamer
+ *
+ * unit test for the geometrictransform map cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* the matrix property of perspective is a GValueArray */
+#define GLIB_DISABLE_DEPRECATION_WARNINGS
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/video/video.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/* Maps in memory are shared by key and always win over the files, so every
+ * element here uses a matrix no other one used: a translation by a
+ * different number of pixels, which maps exactly onto input pixels. */
+
+#define WIDTH 32
+#define HEIGHT 24
+#define GRAY8_CAPS "video/x-raw, format=GRAY8, width=32, height=24, " \
+  "framerate=30/1"
+
+/* offset of the luma map in a .gtmap file, after the 40 byte header
+ * rounded up to 16 */
+#define MAP_OFFSET 48
+
+/* The name the element stores the map of a translation by @shift under,
+ * see gst_geometric_transform_get_map_key() and perspective_hash() */
+static gchar *
+get_map_path (const gchar * dir, gint shift)
+{
+  const gdouble matrix[9] = { 1, 0, shift, 0, 1, 0, 0, 0, 1 };
+  const gint32 params[9] = { WIDTH, HEIGHT, WIDTH, HEIGHT,
+    GST_VIDEO_FORMAT_GRAY8, 0, 0, 0, 0
+  };
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  gchar *filename, *path;
+
+  g_checksum_update (checksum, (const guchar *) "GstPerspective", -1);
+  g_checksum_update (checksum, (const guchar *) params, sizeof (params));
+  g_checksum_update (checksum, (const guchar *) matrix, sizeof (matrix));
+  filename = g_strconcat (g_checksum_get_string (checksum), ".gtmap", NULL);
+  path = g_build_filename (dir, filename, NULL);
+
+  g_free (filename);
+  g_checksum_free (checksum);
+
+  return path;
+}
+
+/* Warps a frame of random pixels with a translation by @shift and checks
+ * that the output is the input shifted by @expected_shift */
+static void
+check_translation (const gchar * dir, gint shift, gint expected_shift)
+{
+  GstHarness *h = gst_harness_new ("perspective");
+  GValueArray *va = g_value_array_new (9);
+  GValue v = G_VALUE_INIT;
+  GRand *rand = g_rand_new_with_seed (shift);
+  GstVideoInfo info;
+  GstVideoFrame in, out;
+  GstBuffer *in_buffer, *out_buffer;
+  const guint8 *in_data, *out_data;
+  gint x, y;
+  gsize i;
+
+  for (i = 0; i < 9; i++) {
+    g_value_init (&v, G_TYPE_DOUBLE);
+    g_value_set_double (&v, i == 2 ? shift : (i % 4 == 0));
+    g_value_array_append (va, &v);
+    g_value_unset (&v);
+  }
+  g_object_set (h->element, "matrix", va, "map-cache-dir", dir, NULL);
+  g_value_array_free (va);
+
+  gst_harness_set_caps_str (h, GRAY8_CAPS, GRAY8_CAPS);
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_GRAY8, WIDTH, HEIGHT);
+  in_buffer = gst_buffer_new_and_alloc (GST_VIDEO_INFO_SIZE (&info));
+  fail_unless (gst_video_frame_map (&in, &info, in_buffer, GST_MAP_WRITE));
+  in_data = GST_VIDEO_FRAME_PLANE_DATA (&in, 0);
+  for (i = 0; i < GST_VIDEO_INFO_SIZE (&info); i++)
+    ((guint8 *) in_data)[i] = g_rand_int_range (rand, 0, 256);
+  gst_video_frame_unmap (&in);
+
+  fail_unless_equals_int (gst_harness_push (h, gst_buffer_ref (in_buffer)),
+      GST_FLOW_OK);
+  out_buffer = gst_harness_pull (h);
+  fail_unless (out_buffer != NULL);
+
+  fail_unless (gst_video_frame_map (&in, &info, in_buffer, GST_MAP_READ));
+  fail_unless (gst_video_frame_map (&out, &info, out_buffer, GST_MAP_READ));
+  in_data = GST_VIDEO_FRAME_PLANE_DATA (&in, 0);
+  out_data = GST_VIDEO_FRAME_PLANE_DATA (&out, 0);
+
+  /* the columns shifted in from off the edge aren't checked */
+  for (y = 0; y < HEIGHT; y++) {
+    for (x = 0; x < WIDTH - expected_shift; x++) {
+      fail_unless_equals_int (out_data[y * GST_VIDEO_FRAME_PLANE_STRIDE (&out,
+                  0) + x], in_data[y * GST_VIDEO_FRAME_PLANE_STRIDE (&in,
+                  0) + x + expected_shift]);
+    }
+  }
+
+  gst_video_frame_unmap (&out);
+  gst_video_frame_unmap (&in);
+  gst_buffer_unref (out_buffer);
+  gst_buffer_unref (in_buffer);
+  gst_harness_teardown (h);
+  g_rand_free (rand);
+}
+
+/* Waits for the map cache writer to have stored @path, over the @invalid
+ * file if there is one */
+static void
+wait_for_map (const gchar * path, const gchar * invalid, gsize invalid_size)
+{
+  gint i;
+
+  for (i = 0; i < 500; i++) {
+    gchar *contents;
+    gsize length;
+    gboolean stored = FALSE;
+
+    if (g_file_get_contents (path, &contents, &length, NULL)) {
+      stored = !invalid || length != invalid_size
+          || memcmp (contents, invalid, length) != 0;
+      g_free (contents);
+    }
+    if (stored)
+      return;
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  fail ("%s was never stored", path);
+}
+
+/* Files written by the element are valid maps for this layout; one is
+ * stored under the name of each other translation, broken in some way */
+GST_START_TEST (test_invalid_files_are_regenerated)
+{
+  gchar *dir = g_dir_make_tmp ("gtmap-XXXXXX", NULL);
+  gchar *paths[4];
+  gchar *contents, *copy;
+  gsize size;
+  guint i;
+
+  fail_unless (dir != NULL);
+  for (i = 0; i < G_N_ELEMENTS (paths); i++)
+    paths[i] = get_map_path (dir, i);
+
+  /* the identity map */
+  check_translation (dir, 0, 0);
+  wait_for_map (paths[0], NULL, 0);
+  fail_unless (g_file_get_contents (paths[0], &contents, &size, NULL));
+  fail_unless (size > MAP_OFFSET);
+
+  /* a valid file is used as it is, even if it is the identity: this also
+   * makes sure the names above are the ones the element looks for */
+  fail_unless (g_file_set_contents (paths[1], contents, size, NULL));
+  check_translation (dir, 1, 0);
+
+  /* truncated, regenerated and stored again */
+  fail_unless (g_file_set_contents (paths[2], contents, size / 2, NULL));
+  check_translation (dir, 2, 2);
+  wait_for_map (paths[2], contents, size / 2);
+
+  /* the right size, but the first pixel is past the end of the row */
+  copy = g_memdup2 (contents, size);
+  ((gint16 *) (copy + MAP_OFFSET))[0] = WIDTH;
+  fail_unless (g_file_set_contents (paths[3], copy, size, NULL));
+  check_translation (dir, 3, 3);
+  wait_for_map (paths[3], copy, size);
+  g_free (copy);
+
+  for (i = 0; i < G_N_ELEMENTS (paths); i++) {
+    g_unlink (paths[i]);
+    g_free (paths[i]);
+  }
+  g_free (contents);
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+GST_END_TEST;
+
+static Suite *
+geometricmapcache_suite (void)
+{
+  Suite *s = suite_create ("geometricmapcache");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_invalid_files_are_regenerated);
+
+  return s;
+}
+
+GST_CHECK_MAIN (geometricmapcache);
@@ -0,0 +1,505 @@
+/* GStreamer
+ *
+ * unit test for the geometrictransform remap kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <string.h>
+#include <math.h>
+
+#include "geometricremap.h"
+
+/* Every kernel must give the same bytes as these plain loops, for every
+ * plane of the formats the deskew element warps natively. The planes and
+ * rows have odd sizes so that the vector loops also hit their tails, and
+ * the maps point at the last pixels of the plane so that kernels loading
+ * more than a pixel at once have to avoid reading past its end. */
+
+typedef struct
+{
+  const gchar *name;
+  GstGMRemapRowFunc row[3];     /* 1, 2 and 4 bytes per pixel */
+} RemapKernels;
+
+typedef struct
+{
+  gint width;
+  gint height;
+  gint pixel_stride;
+} PlaneLayout;
+
+#define OUT_WIDTH 61
+#define N_ROWS 16
+
+static void
+ref_remap_row (guint8 * out, const guint8 * in, gint in_stride,
+    gint pixel_stride, const gint16 * map, gint width)
+{
+  gint x, c;
+
+  for (x = 0; x < width; x++) {
+    if (map[2 * x] < 0)
+      continue;
+    for (c = 0; c < pixel_stride; c++)
+      out[x * pixel_stride + c] =
+          in[map[2 * x + 1] * in_stride + map[2 * x] * pixel_stride + c];
+  }
+}
+
+static void
+ref_bilinear_row (guint8 * out, const guint8 * in, gint in_stride,
+    gint in_width, gint in_height, gint pixel_stride, const gint16 * map,
+    const guint8 * frac, gint width)
+{
+  gint x, c;
+
+  for (x = 0; x < width; x++) {
+    gint x0 = map[2 * x], y0 = map[2 * x + 1];
+    gint x1 = MIN (x0 + 1, in_width - 1), y1 = MIN (y0 + 1, in_height - 1);
+    gint fx = frac[2 * x], fy = frac[2 * x + 1];
+
+    if (x0 < 0)
+      continue;
+    for (c = 0; c < pixel_stride; c++) {
+      gint tl = in[y0 * in_stride + x0 * pixel_stride + c];
+      gint tr = in[y0 * in_stride + x1 * pixel_stride + c];
+      gint bl = in[y1 * in_stride + x0 * pixel_stride + c];
+      gint br = in[y1 * in_stride + x1 * pixel_stride + c];
+      gint top = tl * (256 - fx) + tr * fx;
+      gint bottom = bl * (256 - fx) + br * fx;
+
+      out[x * pixel_stride + c] =
+          (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+    }
+  }
+}
+
+/* Catmull-Rom in floating point, the kernel uses fixed-point weights and
+ * may be 1 off */
+static gdouble
+ref_catmull_rom (gdouble p0, gdouble p1, gdouble p2, gdouble p3, gdouble t)
+{
+  return p1 + 0.5 * t * (p2 - p0 + t * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 +
+          t * (3.0 * (p1 - p2) + p3 - p0)));
+}
+
+static void
+ref_bicubic_row (guint8 * out, const guint8 * in, gint in_stride,
+    gint in_width, gint in_height, gint pixel_stride, const gint16 * map,
+    const guint8 * frac, gint width)
+{
+  gint x, c, i, j;
+
+  for (x = 0; x < width; x++) {
+    if (map[2 * x] < 0)
+      continue;
+    for (c = 0; c < pixel_stride; c++) {
+      gdouble rows[4];
+
+      for (j = 0; j < 4; j++) {
+        gint y = CLAMP (map[2 * x + 1] - 1 + j, 0, in_height - 1);
+        gdouble p[4];
+
+        for (i = 0; i < 4; i++) {
+          gint xi = CLAMP (map[2 * x] - 1 + i, 0, in_width - 1);
+
+          p[i] = in[y * in_stride + xi * pixel_stride + c];
+        }
+        rows[j] = ref_catmull_rom (p[0], p[1], p[2], p[3],
+            frac[2 * x] / 256.0);
+      }
+      out[x * pixel_stride + c] =
+          CLAMP (floor (ref_catmull_rom (rows[0], rows[1], rows[2], rows[3],
+                      frac[2 * x + 1] / 256.0) + 0.5), 0, 255);
+    }
+  }
+}
+
+static GPtrArray *
+get_kernels (void)
+{
+  GPtrArray *kernels = g_ptr_array_new_with_free_func (g_free);
+  RemapKernels *k;
+
+  k = g_new0 (RemapKernels, 1);
+  k->name = "c";
+  k->row[0] = gst_gm_remap_row_u8_c;
+  k->row[1] = gst_gm_remap_row_u16_c;
+  k->row[2] = gst_gm_remap_row_u32_c;
+  g_ptr_array_add (kernels, k);
+
+#if defined (HAVE_GM_REMAP_AVX2) && (defined (__GNUC__) || defined (__clang__))
+  if (__builtin_cpu_supports ("avx2")) {
+    k = g_new0 (RemapKernels, 1);
+    k->name = "avx2";
+    k->row[0] = gst_gm_remap_row_u8_avx2;
+    k->row[1] = gst_gm_remap_row_u16_avx2;
+    k->row[2] = gst_gm_remap_row_u32_avx2;
+    g_ptr_array_add (kernels, k);
+  }
+#endif
+
+#ifdef HAVE_GM_REMAP_NEON
+  k = g_new0 (RemapKernels, 1);
+  k->name = "neon";
+  k->row[0] = gst_gm_remap_row_u8_neon;
+  k->row[1] = gst_gm_remap_row_u16_neon;
+  k->row[2] = gst_gm_remap_row_u32_c;
+  g_ptr_array_add (kernels, k);
+#endif
+
+  /* whatever the element ends up with */
+  k = g_new0 (RemapKernels, 1);
+  k->name = gst_gm_remap_init ();
+  k->row[0] = gst_gm_remap_row_u8;
+  k->row[1] = gst_gm_remap_row_u16;
+  k->row[2] = gst_gm_remap_row_u32;
+  g_ptr_array_add (kernels, k);
+
+  return kernels;
+}
+
+/* Map entries of a row, some untouched (-1) and the last ones on the last
+ * input pixels. The others are random, or when @smooth is set on a slanted
+ * line across the input like the maps of deskew, so that the NEON kernel
+ * takes its table lookups and not only its fallback. */
+static void
+fill_map (GRand * rand, gint16 * map, guint8 * frac, gint width,
+    gint in_width, gint in_height, gboolean smooth)
+{
+  gdouble x0 = g_rand_int_range (rand, 0, in_width);
+  gdouble y0 = g_rand_int_range (rand, 0, in_height);
+  gdouble dx = g_rand_double_range (rand, -2.0, 2.0);
+  gdouble dy = g_rand_double_range (rand, -0.1, 0.1);
+  gint x;
+
+  for (x = 0; x < width; x++) {
+    if (g_rand_int_range (rand, 0, 8) == 0) {
+      map[2 * x] = -1;
+      map[2 * x + 1] = -1;
+    } else if (x >= width - 3) {
+      map[2 * x] = in_width - 1 - (width - 1 - x);
+      map[2 * x + 1] = in_height - 1;
+    } else if (smooth) {
+      map[2 * x] = CLAMP ((gint) (x0 + dx * x), 0, in_width - 1);
+      map[2 * x + 1] = CLAMP ((gint) (y0 + dy * x), 0, in_height - 1);
+    } else {
+      map[2 * x] = g_rand_int_range (rand, 0, in_width);
+      map[2 * x + 1] = g_rand_int_range (rand, 0, in_height);
+    }
+    frac[2 * x] = g_rand_int_range (rand, 0, 256);
+    frac[2 * x + 1] = g_rand_int_range (rand, 0, 256);
+  }
+}
+
+static void
+check_plane (GRand * rand, const PlaneLayout * plane, gboolean bilinear)
+{
+  gint in_stride = GST_ROUND_UP_4 (plane->width * plane->pixel_stride) + 4;
+  /* the plane ends right after its last pixel, like a mapped frame can */
+  gsize in_size = (gsize) in_stride * (plane->height - 1) +
+      plane->width * plane->pixel_stride;
+  gsize out_size = OUT_WIDTH * plane->pixel_stride;
+  guint8 *in = g_malloc (in_size);
+  guint8 *background = g_malloc (out_size);
+  guint8 *expected = g_malloc (out_size);
+  guint8 *out = g_malloc (out_size);
+  gint16 map[OUT_WIDTH * 2];
+  guint8 frac[OUT_WIDTH * 2];
+  GPtrArray *kernels = get_kernels ();
+  gint row_index = plane->pixel_stride == 4 ? 2 : plane->pixel_stride - 1;
+  gsize i;
+  gint r;
+  guint k;
+
+  for (i = 0; i < in_size; i++)
+    in[i] = g_rand_int_range (rand, 0, 256);
+
+  for (r = 0; r < N_ROWS; r++) {
+    fill_map (rand, map, frac, OUT_WIDTH, plane->width, plane->height,
+        r % 2);
+    for (i = 0; i < out_size; i++)
+      background[i] = g_rand_int_range (rand, 0, 256);
+
+    if (bilinear) {
+      memcpy (expected, background, out_size);
+      ref_bilinear_row (expected, in, in_stride, plane->width, plane->height,
+          plane->pixel_stride, map, frac, OUT_WIDTH);
+      memcpy (out, background, out_size);
+      gst_gm_remap_row_bilinear (out, in, in_stride, plane->width,
+          plane->height, plane->pixel_stride, map, frac, OUT_WIDTH);
+      fail_unless (memcmp (out, expected, out_size) == 0,
+          "bilinear differs from the reference, %d bytes per pixel",
+          plane->pixel_stride);
+
+      /* without fractions bilinear is nearest */
+      memset (frac, 0, sizeof (frac));
+      memcpy (expected, background, out_size);
+      ref_remap_row (expected, in, in_stride, plane->pixel_stride, map,
+          OUT_WIDTH);
+      memcpy (out, background, out_size);
+      gst_gm_remap_row_bilinear (out, in, in_stride, plane->width,
+          plane->height, plane->pixel_stride, map, frac, OUT_WIDTH);
+      fail_unless (memcmp (out, expected, out_size) == 0,
+          "bilinear without fractions differs from nearest, %d bytes per "
+          "pixel", plane->pixel_stride);
+      continue;
+    }
+
+    memcpy (expected, background, out_size);
+    ref_remap_row (expected, in, in_stride, plane->pixel_stride, map,
+        OUT_WIDTH);
+
+    for (k = 0; k < kernels->len; k++) {
+      const RemapKernels *kernel = g_ptr_array_index (kernels, k);
+
+      /* every row length, so that each tail length is covered */
+      memcpy (out, background, out_size);
+      kernel->row[row_index] (out, in, in_stride, in_size, map, OUT_WIDTH);
+      fail_unless (memcmp (out, expected, out_size) == 0,
+          "%s kernel differs from the reference, %d bytes per pixel",
+          kernel->name, plane->pixel_stride);
+
+      memcpy (out, background, out_size);
+      kernel->row[row_index] (out, in, in_stride, in_size, map, r + 1);
+      fail_unless (memcmp (out, expected, (r + 1) * plane->pixel_stride) == 0
+          && memcmp (out + (r + 1) * plane->pixel_stride,
+              background + (r + 1) * plane->pixel_stride,
+              out_size - (r + 1) * plane->pixel_stride) == 0,
+          "%s kernel differs from the reference on %d pixels", kernel->name,
+          r + 1);
+    }
+  }
+
+  g_ptr_array_unref (kernels);
+  g_free (out);
+  g_free (expected);
+  g_free (background);
+  g_free (in);
+}
+
+/* Bicubic against the reference, every tap clamped to the plane: the maps
+ * also point at the first and last rows and columns. Without fractions it
+ * must be nearest, and a flat plane must stay flat whatever the fractions,
+ * which holds only if every row of the weight table adds up to 1. */
+static void
+check_bicubic_plane (GRand * rand, const PlaneLayout * plane)
+{
+  gint in_stride = GST_ROUND_UP_4 (plane->width * plane->pixel_stride) + 4;
+  gsize in_size = (gsize) in_stride * plane->height;
+  gsize out_size = OUT_WIDTH * plane->pixel_stride;
+  guint8 *in = g_malloc (in_size);
+  guint8 *background = g_malloc (out_size);
+  guint8 *expected = g_malloc (out_size);
+  guint8 *out = g_malloc (out_size);
+  gint16 map[OUT_WIDTH * 2];
+  guint8 frac[OUT_WIDTH * 2];
+  gsize i;
+  gint r, x;
+
+  gst_gm_remap_init ();
+
+  for (i = 0; i < in_size; i++)
+    in[i] = g_rand_int_range (rand, 0, 256);
+
+  for (r = 0; r < N_ROWS; r++) {
+    fill_map (rand, map, frac, OUT_WIDTH, plane->width, plane->height,
+        r % 2);
+    /* the other corners and edges */
+    map[0] = 0;
+    map[1] = 0;
+    map[2] = plane->width - 1;
+    map[3] = 0;
+    map[4] = 0;
+    map[5] = plane->height - 1;
+    map[6] = 0;
+    map[7] = g_rand_int_range (rand, 0, plane->height);
+    for (i = 0; i < out_size; i++)
+      background[i] = g_rand_int_range (rand, 0, 256);
+
+    memcpy (expected, background, out_size);
+    ref_bicubic_row (expected, in, in_stride, plane->width, plane->height,
+        plane->pixel_stride, map, frac, OUT_WIDTH);
+    memcpy (out, background, out_size);
+    gst_gm_remap_row_bicubic (out, in, in_stride, plane->width,
+        plane->height, plane->pixel_stride, map, frac, OUT_WIDTH);
+    for (i = 0; i < out_size; i++)
+      fail_unless (ABS (out[i] - expected[i]) <= 1,
+          "bicubic gives %d instead of %d at byte %" G_GSIZE_FORMAT
+          ", %d bytes per pixel", out[i], expected[i], i,
+          plane->pixel_stride);
+
+    memset (frac, 0, sizeof (frac));
+    memcpy (expected, background, out_size);
+    ref_remap_row (expected, in, in_stride, plane->pixel_stride, map,
+        OUT_WIDTH);
+    memcpy (out, background, out_size);
+    gst_gm_remap_row_bicubic (out, in, in_stride, plane->width,
+        plane->height, plane->pixel_stride, map, frac, OUT_WIDTH);
+    fail_unless (memcmp (out, expected, out_size) == 0,
+        "bicubic without fractions differs from nearest, %d bytes per "
+        "pixel", plane->pixel_stride);
+  }
+
+  /* every fraction of both axes, on a flat plane of each value */
+  for (r = 0; r < 256; r += 17) {
+    memset (in, r, in_size);
+    for (x = 0; x < OUT_WIDTH; x++) {
+      map[2 * x] = x % plane->width;
+      map[2 * x + 1] = x % plane->height;
+    }
+    for (i = 0; i < 256 * 256; i += OUT_WIDTH) {
+      for (x = 0; x < OUT_WIDTH; x++) {
+        frac[2 * x] = (i + x) % 256;
+        frac[2 * x + 1] = ((i + x) / 256) % 256;
+      }
+      memset (out, r ^ 0xff, out_size);
+      gst_gm_remap_row_bicubic (out, in, in_stride, plane->width,
+          plane->height, plane->pixel_stride, map, frac, OUT_WIDTH);
+      for (x = 0; x < (gint) out_size; x++)
+        fail_unless (out[x] == r, "flat %d became %d with fractions %d, %d",
+            r, out[x], frac[2 * (x / plane->pixel_stride)],
+            frac[2 * (x / plane->pixel_stride) + 1]);
+    }
+  }
+
+  g_free (out);
+  g_free (expected);
+  g_free (background);
+  g_free (in);
+}
+
+static void
+check_format (const PlaneLayout * planes, guint n_planes, gboolean bilinear)
+{
+  GRand *rand = g_rand_new_with_seed (0x9e3779b9);
+  guint i;
+
+  for (i = 0; i < n_planes; i++)
+    check_plane (rand, &planes[i], bilinear);
+
+  g_rand_free (rand);
+}
+
+static void
+check_bicubic_format (const PlaneLayout * planes, guint n_planes)
+{
+  GRand *rand = g_rand_new_with_seed (0x9e3779b9);
+  guint i;
+
+  for (i = 0; i < n_planes; i++)
+    check_bicubic_plane (rand, &planes[i]);
+
+  g_rand_free (rand);
+}
+
+/* a 67x41 frame: luma, then chroma as the element samples it */
+static const PlaneLayout nv12_planes[] = { {67, 41, 1}, {34, 21, 2} };
+static const PlaneLayout i420_planes[] = { {67, 41, 1}, {34, 21, 1},
+{34, 21, 1}
+};
+static const PlaneLayout rgbx_planes[] = { {67, 41, 4} };
+
+GST_START_TEST (test_nearest_nv12)
+{
+  check_format (nv12_planes, G_N_ELEMENTS (nv12_planes), FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_nearest_i420)
+{
+  check_format (i420_planes, G_N_ELEMENTS (i420_planes), FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_nearest_rgbx)
+{
+  check_format (rgbx_planes, G_N_ELEMENTS (rgbx_planes), FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bilinear_nv12)
+{
+  check_format (nv12_planes, G_N_ELEMENTS (nv12_planes), TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bilinear_i420)
+{
+  check_format (i420_planes, G_N_ELEMENTS (i420_planes), TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bilinear_rgbx)
+{
+  check_format (rgbx_planes, G_N_ELEMENTS (rgbx_planes), TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bicubic_nv12)
+{
+  check_bicubic_format (nv12_planes, G_N_ELEMENTS (nv12_planes));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bicubic_i420)
+{
+  check_bicubic_format (i420_planes, G_N_ELEMENTS (i420_planes));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_bicubic_rgbx)
+{
+  check_bicubic_format (rgbx_planes, G_N_ELEMENTS (rgbx_planes));
+}
+
+GST_END_TEST;
+
+static Suite *
+geometricremap_suite (void)
+{
+  Suite *s = suite_create ("geometricremap");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_nearest_nv12);
+  tcase_add_test (tc_chain, test_nearest_i420);
+  tcase_add_test (tc_chain, test_nearest_rgbx);
+  tcase_add_test (tc_chain, test_bilinear_nv12);
+  tcase_add_test (tc_chain, test_bilinear_i420);
+  tcase_add_test (tc_chain, test_bilinear_rgbx);
+  tcase_add_test (tc_chain, test_bicubic_nv12);
+  tcase_add_test (tc_chain, test_bicubic_i420);
+  tcase_add_test (tc_chain, test_bicubic_rgbx);
+
+  return s;
+}
+
+GST_CHECK_MAIN (geometricremap);
@@ -0,0 +1,62 @@
+#include "gstbuslog.h"
+#include <iostream>
+
+void GstBusLog::watch(GstElement* pipeline, const char* name, GstMessageType keep) {
+    GstBus* bus = gst_element_get_bus(pipeline);
+    // The pipeline owns the bus, it isn't referenced back
+    gst_bus_set_sync_handler(bus, onMessage, new Watch{pipeline, name, keep},
+        [](gpointer data) { delete static_cast<Watch*>(data); });
+    gst_object_unref(bus);
+}
+
+GstBusSyncReply GstBusLog::onMessage(GstBus* bus, GstMessage* msg, gpointer user_data) {
+    const Watch* watch = static_cast<const Watch*>(user_data);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ERROR: {
+            GError* err = nullptr;
+            gchar* debug = nullptr;
+            gst_message_parse_error(msg, &err, &debug);
+            std::cerr << watch->name << " error: " << err->message << std::endl;
+            if (debug) std::cerr << "Debug info: " << debug << std::endl;
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_WARNING: {
+            GError* err = nullptr;
+            gchar* debug = nullptr;
+            gst_message_parse_warning(msg, &err, &debug);
+            std::cerr << watch->name << " warning: " << err->message << std::endl;
+            if (debug) std::cerr << "Debug info: " << debug << std::endl;
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            std::cout << watch->name << ": end of stream" << std::endl;
+            break;
+        case GST_MESSAGE_STATE_CHANGED: {
+            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(watch->pipeline)) {
+                GstState old_state, new_state, pending;
+                gst_message_parse_state_changed(msg, &old_state, &new_state, &pending);
+                std::cout << watch->name << " pipeline state changed from "
+                          << gst_element_state_get_name(old_state)
+                          << " to " << gst_element_state_get_name(new_state)
+                          << std::endl;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (GST_MESSAGE_TYPE(msg) & watch->keep) {
+        // The bus emits the sync-message signal itself for what it queues
+        return GST_BUS_PASS;
+    }
+    // ...but not for what the handler drops, nobody would ever pop it
+    gst_bus_sync_signal_handler(bus, msg, nullptr);
+    gst_message_unref(msg);
+    return GST_BUS_DROP;
+}
@@ -0,0 +1,28 @@
+#ifndef GSTBUSLOG_H
+#define GSTBUSLOG_H
+
+#include <gst/gst.h>
+
+// Logs the errors, warnings and state changes a pipeline posts, from the
+// thread that posts them: nothing iterates the default main context under
+// gst_macos_main, so a bus watch would never run. Messages are dropped
+// once logged, except the types in keep, which stay queued for
+// gst_bus_timed_pop_filtered (see GstFinalizer). Sync-message signals
+// (see GstPipelineStats) are still emitted for every message.
+class GstBusLog {
+public:
+    // name prefixes the log lines and must outlive the pipeline
+    static void watch(GstElement* pipeline, const char* name,
+                      GstMessageType keep = GST_MESSAGE_UNKNOWN);
+
+private:
+    struct Watch {
+        GstElement* pipeline;
+        const char* name;
+        GstMessageType keep;
+    };
+
+    static GstBusSyncReply onMessage(GstBus* bus, GstMessage* msg, gpointer user_data);
+};
+
+#endif // GSTBUSLOG_H
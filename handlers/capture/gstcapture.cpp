@@ -0,0 +1,389 @@
+#include "gstcapture.h"
+#include "gstbuslog.h"
+#include <iostream>
+#include <algorithm>
+
+CaptureSources GstCapture::sources;
+std::map<std::pair<std::string, std::string>, std::weak_ptr<GstCapture>> GstCapture::captures;
+std::mutex GstCapture::captures_mutex;
+
+GstFanout::GstFanout(GstElement* pipeline, GstElement* appsink)
+    : pipeline(pipeline), appsink(GST_ELEMENT(gst_object_ref(appsink))) {
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = onNewSample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, this, nullptr);
+}
+
+GstFanout::~GstFanout() {
+    GstAppSinkCallbacks callbacks = {};
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, nullptr, nullptr);
+    gst_object_unref(appsink);
+
+    for (auto& output : outputs) {
+        gst_object_unref(output.appsrc);
+    }
+    gst_clear_caps(&caps);
+}
+
+void GstFanout::add(GstElement* appsrc, GstElement* consumer, bool wait_keyframe,
+                    bool preroll, GstClockTime start) {
+    std::lock_guard<std::mutex> lock(mutex);
+    GstClockTime base_time = gst_element_get_base_time(consumer);
+    Output output = {GST_ELEMENT(gst_object_ref(appsrc)), base_time,
+                     GST_CLOCK_TIME_IS_VALID(start) ? std::max(start, base_time) : base_time,
+                     GST_CLOCK_TIME_NONE, wait_keyframe, wait_keyframe};
+
+    if (preroll && ring && ring->start() != GST_CLOCK_TIME_NONE && ring->start() >= output.start) {
+        // The ring starts on a keyframe and ends right before the next
+        // sample, the consumer picks up from there
+        ring->forEach([&](GstBuffer* buffer) {
+            output.last = GST_BUFFER_PTS(buffer);
+            GST_BUFFER_PTS(buffer) -= output.base_time;
+            if (GST_BUFFER_DTS_IS_VALID(buffer)) {
+                GST_BUFFER_DTS(buffer) = GST_BUFFER_DTS(buffer) >= output.base_time ?
+                    GST_BUFFER_DTS(buffer) - output.base_time : GST_CLOCK_TIME_NONE;
+            }
+            GstSample* sample = gst_sample_new(buffer, caps, nullptr, nullptr);
+            gst_app_src_push_sample(GST_APP_SRC(output.appsrc), sample);
+            gst_sample_unref(sample);
+        });
+        output.wait_keyframe = false;
+    }
+    outputs.push_back(output);
+}
+
+void GstFanout::setPreroll(GstClockTime duration, gsize max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (duration == 0 || max_bytes == 0) {
+        ring.reset();
+        return;
+    }
+    // Room for 120 fps, the byte bound is what normally applies
+    gsize max_frames = (duration / GST_SECOND + 1) * 120;
+    ring = std::make_unique<GstGopRing>(duration, max_bytes, max_frames);
+}
+
+GstClockTime GstFanout::prerollStart() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ring ? ring->start() : GST_CLOCK_TIME_NONE;
+}
+
+GstClockTime GstFanout::remove(GstElement* appsrc) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(outputs.begin(), outputs.end(),
+        [appsrc](const Output& output) { return output.appsrc == appsrc; });
+    if (it == outputs.end()) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    GstClockTime last = it->last;
+    gst_object_unref(it->appsrc);
+    outputs.erase(it);
+    return last;
+}
+
+guint64 GstFanout::dropped(GstElement* appsrc) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& output : outputs) {
+        if (output.appsrc == appsrc) {
+            // Plus what a leaky appsrc dropped itself
+            guint64 leaked = 0;
+            g_object_get(appsrc, "dropped", &leaked, NULL);
+            return output.dropped + leaked;
+        }
+    }
+    return 0;
+}
+
+size_t GstFanout::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return outputs.size();
+}
+
+bool GstFanout::isFull(GstAppSrc* appsrc) {
+    guint64 max_bytes = gst_app_src_get_max_bytes(appsrc);
+    guint64 max_buffers = gst_app_src_get_max_buffers(appsrc);
+    GstClockTime max_time = gst_app_src_get_max_time(appsrc);
+    return (max_bytes && gst_app_src_get_current_level_bytes(appsrc) >= max_bytes) ||
+        (max_buffers && gst_app_src_get_current_level_buffers(appsrc) >= max_buffers) ||
+        (max_time && gst_app_src_get_current_level_time(appsrc) >= max_time);
+}
+
+GstFlowReturn GstFanout::onNewSample(GstAppSink* appsink, gpointer user_data) {
+    GstFanout* self = static_cast<GstFanout*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    const GstSegment* segment = gst_sample_get_segment(sample);
+    GstClockTime base_time = gst_element_get_base_time(self->pipeline);
+    GstClockTime pts = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    GstClockTime dts = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_DTS(buffer));
+
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (self->ring && GST_CLOCK_TIME_IS_VALID(pts)) {
+        gst_caps_replace(&self->caps, gst_sample_get_caps(sample));
+        self->ring->push(buffer, pts + base_time,
+            GST_CLOCK_TIME_IS_VALID(dts) ? dts + base_time : GST_CLOCK_TIME_NONE);
+    }
+    for (auto& output : self->outputs) {
+        // Same clock everywhere, only the base times differ. Whatever was
+        // captured before the consumer started (or moved here) is dropped.
+        if (!GST_CLOCK_TIME_IS_VALID(pts) || pts + base_time < output.start) {
+            continue;
+        }
+        if (output.encoded && isFull(GST_APP_SRC(output.appsrc))) {
+            // The consumer fell behind, pick up again on a keyframe once
+            // it caught up
+            if (!output.wait_keyframe) {
+                std::cerr << "A session fell behind, dropping its video until the "
+                          << "next keyframe" << std::endl;
+            }
+            output.wait_keyframe = true;
+            output.overflowed = true;
+            output.dropped++;
+            continue;
+        }
+        if (output.wait_keyframe) {
+            if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+                // Only a drop once the consumer got frames, not on joining
+                output.dropped += output.overflowed;
+                continue;
+            }
+            output.wait_keyframe = false;
+            output.overflowed = false;
+        }
+
+        // Only the metadata is copied, the memory is shared
+        GstBuffer* copy = gst_buffer_copy(buffer);
+        GST_BUFFER_PTS(copy) = pts + base_time - output.base_time;
+        GST_BUFFER_DTS(copy) = GST_CLOCK_TIME_IS_VALID(dts) && dts + base_time >= output.base_time ?
+            dts + base_time - output.base_time : GST_CLOCK_TIME_NONE;
+
+        GstSample* retimed = gst_sample_new(copy, gst_sample_get_caps(sample), nullptr, nullptr);
+        // A consumer that falls behind or is shutting down only loses its
+        // own samples, raw ones through their leaky appsrc
+        gst_app_src_push_sample(GST_APP_SRC(output.appsrc), retimed);
+        gst_sample_unref(retimed);
+        output.last = pts + base_time;
+        gst_buffer_unref(copy);
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void GstCapture::setSources(const CaptureSources& new_sources) {
+    std::lock_guard<std::mutex> lock(captures_mutex);
+    sources = new_sources;
+}
+
+std::shared_ptr<GstCapture> GstCapture::get(const std::string& camIndex,
+                                            const std::string& audioIndex) {
+    std::lock_guard<std::mutex> lock(captures_mutex);
+    auto key = std::make_pair(camIndex, audioIndex);
+    auto it = captures.find(key);
+    if (it != captures.end()) {
+        if (auto capture = it->second.lock()) {
+            return capture;
+        }
+    }
+
+    std::shared_ptr<GstCapture> capture(new GstCapture());
+    if (!capture->createPipeline(camIndex, audioIndex)) {
+        return nullptr;
+    }
+    captures[key] = capture;
+    return capture;
+}
+
+void GstCapture::useClock(GstElement* pipeline) {
+    // The capture runs on the system clock rather than on the microphone's,
+    // so that every pipeline it feeds can share it
+    GstClock* clock = gst_system_clock_obtain();
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), clock);
+    // Fixed base time: the running time starts now and doesn't depend on
+    // when the pipeline reaches PLAYING
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, gst_clock_get_time(clock));
+    gst_object_unref(clock);
+}
+
+static GstElement* createConsumerSource(const char* name) {
+    GstElement* appsrc = gst_element_factory_make("appsrc", name);
+    if (!appsrc) {
+        return nullptr;
+    }
+
+    g_object_set(appsrc,
+        "is-live", TRUE,
+        "format", GST_FORMAT_TIME,
+        "do-timestamp", FALSE,
+        "block", FALSE,
+        NULL);
+    // Drop the oldest queued samples rather than queue without bound when
+    // the session can't keep up, the newest are the ones it wants
+    gst_util_set_object_arg(G_OBJECT(appsrc), "leaky-type", "downstream");
+    return appsrc;
+}
+
+GstElement* GstCapture::createVideoSource(const char* name) {
+    GstElement* appsrc = createConsumerSource(name);
+    if (appsrc) {
+        g_object_set(appsrc, "max-buffers", (guint64) 8, NULL);
+    }
+    return appsrc;
+}
+
+GstElement* GstCapture::createAudioSource(const char* name) {
+    GstElement* appsrc = createConsumerSource(name);
+    if (appsrc) {
+        g_object_set(appsrc, "max-time", (guint64) GST_SECOND / 2, NULL);
+    }
+    return appsrc;
+}
+
+void GstCapture::attach(GstElement* pipeline, GstElement* video_src, GstElement* audio_src) {
+    if (video_src) {
+        video_fanout->add(video_src, pipeline);
+    }
+    if (audio_src) {
+        audio_fanout->add(audio_src, pipeline);
+    }
+}
+
+void GstCapture::detach(GstElement* video_src, GstElement* audio_src) {
+    if (video_src) {
+        video_fanout->remove(video_src);
+    }
+    if (audio_src) {
+        audio_fanout->remove(audio_src);
+    }
+}
+
+static GstElement* createSource(const std::string& description, const char* factory,
+                                const char* name) {
+    if (description.empty()) {
+        return gst_element_factory_make(factory, name);
+    }
+
+    GError* error = nullptr;
+    GstElement* bin = gst_parse_bin_from_description(description.c_str(), TRUE, &error);
+    if (error) {
+        std::cerr << "Invalid capture source \"" << description << "\": " << error->message << std::endl;
+        g_error_free(error);
+        if (bin) gst_object_unref(bin);
+        return nullptr;
+    }
+    gst_object_set_name(GST_OBJECT(bin), name);
+    return bin;
+}
+
+bool GstCapture::createPipeline(const std::string& camIndex, const std::string& audioIndex) {
+    pipeline = gst_pipeline_new(("capture-pipeline-" + camIndex).c_str());
+    if (!pipeline) {
+        std::cerr << "Failed to create capture pipeline" << std::endl;
+        return false;
+    }
+
+#ifdef __APPLE__
+    const char* video_factory = "avfvideosrc";
+    const char* audio_factory = "osxaudiosrc";
+#else
+    const char* video_factory = "videotestsrc";
+    const char* audio_factory = "audiotestsrc";
+#endif
+
+    GstElement* src = createSource(sources.video, video_factory, "source");
+    GstElement* capsfilter = gst_element_factory_make("capsfilter", "capsfilter");
+    GstElement* video_queue = gst_element_factory_make("queue", "video_queue");
+    GstElement* video_sink = gst_element_factory_make("appsink", "video_sink");
+    GstElement* audio_src = createSource(sources.audio, audio_factory, "audio_src");
+    GstElement* audio_queue = gst_element_factory_make("queue", "audio_queue");
+    GstElement* audio_sink = gst_element_factory_make("appsink", "audio_sink");
+
+    if (!src || !capsfilter || !video_queue || !video_sink ||
+        !audio_src || !audio_queue || !audio_sink) {
+        std::cerr << "Failed to create one or more capture elements" << std::endl;
+        return false;
+    }
+
+    if (sources.video.empty()) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(src), "device-unique-id")) {
+            g_object_set(src,
+                "do-timestamp", TRUE,
+                "device-unique-id", camIndex.c_str(),
+                "capture-screen", FALSE,
+                NULL);
+        } else {
+            g_object_set(src, "is-live", TRUE, NULL);
+        }
+    }
+    if (sources.audio.empty()) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(audio_src), "unique-id")) {
+            g_object_set(audio_src, "unique-id", audioIndex.c_str(), NULL);
+        } else {
+            g_object_set(audio_src, "is-live", TRUE, NULL);
+        }
+    }
+
+    // What every session used to ask the camera for
+    GstCaps* caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "NV12",
+        "width", G_TYPE_INT, 1280,
+        "height", G_TYPE_INT, 720,
+        "framerate", GST_TYPE_FRACTION_RANGE, 15, 1, 60, 1,
+        NULL);
+    g_object_set(capsfilter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    // The sinks hand samples over as they come, the consumers queue them
+    for (GstElement* sink : {video_sink, audio_sink}) {
+        g_object_set(sink,
+            "sync", FALSE,
+            "max-buffers", 2,
+            "drop", TRUE,
+            NULL);
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline),
+        src, capsfilter, video_queue, video_sink,
+        audio_src, audio_queue, audio_sink,
+        NULL);
+
+    if (!gst_element_link_many(src, capsfilter, video_queue, video_sink, NULL) ||
+        !gst_element_link_many(audio_src, audio_queue, audio_sink, NULL)) {
+        std::cerr << "Failed to link capture elements" << std::endl;
+        return false;
+    }
+
+    video_fanout = std::make_unique<GstFanout>(pipeline, video_sink);
+    audio_fanout = std::make_unique<GstFanout>(pipeline, audio_sink);
+
+    GstBusLog::watch(pipeline, "Capture");
+
+    useClock(pipeline);
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Failed to start capture pipeline" << std::endl;
+        return false;
+    }
+
+    std::cout << "Started capture for camera " << camIndex << " and microphone " << audioIndex << std::endl;
+    return true;
+}
+
+guint64 GstCapture::dropped(GstElement* src) {
+    return video_fanout->dropped(src) + audio_fanout->dropped(src);
+}
+
+GstCapture::~GstCapture() {
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        // no more samples after this, the fanouts can go
+        video_fanout.reset();
+        audio_fanout.reset();
+
+        gst_object_unref(pipeline);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef GSTCAPTURE_H
+#define GSTCAPTURE_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "gstgopring.h"
+
+// Pushes every sample an appsink receives to the appsrcs of any number of
+// consumer pipelines. Buffers are retimed to the running time of each
+// consumer, which must run on the same clock (see GstCapture::useClock).
+class GstFanout {
+public:
+    GstFanout(GstElement* pipeline, GstElement* appsink);
+    ~GstFanout();
+
+    GstFanout(const GstFanout&) = delete;
+    GstFanout& operator=(const GstFanout&) = delete;
+
+    // consumer is the pipeline appsrc is in. Encoded streams must start on
+    // a keyframe, wait_keyframe drops everything until the next one. Their
+    // appsrc can't be leaky, dropping any frame would break the ones that
+    // reference it: when it is full, everything until the next keyframe is
+    // dropped instead. With preroll, whatever the pre-roll ring holds from
+    // the consumer's base time on is pushed first. Nothing captured before
+    // start (a clock time) is pushed, by default the consumer's base time.
+    void add(GstElement* appsrc, GstElement* consumer, bool wait_keyframe = false,
+             bool preroll = false, GstClockTime start = GST_CLOCK_TIME_NONE);
+    // Clock time of the last sample pushed to appsrc, GST_CLOCK_TIME_NONE
+    // if none was
+    GstClockTime remove(GstElement* appsrc);
+    size_t size();
+    // Samples appsrc didn't get since it was added, because it was full
+    guint64 dropped(GstElement* appsrc);
+
+    // Keeps up to duration and max_bytes of encoded GOPs for new consumers
+    void setPreroll(GstClockTime duration, gsize max_bytes);
+    // Clock time the pre-roll ring starts at, GST_CLOCK_TIME_NONE if empty
+    GstClockTime prerollStart();
+
+private:
+    struct Output {
+        GstElement* appsrc;
+        GstClockTime base_time;
+        GstClockTime start;
+        GstClockTime last;
+        bool encoded;
+        bool wait_keyframe;
+        bool overflowed; // waits for a keyframe because it was full
+        guint64 dropped;
+    };
+
+    // Whether appsrc reached any of its max-bytes/-buffers/-time
+    static bool isFull(GstAppSrc* appsrc);
+
+    static GstFlowReturn onNewSample(GstAppSink* appsink, gpointer user_data);
+
+    GstElement* pipeline; // the pipeline appsink is in, not owned
+    GstElement* appsink;
+    std::vector<Output> outputs;
+    std::unique_ptr<GstGopRing> ring;
+    GstCaps* caps = nullptr; // of the samples in ring
+    std::mutex mutex;
+};
+
+// Where the capture gets its frames and sound from. Empty descriptions use
+// the camera and microphone of the device indices, anything else is a
+// gst-launch description, e.g. "videotestsrc is-live=true" to run without
+// the hardware.
+struct CaptureSources {
+    std::string video;
+    std::string audio;
+};
+
+// One long-lived pipeline per (camera, microphone) pair, opening the devices
+// once for all the recordings, streams and the preview. Sessions run in
+// their own pipelines, fed through appsrcs.
+class GstCapture {
+public:
+    static void setSources(const CaptureSources& sources);
+
+    // The capture of a device pair, started on first use and stopped once
+    // nobody holds it anymore
+    static std::shared_ptr<GstCapture> get(const std::string& camIndex,
+                                           const std::string& audioIndex);
+
+    // Makes pipeline run on the capture clock, must be called before
+    // anything is attached to it
+    static void useClock(GstElement* pipeline);
+
+    // Appsrcs for consumer pipelines, to be attached once in their pipeline
+    static GstElement* createVideoSource(const char* name);
+    static GstElement* createAudioSource(const char* name);
+
+    // Either source can be nullptr
+    void attach(GstElement* pipeline, GstElement* video_src, GstElement* audio_src);
+    void detach(GstElement* video_src, GstElement* audio_src);
+    // Samples an attached source didn't get because it was full
+    guint64 dropped(GstElement* src);
+
+    ~GstCapture();
+
+private:
+    GstCapture() = default;
+
+    bool createPipeline(const std::string& camIndex, const std::string& audioIndex);
+
+    GstElement* pipeline = nullptr;
+    std::unique_ptr<GstFanout> video_fanout;
+    std::unique_ptr<GstFanout> audio_fanout;
+
+    static CaptureSources sources;
+    static std::map<std::pair<std::string, std::string>, std::weak_ptr<GstCapture>> captures;
+    static std::mutex captures_mutex;
+};
+
+#endif // GSTCAPTURE_H
@@ -0,0 +1,43 @@
+#include "gstfinalizer.h"
+#include <iostream>
+#include <thread>
+
+void GstFinalizer::finalize(GstElement* pipeline, Done done, GstClockTime timeout) {
+    if (!gst_element_send_event(pipeline, gst_event_new_eos())) {
+        std::cerr << "Failed to send EOS event" << std::endl;
+    }
+
+    // The worker keeps its own reference, the caller may drop its one
+    gst_object_ref(pipeline);
+    std::thread([pipeline, done = std::move(done), timeout]() {
+        bool eos = false;
+        GstBus* bus = gst_element_get_bus(pipeline);
+        if (bus) {
+            GstMessage* msg = gst_bus_timed_pop_filtered(bus, timeout,
+                static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+
+            if (!msg) {
+                std::cerr << "Timed out waiting for EOS on "
+                          << GST_ELEMENT_NAME(pipeline) << std::endl;
+            } else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+                GError* err = nullptr;
+                gchar* debug = nullptr;
+                gst_message_parse_error(msg, &err, &debug);
+                std::cerr << "Error while stopping: " << err->message << std::endl;
+                if (debug) std::cerr << "Debug: " << debug << std::endl;
+                g_error_free(err);
+                g_free(debug);
+            } else {
+                eos = true;
+            }
+            if (msg) {
+                gst_message_unref(msg);
+            }
+            gst_object_unref(bus);
+        }
+
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        done(eos);
+    }).detach();
+}
@@ -0,0 +1,22 @@
+#ifndef GSTFINALIZER_H
+#define GSTFINALIZER_H
+
+#include <gst/gst.h>
+#include <functional>
+
+// Ends a pipeline without blocking the caller: EOS is sent right away, the
+// wait for it to reach the sinks (so that muxers can write their headers)
+// happens on a worker thread. Any number of pipelines can finalize at once.
+class GstFinalizer {
+public:
+    // Runs on the worker thread once the pipeline is in NULL state, eos is
+    // false when it errored or didn't drain within the timeout
+    using Done = std::function<void(bool eos)>;
+
+    static constexpr GstClockTime DEFAULT_TIMEOUT = 5 * GST_SECOND;
+
+    static void finalize(GstElement* pipeline, Done done,
+                         GstClockTime timeout = DEFAULT_TIMEOUT);
+};
+
+#endif // GSTFINALIZER_H
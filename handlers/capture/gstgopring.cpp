@@ -0,0 +1,89 @@
+#include "gstgopring.h"
+#include <algorithm>
+
+GstGopRing::GstGopRing(GstClockTime duration, gsize max_bytes, gsize max_frames)
+    : duration(duration), data(max_bytes), frames(std::max<gsize>(max_frames, 1)) {
+}
+
+bool GstGopRing::fits(gsize size, gsize& offset) const {
+    if (count == 0) {
+        offset = 0;
+        return size <= data.size();
+    }
+
+    gsize read_pos = frame(0).offset;
+    if (write_pos > read_pos) {
+        // Free space after the newest frame, or from the start of the
+        // buffer up to the oldest one
+        if (write_pos + size <= data.size()) {
+            offset = write_pos;
+            return true;
+        }
+        offset = 0;
+        return size <= read_pos;
+    }
+    // Wrapped around, the free space is between the two
+    offset = write_pos;
+    return write_pos + size <= read_pos;
+}
+
+bool GstGopRing::dropGop(bool keep_last) {
+    gsize next = 1;
+    while (next < count && !frame(next).keyframe) {
+        next++;
+    }
+    if (keep_last && next == count) {
+        return false;
+    }
+    first = (first + next) % frames.size();
+    count -= next;
+    return true;
+}
+
+void GstGopRing::push(GstBuffer* buffer, GstClockTime pts, GstClockTime dts) {
+    bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (count == 0 && !keyframe) {
+        // Can't be decoded without the GOP it belongs to
+        return;
+    }
+
+    gsize size = gst_buffer_get_size(buffer);
+    gsize offset = 0;
+    while (count == frames.size() || !fits(size, offset)) {
+        if (count == 0) {
+            // Larger than the whole ring
+            return;
+        }
+        dropGop(false);
+        if (count == 0 && !keyframe) {
+            return;
+        }
+    }
+
+    gst_buffer_extract(buffer, 0, data.data() + offset, size);
+    frames[(first + count) % frames.size()] = {offset, size, pts, dts, keyframe};
+    count++;
+    write_pos = offset + size;
+
+    // Only whole GOPs are dropped, the current one is always kept
+    while (GST_CLOCK_TIME_IS_VALID(pts) && pts > frame(0).pts + duration && dropGop(true)) {
+    }
+}
+
+GstClockTime GstGopRing::start() const {
+    return count ? frame(0).pts : GST_CLOCK_TIME_NONE;
+}
+
+void GstGopRing::forEach(const std::function<void(GstBuffer* buffer)>& fn) const {
+    for (gsize i = 0; i < count; i++) {
+        const Frame& f = frame(i);
+        GstBuffer* buffer = gst_buffer_new_memdup(data.data() + f.offset, f.size);
+        GST_BUFFER_PTS(buffer) = f.pts;
+        GST_BUFFER_DTS(buffer) = f.dts;
+        if (!f.keyframe) {
+            GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+        fn(buffer);
+        gst_buffer_unref(buffer);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef GSTGOPRING_H
+#define GSTGOPRING_H
+
+#include <gst/gst.h>
+#include <functional>
+#include <vector>
+
+// Keeps the last GOPs of an encoded stream in memory, bounded by duration
+// and size. Frames are copied into one buffer allocated up front and used
+// circularly, making room drops the oldest GOP, so the ring always starts
+// on a keyframe and never grows.
+class GstGopRing {
+public:
+    // max_frames bounds the frame table the same way max_bytes bounds the data
+    GstGopRing(GstClockTime duration, gsize max_bytes, gsize max_frames);
+
+    GstGopRing(const GstGopRing&) = delete;
+    GstGopRing& operator=(const GstGopRing&) = delete;
+
+    // pts and dts are clock times, running time plus base time
+    void push(GstBuffer* buffer, GstClockTime pts, GstClockTime dts);
+
+    // Clock time of the oldest frame, GST_CLOCK_TIME_NONE when empty
+    GstClockTime start() const;
+
+    // Calls fn with a new buffer for every frame, oldest first
+    void forEach(const std::function<void(GstBuffer* buffer)>& fn) const;
+
+private:
+    struct Frame {
+        gsize offset;
+        gsize size;
+        GstClockTime pts;
+        GstClockTime dts;
+        bool keyframe;
+    };
+
+    const Frame& frame(gsize i) const { return frames[(first + i) % frames.size()]; }
+    bool fits(gsize size, gsize& offset) const;
+    // Drops the oldest GOP, unless it's the only one and keep_last is set
+    bool dropGop(bool keep_last);
+
+    GstClockTime duration;
+    std::vector<guint8> data;
+    std::vector<Frame> frames;
+    gsize first = 0;
+    gsize count = 0;
+    gsize write_pos = 0;
+};
+
+#endif // GSTGOPRING_H
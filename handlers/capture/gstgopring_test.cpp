@@ -0,0 +1,134 @@
+#include "gstgopring.h"
+#include "unit_test.h"
+#include <string>
+#include <vector>
+
+// A frame of size bytes, all of them fill
+static void pushFrame(GstGopRing& ring, gsize size, guint8 fill, bool keyframe, GstClockTime pts) {
+    std::vector<guint8> bytes(size, fill);
+    GstBuffer* buffer = gst_buffer_new_memdup(bytes.data(), bytes.size());
+    if (!keyframe) {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    ring.push(buffer, pts, pts);
+    gst_buffer_unref(buffer);
+}
+
+struct Kept {
+    GstClockTime pts;
+    bool keyframe;
+    std::string bytes;
+};
+
+static std::vector<Kept> kept(const GstGopRing& ring) {
+    std::vector<Kept> frames;
+    ring.forEach([&](GstBuffer* buffer) {
+        GstMapInfo map;
+        gst_buffer_map(buffer, &map, GST_MAP_READ);
+        frames.push_back({GST_BUFFER_PTS(buffer),
+                          !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT),
+                          std::string((const char*) map.data, map.size)});
+        gst_buffer_unmap(buffer, &map);
+    });
+    return frames;
+}
+
+static void testStartsOnKeyframe() {
+    GstGopRing ring(10 * GST_SECOND, 1024, 64);
+    CHECK_EQ(ring.start(), GST_CLOCK_TIME_NONE);
+
+    // Deltas before the first keyframe can't be decoded
+    pushFrame(ring, 10, 1, false, 0);
+    CHECK_EQ(ring.start(), GST_CLOCK_TIME_NONE);
+
+    pushFrame(ring, 10, 2, true, 1 * GST_SECOND);
+    pushFrame(ring, 10, 3, false, 2 * GST_SECOND);
+    CHECK_EQ(ring.start(), (GstClockTime) GST_SECOND);
+    auto frames = kept(ring);
+    CHECK_EQ(frames.size(), (size_t) 2);
+    CHECK(frames[0].keyframe);
+    CHECK(!frames[1].keyframe);
+    CHECK_EQ(frames[1].pts, (GstClockTime) (2 * GST_SECOND));
+}
+
+// Whole GOPs older than the duration are dropped, never the current one
+static void testDuration() {
+    GstGopRing ring(2 * GST_SECOND, 1 << 16, 256);
+    for (int i = 0; i < 10; i++) {
+        // One GOP per second, 4 frames each
+        for (int j = 0; j < 4; j++) {
+            pushFrame(ring, 8, (guint8) i, j == 0, i * GST_SECOND + j * 250 * GST_MSECOND);
+        }
+    }
+    CHECK_EQ(ring.start(), (GstClockTime) (8 * GST_SECOND));
+    auto frames = kept(ring);
+    CHECK_EQ(frames.size(), (size_t) 8);
+    CHECK(frames[0].keyframe);
+
+    // A single GOP longer than the duration stays whole
+    GstGopRing long_gop(GST_SECOND, 1 << 16, 256);
+    for (int i = 0; i < 10; i++) {
+        pushFrame(long_gop, 8, 0, i == 0, i * GST_SECOND);
+    }
+    CHECK_EQ(long_gop.start(), (GstClockTime) 0);
+    CHECK_EQ(kept(long_gop).size(), (size_t) 10);
+}
+
+// The data never outgrows max_bytes and wraps around without mixing frames up
+static void testBytes() {
+    GstGopRing ring(1000 * GST_SECOND, 100, 256);
+    GstClockTime pts = 0;
+    for (int gop = 0; gop < 20; gop++) {
+        for (int j = 0; j < 3; j++) {
+            pushFrame(ring, 7 + gop % 5, (guint8) (gop * 3 + j), j == 0, pts);
+            pts += GST_MSECOND;
+        }
+    }
+
+    auto frames = kept(ring);
+    gsize total = 0;
+    for (const auto& frame : frames) {
+        total += frame.bytes.size();
+    }
+    CHECK(total <= 100);
+    CHECK(!frames.empty());
+    CHECK(frames[0].keyframe);
+    CHECK_EQ(frames.size() % 3, (size_t) 0);
+    CHECK_EQ(frames.back().pts, (GstClockTime) (pts - GST_MSECOND));
+    for (size_t i = 0; i < frames.size(); i++) {
+        guint8 fill = (guint8) frames[i].bytes[0];
+        CHECK_EQ(frames[i].bytes, std::string(frames[i].bytes.size(), (char) fill));
+        if (i > 0) {
+            CHECK_EQ(fill, (guint8) ((guint8) frames[i - 1].bytes[0] + 1));
+        }
+    }
+
+    // A frame larger than the whole ring isn't kept, nor what depends on it
+    pushFrame(ring, 101, 0, true, pts);
+    pushFrame(ring, 10, 0, false, pts + GST_MSECOND);
+    CHECK_EQ(ring.start(), GST_CLOCK_TIME_NONE);
+    CHECK(kept(ring).empty());
+
+    pushFrame(ring, 100, 0, true, pts + 2 * GST_MSECOND);
+    CHECK_EQ(kept(ring).size(), (size_t) 1);
+}
+
+static void testFrames() {
+    GstGopRing ring(1000 * GST_SECOND, 1 << 16, 5);
+    for (int i = 0; i < 12; i++) {
+        pushFrame(ring, 4, (guint8) i, i % 2 == 0, i * GST_MSECOND);
+    }
+    auto frames = kept(ring);
+    CHECK(frames.size() <= 5);
+    CHECK_EQ(frames.size(), (size_t) 4);
+    CHECK_EQ(ring.start(), (GstClockTime) (8 * GST_MSECOND));
+}
+
+int main(int argc, char* argv[]) {
+    gst_init(&argc, &argv);
+    testStartsOnKeyframe();
+    testDuration();
+    testBytes();
+    testFrames();
+    return unitTestResult();
+}
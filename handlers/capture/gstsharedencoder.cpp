@@ -0,0 +1,342 @@
+#include "gstsharedencoder.h"
+#include "gstbuslog.h"
+#include <gst/video/video.h>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+std::map<std::pair<GstCapture*, std::string>, std::weak_ptr<GstSharedEncoder>> GstSharedEncoder::encoders;
+std::mutex GstSharedEncoder::encoders_mutex;
+size_t GstSharedEncoder::screenshot_frames = GstSharedEncoder::DEFAULT_SCREENSHOT_FRAMES;
+GstClockTime GstSharedEncoder::preroll_duration = 0;
+gsize GstSharedEncoder::preroll_bytes = 0;
+std::shared_ptr<GstSharedEncoder> GstSharedEncoder::retained;
+
+// Encoded video a session's appsrc holds at most before the fanout drops
+static const GstClockTime MAX_QUEUED_TIME = 2 * GST_SECOND;
+
+// Same values as the videoflip "method" deskew replaces
+static const std::unordered_map<std::string, int> flip_methods = {
+    {"none", 0}, {"horizontal", 1}, {"vertical", 2},
+    {"clockwise", 3}, {"counterclockwise", 4}};
+
+// Corner points go to deskew as a flat array of 8 doubles
+static void setDeskewPoints(GstElement* deskew, const std::vector<std::pair<double, double>>& points) {
+    GValueArray* points_array = g_value_array_new(8);
+    for (const auto& point : points) {
+        for (double coord : {point.first, point.second}) {
+            GValue val = G_VALUE_INIT;
+            g_value_init(&val, G_TYPE_DOUBLE);
+            g_value_set_double(&val, coord);
+            g_value_array_append(points_array, &val);
+            g_value_unset(&val);
+        }
+    }
+    g_object_set(G_OBJECT(deskew), "points", points_array, NULL);
+    g_value_array_free(points_array);
+}
+
+std::string EncoderSettings::key() const {
+    std::ostringstream key;
+    key.precision(17);
+    for (const auto& point : points) {
+        key << point.first << "," << point.second << ";";
+    }
+    key << flip_mode << ";" << width << "x" << height << ";"
+        << bitrate << ";" << key_int_max << ";" << speed_preset;
+    return key.str();
+}
+
+std::shared_ptr<GstSharedEncoder> GstSharedEncoder::get(const std::shared_ptr<GstCapture>& capture,
+                                                        const EncoderSettings& settings) {
+    if (!flip_methods.count(settings.flip_mode)) {
+        std::cerr << "Invalid flip mode: " << settings.flip_mode << std::endl;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(encoders_mutex);
+    auto key = std::make_pair(capture.get(), settings.key());
+    auto it = encoders.find(key);
+    if (it != encoders.end()) {
+        if (auto encoder = it->second.lock()) {
+            std::cout << "Sharing the encoder of another session" << std::endl;
+            if (preroll_duration) {
+                retained = encoder;
+            }
+            encoder->sessions++;
+            return encoder;
+        }
+    }
+
+    std::shared_ptr<GstSharedEncoder> encoder(new GstSharedEncoder());
+    encoder->capture = capture;
+    encoder->settings = settings;
+    if (!encoder->createPipeline(settings)) {
+        return nullptr;
+    }
+    encoders[key] = encoder;
+    if (preroll_duration) {
+        retained = encoder;
+    }
+    encoder->sessions++;
+    return encoder;
+}
+
+void GstSharedEncoder::setPreroll(GstClockTime duration, gsize max_bytes) {
+    std::lock_guard<std::mutex> lock(encoders_mutex);
+    preroll_duration = max_bytes ? duration : 0;
+    preroll_bytes = max_bytes;
+    if (!preroll_duration) {
+        retained.reset();
+    }
+}
+
+void GstSharedEncoder::setScreenshotFrames(size_t count) {
+    std::lock_guard<std::mutex> lock(encoders_mutex);
+    screenshot_frames = count;
+}
+
+GstElement* GstSharedEncoder::createVideoSource(const char* name) {
+    GstElement* appsrc = gst_element_factory_make("appsrc", name);
+    if (!appsrc) {
+        return nullptr;
+    }
+
+    g_object_set(appsrc,
+        "is-live", TRUE,
+        "format", GST_FORMAT_TIME,
+        "do-timestamp", FALSE,
+        "block", FALSE,
+        // Bounded by time only, keyframes can be large. Not leaky: once
+        // it is full the fanout drops up to the next keyframe, see
+        // GstFanout::add
+        "max-bytes", (guint64) 0,
+        "max-time", MAX_QUEUED_TIME,
+        NULL);
+    return appsrc;
+}
+
+void GstSharedEncoder::attach(GstElement* pipeline, GstElement* video_src, bool preroll) {
+    GstClockTime start = preroll ? fanout->prerollStart() : GST_CLOCK_TIME_NONE;
+    if (GST_CLOCK_TIME_IS_VALID(start) && start < gst_element_get_base_time(pipeline)) {
+        // Running time 0 is the oldest kept keyframe
+        gst_element_set_base_time(pipeline, start);
+    }
+    if (GST_CLOCK_TIME_IS_VALID(start)) {
+        // The pre-roll is pushed all at once, on top of the usual bound
+        GstClock* clock = gst_system_clock_obtain();
+        GstClockTime now = gst_clock_get_time(clock);
+        gst_object_unref(clock);
+        g_object_set(video_src, "max-time", MAX_QUEUED_TIME + (now > start ? now - start : 0), NULL);
+    }
+    fanout->add(video_src, pipeline, true, preroll);
+
+    if (!GST_CLOCK_TIME_IS_VALID(start)) {
+        // Ask for a keyframe right away rather than make the new session
+        // wait for the next one
+        gst_element_send_event(video_sink,
+            gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+}
+
+void GstSharedEncoder::detach(GstElement* video_src) {
+    fanout->remove(video_src);
+    std::lock_guard<std::mutex> lock(encoders_mutex);
+    sessions--;
+}
+
+std::shared_ptr<GstSharedEncoder> GstSharedEncoder::updatePoints(GstElement* pipeline,
+        GstElement* video_src, const std::vector<std::pair<double, double>>& points) {
+    std::shared_ptr<GstSharedEncoder> self = shared_from_this();
+    EncoderSettings moved;
+    {
+        std::lock_guard<std::mutex> lock(encoders_mutex);
+        moved = settings;
+        moved.points = points;
+        auto key = std::make_pair(capture.get(), moved.key());
+        auto it = encoders.find(key);
+        bool exists = it != encoders.end() && it->second.lock();
+        // Screenshots and bursts hold encoders too, only sessions count
+        if (!exists && sessions == 1) {
+            // Nobody else to disturb: the pipeline keeps running, deskew
+            // builds the new map in the background and switches to it
+            // between two frames
+            setDeskewPoints(deskew, points);
+            if (retained == self) {
+                // The kept GOPs show the old points
+                fanout->setPreroll(preroll_duration, preroll_bytes);
+            }
+            auto old_it = encoders.find(std::make_pair(capture.get(), settings.key()));
+            if (old_it != encoders.end() && old_it->second.lock() == self) {
+                encoders.erase(old_it);
+            }
+            settings = moved;
+            encoders[key] = self;
+            return self;
+        }
+    }
+
+    std::shared_ptr<GstSharedEncoder> encoder = get(capture, moved);
+    if (!encoder) {
+        return nullptr;
+    }
+    // Picks up after the last frame the session got from here, on the
+    // keyframe attach asks for
+    GstClockTime last = fanout->remove(video_src);
+    {
+        std::lock_guard<std::mutex> lock(encoders_mutex);
+        sessions--;
+    }
+    encoder->fanout->add(video_src, pipeline, true, false,
+        GST_CLOCK_TIME_IS_VALID(last) ? last + 1 : GST_CLOCK_TIME_NONE);
+    gst_element_send_event(encoder->video_sink,
+        gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    std::cout << "Session moved to an encoder of its new points" << std::endl;
+    return encoder;
+}
+
+std::string GstSharedEncoder::statsJson() {
+    return "{\"dropped\":" + std::to_string(capture->dropped(video_src)) + "," +
+           stats->toJson().substr(1);
+}
+
+bool GstSharedEncoder::createPipeline(const EncoderSettings& settings) {
+    pipeline = gst_pipeline_new("encoder-pipeline");
+    if (!pipeline) {
+        std::cerr << "Failed to create encoder pipeline" << std::endl;
+        return false;
+    }
+    GstCapture::useClock(pipeline);
+
+    video_src = GstCapture::createVideoSource("source");
+    deskew = gst_element_factory_make("deskew", "deskew");
+    GstElement* capsink = gst_element_factory_make("capsfilter", "capsink");
+    GstElement* tee = gst_element_factory_make("tee", "screenshot_tee");
+    GstElement* queue = gst_element_factory_make("queue", "queue");
+    GstElement* frame_queue = gst_element_factory_make("queue", "frame_queue");
+    GstElement* frame_sink = gst_element_factory_make("appsink", "frame_sink");
+    GstElement* encoder = gst_element_factory_make("x264enc", "encoder");
+    GstElement* h264parse = gst_element_factory_make("h264parse", "h264parse");
+    GstElement* capsparse = gst_element_factory_make("capsfilter", "capsparse");
+    video_sink = gst_element_factory_make("appsink", "video_sink");
+
+    if (!video_src || !deskew || !capsink || !tee || !queue || !frame_queue || !frame_sink ||
+        !encoder || !h264parse || !capsparse || !video_sink) {
+        std::cerr << "Failed to create one or more encoder elements" << std::endl;
+        return false;
+    }
+
+    // Deskew, flip and scale in a single pass, straight from the camera's
+    // NV12 into the I420 x264enc wants. The output size comes from capsink.
+    setDeskewPoints(deskew, settings.points);
+    g_object_set(G_OBJECT(deskew), "video-direction", flip_methods.at(settings.flip_mode), NULL);
+    // Split the warp across all cores (0 = one band per processor)
+    g_object_set(G_OBJECT(deskew), "n-threads", 0, NULL);
+    // Smooth edges on the deskewed text instead of nearest-neighbour jaggies
+    gst_util_set_object_arg(G_OBJECT(deskew), "interpolation", "bilinear");
+    // Operators reuse the same camera rigs, keep the remap tables across
+    // restarts so the first frame doesn't wait for one to be generated
+    std::string map_cache_dir = std::string(g_get_user_cache_dir()) + "/binaryCameraRecorder/deskew";
+    g_object_set(G_OBJECT(deskew), "map-cache-dir", map_cache_dir.c_str(), NULL);
+
+    GstCaps* out_caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "I420",
+        "width", G_TYPE_INT, settings.width,
+        "height", G_TYPE_INT, settings.height,
+        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+        "framerate", GST_TYPE_FRACTION_RANGE, 15, 1, 60, 1,
+        NULL);
+    g_object_set(capsink, "caps", out_caps, NULL);
+    gst_caps_unref(out_caps);
+
+    g_object_set(encoder,
+        "bitrate", settings.bitrate,
+        "tune", 0x00000004,  // zerolatency
+        "key-int-max", settings.key_int_max,
+        NULL);
+    gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", settings.speed_preset.c_str());
+
+    // SPS/PPS in front of every keyframe, so that sessions can join at any
+    // keyframe. Each session parses it into what its muxer or sink needs.
+    g_object_set(h264parse, "config-interval", -1, NULL);
+    GstCaps* parse_caps = gst_caps_new_simple("video/x-h264",
+        "stream-format", G_TYPE_STRING, "byte-stream",
+        "alignment", G_TYPE_STRING, "au",
+        NULL);
+    g_object_set(capsparse, "caps", parse_caps, NULL);
+    gst_caps_unref(parse_caps);
+
+    g_object_set(video_sink,
+        "sync", FALSE,
+        "max-buffers", 30,
+        "drop", TRUE,
+        NULL);
+
+    // Screenshot tap: only ever holds the newest frame, whatever the
+    // screenshots don't take in time is dropped rather than queued up in
+    // front of the encoder
+    g_object_set(frame_queue,
+        "max-size-buffers", 1,
+        "max-size-bytes", 0,
+        "max-size-time", (guint64) 0,
+        NULL);
+    gst_util_set_object_arg(G_OBJECT(frame_queue), "leaky", "downstream");
+    g_object_set(frame_sink,
+        "sync", FALSE,
+        "async", FALSE,
+        "max-buffers", 1,
+        "drop", TRUE,
+        NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline),
+        video_src, deskew, capsink, tee, queue, encoder, h264parse, capsparse, video_sink,
+        frame_queue, frame_sink,
+        NULL);
+
+    if (!gst_element_link_many(
+        video_src, deskew, capsink, tee, queue, encoder, h264parse, capsparse, video_sink, NULL) ||
+        !gst_element_link_many(tee, frame_queue, frame_sink, NULL)) {
+        std::cerr << "Failed to link encoder elements" << std::endl;
+        return false;
+    }
+
+    fanout = std::make_unique<GstFanout>(pipeline, video_sink);
+    frames = std::make_unique<GstFrameTap>(frame_sink, screenshot_frames);
+
+    // Perspective, flip and scale are a single deskew pass. The age at
+    // "capture" is how long frames take from the camera to the encoder.
+    stats = GstPipelineStats::create(pipeline);
+    stats->addPoint("capture", "deskew", "sink");
+    stats->addElement("deskew", "deskew");
+    stats->addElement("encode", "encoder");
+    stats->addPoint("encoded", "video_sink", "sink");
+    stats->addQueue("queue");
+    stats->addQueue("frame_queue");
+    if (preroll_duration) {
+        fanout->setPreroll(preroll_duration, preroll_bytes);
+    }
+
+    GstBusLog::watch(pipeline, "Encoder");
+
+    capture->attach(pipeline, video_src, nullptr);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Failed to start encoder pipeline" << std::endl;
+        capture->detach(video_src, nullptr);
+        return false;
+    }
+    return true;
+}
+
+GstSharedEncoder::~GstSharedEncoder() {
+    if (capture && video_src) {
+        capture->detach(video_src, nullptr);
+    }
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        fanout.reset();
+        frames.reset();
+
+        gst_object_unref(pipeline);
+    }
+}
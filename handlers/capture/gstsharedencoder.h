@@ -0,0 +1,112 @@
+#ifndef GSTSHAREDENCODER_H
+#define GSTSHAREDENCODER_H
+
+#include <gst/gst.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "gstcapture.h"
+#include "gstscreenshot.h"
+#include "gststats.h"
+
+// Everything the encoded video depends on. Sessions asking for the same
+// settings get the same stream.
+struct EncoderSettings {
+    std::vector<std::pair<double, double>> points;
+    std::string flip_mode = "none";
+    int width = 1280;
+    int height = 720;
+    int bitrate = 2000; // kbps
+    int key_int_max = 30;
+    std::string speed_preset = "ultrafast"; // x264enc speed-preset nick
+
+    std::string key() const;
+};
+
+// Deskews and H.264 encodes the frames of a capture once, for all the
+// recordings and streams that use the same settings. Sessions get the
+// encoded video through an appsrc, starting on a keyframe.
+class GstSharedEncoder : public std::enable_shared_from_this<GstSharedEncoder> {
+public:
+    static std::shared_ptr<GstSharedEncoder> get(const std::shared_ptr<GstCapture>& capture,
+                                                 const EncoderSettings& settings);
+
+    // byte-stream H.264 appsrc, to be attached once in its pipeline
+    static GstElement* createVideoSource(const char* name);
+
+    // Keeps up to duration (and max_bytes) of encoded video for sessions
+    // attached with preroll, 0 turns it off. Applies to encoders created
+    // afterwards. The last encoder used keeps running after its sessions
+    // stopped, so that the next start with the same settings has video
+    // from before it.
+    static void setPreroll(GstClockTime duration, gsize max_bytes);
+
+    // Raw frames kept for screenshots of encoders created afterwards, see
+    // GstFrameTap
+    static void setScreenshotFrames(size_t count);
+    static constexpr size_t DEFAULT_SCREENSHOT_FRAMES = 10;
+
+    // pipeline must run on the capture clock, see GstCapture::useClock.
+    // With preroll its base time is moved back to the oldest kept keyframe,
+    // so this must be called before anything else is attached to it.
+    void attach(GstElement* pipeline, GstElement* video_src, bool preroll = false);
+    // Every session that got the encoder detaches once, attached or not
+    void detach(GstElement* video_src);
+    // Frames an attached source didn't get because its session fell behind
+    guint64 dropped(GstElement* video_src) { return fanout->dropped(video_src); }
+
+    // Moves the deskew corners of the session whose pipeline is fed
+    // through video_src. The other sessions of this encoder keep theirs:
+    // when there are any, the session moves to the encoder of the new
+    // points, a new one if needed, and goes on from its next keyframe.
+    // Returns the encoder the session uses from now on, nullptr if it
+    // couldn't be moved.
+    std::shared_ptr<GstSharedEncoder> updatePoints(GstElement* pipeline, GstElement* video_src,
+        const std::vector<std::pair<double, double>>& points);
+
+    // The pipeline the raw frames go through
+    GstElement* getPipeline() const { return pipeline; }
+
+    // The deskewed frames, for screenshots
+    GstFrameTap& frameTap() { return *frames; }
+
+    // See GstPipelineStats::toJson, plus the camera frames the encoder
+    // dropped because it fell behind
+    std::string statsJson();
+    GstPipelineStats& pipelineStats() { return *stats; }
+
+    ~GstSharedEncoder();
+
+private:
+    GstSharedEncoder() = default;
+
+    bool createPipeline(const EncoderSettings& settings);
+
+    std::shared_ptr<GstCapture> capture;
+    EncoderSettings settings;
+    GstElement* pipeline = nullptr;
+    GstElement* video_src = nullptr;
+    GstElement* deskew = nullptr;
+    GstElement* video_sink = nullptr;
+    std::unique_ptr<GstFanout> fanout;
+    // Always attached, so screenshots don't touch the pipeline
+    std::unique_ptr<GstFrameTap> frames;
+    std::shared_ptr<GstPipelineStats> stats;
+    // Sessions that got the encoder and haven't detached yet, under
+    // encoders_mutex
+    int sessions = 0;
+
+    static std::map<std::pair<GstCapture*, std::string>, std::weak_ptr<GstSharedEncoder>> encoders;
+    static std::mutex encoders_mutex;
+
+    static size_t screenshot_frames;
+    static GstClockTime preroll_duration;
+    static gsize preroll_bytes;
+    // last encoder used, kept running for its pre-roll
+    static std::shared_ptr<GstSharedEncoder> retained;
+};
+
+#endif // GSTSHAREDENCODER_H
@@ -0,0 +1,342 @@
+#include "gststats.h"
+#include <algorithm>
+#include <cstdio>
+
+// Buffers kept track of per element, should some never come out
+static const size_t MAX_INSIDE = 64;
+
+std::shared_ptr<GstPipelineStats> GstPipelineStats::create(GstElement* pipeline) {
+    std::shared_ptr<GstPipelineStats> stats(new GstPipelineStats(pipeline));
+
+    // Elements post QoS messages when they drop or are late; sync messages
+    // come on the streaming threads, no main loop needed
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_enable_sync_message_emission(bus);
+    g_signal_connect_data(bus, "sync-message::qos", G_CALLBACK(onQos),
+        new std::shared_ptr<GstPipelineStats>(stats),
+        [](gpointer data, GClosure*) { delete static_cast<std::shared_ptr<GstPipelineStats>*>(data); },
+        (GConnectFlags) 0);
+    gst_object_unref(bus);
+    return stats;
+}
+
+GstPipelineStats::GstPipelineStats(GstElement* pipeline)
+    : pipeline(pipeline), clock(gst_system_clock_obtain()) {
+}
+
+GstPipelineStats::~GstPipelineStats() {
+    gst_object_unref(clock);
+}
+
+GstClockTime GstPipelineStats::now() const {
+    return gst_clock_get_time(clock);
+}
+
+std::string GstPipelineStats::quote(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+namespace {
+
+struct ProbeData {
+    std::shared_ptr<GstPipelineStats> stats;
+    size_t index;
+};
+
+// Clock time a buffer was captured at, GST_CLOCK_TIME_NONE if unknown
+GstClockTime captureTime(GstPad* pad, GstBuffer* buffer) {
+    GstEvent* event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (!event) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    const GstSegment* segment;
+    gst_event_parse_segment(event, &segment);
+    GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    gst_event_unref(event);
+    if (!GST_CLOCK_TIME_IS_VALID(running_time)) {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    GstElement* element = gst_pad_get_parent_element(pad);
+    if (!element) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    GstClockTime base_time = gst_element_get_base_time(element);
+    gst_object_unref(element);
+    return running_time + base_time;
+}
+
+} // namespace
+
+void GstPipelineStats::addProbe(GstPad* pad, GstPadProbeCallback callback, size_t index) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback,
+        new ProbeData{shared_from_this(), index},
+        [](gpointer data) { delete static_cast<ProbeData*>(data); });
+}
+
+void GstPipelineStats::addElement(const std::string& label, const char* name) {
+    GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    if (!element) {
+        return;
+    }
+    GstPad* sink = gst_element_get_static_pad(element, "sink");
+    GstPad* src = gst_element_get_static_pad(element, "src");
+    gst_object_unref(element);
+    if (!sink || !src) {
+        if (sink) gst_object_unref(sink);
+        if (src) gst_object_unref(src);
+        return;
+    }
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index = timings.size();
+        timings.push_back(std::make_unique<Timing>());
+        timings.back()->label = label;
+    }
+
+    addProbe(sink, [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+        ProbeData* data = static_cast<ProbeData*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstClockTime arrival = data->stats->now();
+
+        std::lock_guard<std::mutex> lock(data->stats->mutex);
+        Timing& timing = *data->stats->timings[data->index];
+        if (timing.inside.size() == MAX_INSIDE) {
+            timing.inside.pop_front();
+        }
+        timing.inside.emplace_back(GST_BUFFER_PTS(buffer), arrival);
+        return GST_PAD_PROBE_OK;
+    }, index);
+
+    addProbe(src, [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+        ProbeData* data = static_cast<ProbeData*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstClockTime departure = data->stats->now();
+
+        std::lock_guard<std::mutex> lock(data->stats->mutex);
+        Timing& timing = *data->stats->timings[data->index];
+        // Whatever came in before this buffer and didn't come out was dropped
+        while (!timing.inside.empty()) {
+            auto [pts, arrival] = timing.inside.front();
+            timing.inside.pop_front();
+            if (pts == GST_BUFFER_PTS(buffer)) {
+                GstClockTime spent = departure - arrival;
+                timing.frames++;
+                timing.total += spent;
+                timing.max = std::max(timing.max, spent);
+                break;
+            }
+        }
+        return GST_PAD_PROBE_OK;
+    }, index);
+
+    gst_object_unref(sink);
+    gst_object_unref(src);
+}
+
+void GstPipelineStats::addPoint(const std::string& label, const char* name, const char* pad_name) {
+    GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    if (!element) {
+        return;
+    }
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+    gst_object_unref(element);
+    if (!pad) {
+        return;
+    }
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index = points.size();
+        points.push_back(std::make_unique<Point>());
+        points.back()->label = label;
+    }
+
+    addProbe(pad, [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+        ProbeData* data = static_cast<ProbeData*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstClockTime arrival = data->stats->now();
+        GstClockTime captured = captureTime(pad, buffer);
+
+        std::lock_guard<std::mutex> lock(data->stats->mutex);
+        Point& point = *data->stats->points[data->index];
+        point.frames++;
+        if (!GST_CLOCK_TIME_IS_VALID(point.first)) {
+            point.first = arrival;
+        }
+        point.last = arrival;
+        point.recent.push_back(arrival);
+        while (point.recent.front() + GST_SECOND < arrival) {
+            point.recent.pop_front();
+        }
+        // Frames from before the session (pre-roll) would skew the age
+        if (GST_CLOCK_TIME_IS_VALID(captured) && captured <= arrival &&
+            arrival - captured < 10 * GST_SECOND) {
+            GstClockTime age = arrival - captured;
+            point.aged++;
+            point.age_total += age;
+            point.age_max = std::max(point.age_max, age);
+            if (point.ages.size() == MAX_AGES) {
+                point.ages.pop_front();
+            }
+            point.ages.emplace_back(arrival, age);
+        }
+        return GST_PAD_PROBE_OK;
+    }, index);
+
+    gst_object_unref(pad);
+}
+
+void GstPipelineStats::addQueue(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    queues.push_back(name);
+}
+
+void GstPipelineStats::onQos(GstBus* bus, GstMessage* msg, gpointer user_data) {
+    GstPipelineStats* self = static_cast<std::shared_ptr<GstPipelineStats>*>(user_data)->get();
+    GstFormat format;
+    guint64 processed, dropped;
+    gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+    gint64 jitter;
+    gdouble proportion;
+    gint quality;
+    gst_message_parse_qos_values(msg, &jitter, &proportion, &quality);
+    GstClockTime duration;
+    gst_message_parse_qos(msg, nullptr, nullptr, nullptr, nullptr, &duration);
+
+    std::string element = GST_OBJECT_NAME(GST_MESSAGE_SRC(msg));
+    std::lock_guard<std::mutex> lock(self->mutex);
+    auto it = self->qos.begin();
+    while (it != self->qos.end() && it->element != element) {
+        ++it;
+    }
+    if (it == self->qos.end()) {
+        it = self->qos.insert(self->qos.end(), Qos{element});
+    }
+    // Elements report running totals, -1 when they don't know
+    bool dropped_more = false;
+    if ((format == GST_FORMAT_BUFFERS || format == GST_FORMAT_DEFAULT) && dropped != (guint64) -1) {
+        dropped_more = dropped > it->dropped;
+        it->processed = processed;
+        it->dropped = dropped;
+    }
+    // Late is a frame dropped, or more than a frame duration behind; any
+    // less is scheduling noise, elements report it with every frame
+    if (GST_CLOCK_TIME_IS_VALID(duration)) {
+        it->late_threshold = duration;
+    }
+    if (dropped_more || (GST_CLOCK_TIME_IS_VALID(duration) && jitter > (gint64) duration)) {
+        it->late++;
+    }
+}
+
+bool GstPipelineStats::getPoint(const std::string& label, guint64& frames, std::vector<GstClockTime>& ages,
+                                GstClockTime since) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& point : points) {
+        if (point->label != label) {
+            continue;
+        }
+        frames = point->frames;
+        for (const auto& [arrival, age] : point->ages) {
+            if (arrival >= since) {
+                ages.push_back(age);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+GstClockTime GstPipelineStats::percentile(std::vector<GstClockTime> values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t) (fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static std::string ms(GstClockTime time) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.2f", (double) time / GST_MSECOND);
+    return buf;
+}
+
+std::string GstPipelineStats::toJson() {
+    GstClockTime current = now();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string out = "{\"elements\":{";
+    for (size_t i = 0; i < timings.size(); i++) {
+        const Timing& timing = *timings[i];
+        out += (i ? "," : "") + quote(timing.label) + ":{\"frames\":" + std::to_string(timing.frames) +
+               ",\"avgMs\":" + ms(timing.frames ? timing.total / timing.frames : 0) +
+               ",\"maxMs\":" + ms(timing.max) + "}";
+    }
+
+    out += "},\"points\":{";
+    for (size_t i = 0; i < points.size(); i++) {
+        Point& point = *points[i];
+        while (!point.recent.empty() && point.recent.front() + GST_SECOND < current) {
+            point.recent.pop_front();
+        }
+        char fps[32];
+        double elapsed = point.frames > 1 ? (double) (point.last - point.first) / GST_SECOND : 0;
+        std::snprintf(fps, sizeof(fps), "%.1f,\"avgFps\":%.1f", (double) point.recent.size(),
+                      elapsed > 0 ? (point.frames - 1) / elapsed : 0.0);
+        std::vector<GstClockTime> ages;
+        for (const auto& [arrival, age] : point.ages) {
+            ages.push_back(age);
+        }
+        out += (i ? "," : "") + quote(point.label) + ":{\"frames\":" + std::to_string(point.frames) +
+               ",\"fps\":" + fps +
+               ",\"ageMs\":" + ms(point.aged ? point.age_total / point.aged : 0) +
+               ",\"p50AgeMs\":" + ms(percentile(ages, 0.5)) +
+               ",\"p95AgeMs\":" + ms(percentile(ages, 0.95)) +
+               ",\"p99AgeMs\":" + ms(percentile(ages, 0.99)) +
+               ",\"maxAgeMs\":" + ms(point.age_max) + "}";
+    }
+
+    out += "},\"queues\":{";
+    for (size_t i = 0; i < queues.size(); i++) {
+        guint buffers = 0, max_buffers = 0;
+        guint64 time = 0;
+        GstElement* queue = gst_bin_get_by_name(GST_BIN(pipeline), queues[i].c_str());
+        if (queue) {
+            g_object_get(queue,
+                "current-level-buffers", &buffers,
+                "current-level-time", &time,
+                "max-size-buffers", &max_buffers,
+                NULL);
+            gst_object_unref(queue);
+        }
+        out += (i ? "," : "") + quote(queues[i]) + ":{\"buffers\":" + std::to_string(buffers) +
+               ",\"maxBuffers\":" + std::to_string(max_buffers) + ",\"ms\":" + ms(time) + "}";
+    }
+
+    out += "},\"qos\":{";
+    for (size_t i = 0; i < qos.size(); i++) {
+        out += (i ? "," : "") + quote(qos[i].element) + ":{\"processed\":" + std::to_string(qos[i].processed) +
+               ",\"dropped\":" + std::to_string(qos[i].dropped) +
+               ",\"late\":" + std::to_string(qos[i].late) +
+               ",\"lateThresholdMs\":" + ms(qos[i].late_threshold) + "}";
+    }
+    return out + "}}";
+}
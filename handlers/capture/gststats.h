@@ -0,0 +1,98 @@
+#ifndef GSTSTATS_H
+#define GSTSTATS_H
+
+#include <gst/gst.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Pad-probe instrumentation of a running pipeline: time spent in elements,
+// frame rate and age of the frames at given pads, queue fill levels and
+// the QoS (late/dropped) reports of its elements. The probes keep the
+// stats alive, they go away with the pipeline's pads. The pipeline must run
+// on the capture clock (see GstCapture::useClock), ages are measured from
+// the time a frame was captured.
+class GstPipelineStats : public std::enable_shared_from_this<GstPipelineStats> {
+public:
+    static std::shared_ptr<GstPipelineStats> create(GstElement* pipeline);
+    ~GstPipelineStats();
+
+    GstPipelineStats(const GstPipelineStats&) = delete;
+    GstPipelineStats& operator=(const GstPipelineStats&) = delete;
+
+    // Time buffers take from the sink to the src pad of the named element,
+    // matched by pts. Only for elements that keep timestamps one to one.
+    void addElement(const std::string& label, const char* name);
+    // Frames going through a static pad of the named element
+    void addPoint(const std::string& label, const char* name, const char* pad);
+    // Fill level of the named queue when the stats are read
+    void addQueue(const char* name);
+
+    // {"elements":{...},"points":{...},"queues":{...},"qos":{...}}
+    std::string toJson();
+
+    // Frames through a point so far, and the ages of the ones that came
+    // after since (a clock time), at most the last MAX_AGES. false if there
+    // is no such point.
+    bool getPoint(const std::string& label, guint64& frames, std::vector<GstClockTime>& ages,
+                  GstClockTime since = 0);
+
+    static constexpr size_t MAX_AGES = 1024;
+
+    // Value below which fraction (0 to 1) of values lie, 0 if empty
+    static GstClockTime percentile(std::vector<GstClockTime> values, double fraction);
+
+    static std::string quote(const std::string& value);
+
+private:
+    explicit GstPipelineStats(GstElement* pipeline);
+
+    struct Timing {
+        std::string label;
+        // pts and arrival time of the buffers inside the element
+        std::deque<std::pair<GstClockTime, GstClockTime>> inside;
+        guint64 frames = 0;
+        GstClockTime total = 0;
+        GstClockTime max = 0;
+    };
+
+    struct Point {
+        std::string label;
+        guint64 frames = 0;
+        GstClockTime first = GST_CLOCK_TIME_NONE;
+        GstClockTime last = GST_CLOCK_TIME_NONE;
+        // arrival times of the last second, for the current frame rate
+        std::deque<GstClockTime> recent;
+        GstClockTime age_total = 0;
+        GstClockTime age_max = 0;
+        guint64 aged = 0;
+        // arrival time and age of the last frames, for percentiles
+        std::deque<std::pair<GstClockTime, GstClockTime>> ages;
+    };
+
+    struct Qos {
+        std::string element;
+        guint64 processed = 0;
+        guint64 dropped = 0;
+        guint64 late = 0;
+        // frame duration of the last report, jitter above it is late
+        GstClockTime late_threshold = 0;
+    };
+
+    GstClockTime now() const;
+    void addProbe(GstPad* pad, GstPadProbeCallback callback, size_t index);
+    static void onQos(GstBus* bus, GstMessage* msg, gpointer user_data);
+
+    GstElement* pipeline; // not owned, the stats live as long as its pads
+    GstClock* clock;
+    std::vector<std::unique_ptr<Timing>> timings;
+    std::vector<std::unique_ptr<Point>> points;
+    std::vector<std::string> queues;
+    std::vector<Qos> qos;
+    std::mutex mutex;
+};
+
+#endif // GSTSTATS_H
@@ -1,21 +1,61 @@
 #include "gstrecording.h"
+#include "gstbuslog.h"
+#include "gstfinalizer.h"
 #include <iostream>
-#include <opencv2/opencv.hpp>
+#include <algorithm>
 #include <glib.h>
 
+// mp4mux settings of the crash-safe modes, empty with the default options
+static GstStructure* muxerProperties(const RecordingOptions& options) {
+    GstStructure* properties = gst_structure_new_empty("properties");
+    if (options.fragment_duration_ms) {
+        gst_structure_set(properties,
+            "fragment-duration", G_TYPE_UINT, options.fragment_duration_ms,
+            NULL);
+    }
+    if (options.reserved_max_duration) {
+        gst_structure_set(properties,
+            "reserved-max-duration", G_TYPE_UINT64, (guint64) options.reserved_max_duration,
+            "reserved-moov-update-period", G_TYPE_UINT64, (guint64) GST_SECOND,
+            NULL);
+    }
+    if (!options.moov_recovery_file.empty()) {
+        gst_structure_set(properties,
+            "moov-recovery-file", G_TYPE_STRING, options.moov_recovery_file.c_str(),
+            NULL);
+    }
+    return properties;
+}
+
 GstRecording::GstRecording() {
     gst_init(nullptr, nullptr);
 }
 
 GstRecording::~GstRecording() {
-    std::lock_guard<std::mutex> lock(mutex);
-    for (auto& [path, session] : recordings) {
-        if (session.pipeline) {
-            gst_element_set_state(session.pipeline, GST_STATE_NULL);
-            gst_object_unref(session.pipeline);
-        }
+    stopAll();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pool_stopped = true;
+    }
+    pool_wake.notify_all();
+    if (pool_thread.joinable()) {
+        pool_thread.join();
     }
-    recordings.clear();
+}
+
+void GstRecording::stopAll() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finalized.wait(lock, [this] { return starting.empty() && updating.empty(); });
+    // Close every file properly, all at once
+    while (!recordings.empty()) {
+        finalizeSession(recordings.begin());
+    }
+    finalized.wait(lock, [this] { return finalizing.empty() && !notifying; });
+}
+
+void GstRecording::setStoppedCallback(StoppedCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_stopped = std::move(callback);
 }
 
 bool GstRecording::startRecording(const std::string& outputPath,
@@ -23,197 +63,169 @@ bool GstRecording::startRecording(const std::string& outputPath,
                                 int output_width,
                                 int output_height,
                                 const std::string& flip_mode,
-                                std::string camIndex, std::string g_audioDevIndex) {
+                                std::string camIndex, std::string g_audioDevIndex,
+                                const RecordingOptions& options) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (recordings.count(outputPath) || starting.count(outputPath)) {
+            std::cerr << "Recording already in progress for: " << outputPath << std::endl;
+            return false;
+        }
+        if (finalizing.count(outputPath)) {
+            std::cerr << "Previous recording still being finalized: " << outputPath << std::endl;
+            return false;
+        }
+        starting.insert(outputPath);
+    }
+
+    // Built and started without the lock, other sessions can be
+    // controlled meanwhile
+    RecordingSession session;
+    bool ok = createPipeline(session, outputPath, points, output_width, output_height, flip_mode,
+                             camIndex, g_audioDevIndex, options);
+
     std::lock_guard<std::mutex> lock(mutex);
-    if (recordings.count(outputPath)) {
-        std::cerr << "Recording already in progress for: " << outputPath << std::endl;
+    starting.erase(outputPath);
+    finalized.notify_all();
+    if (!ok) {
         return false;
     }
-    return createPipeline(outputPath, points, output_width, output_height, flip_mode, camIndex, g_audioDevIndex);
+    recordings.emplace(outputPath, std::move(session));
+    std::cout << "Started recording to: " << outputPath << std::endl;
+
+    // Replace the pipeline that was just used, off the latency path
+    fillPool();
+    return true;
 }
 
-bool GstRecording::stopRecording(const std::string& outputPath) {
-    std::lock_guard<std::mutex> lock(mutex);
+bool GstRecording::updatePoints(const std::string& outputPath,
+                                const std::vector<std::pair<double, double>>& points) {
+    std::unique_lock<std::mutex> lock(mutex);
+    finalized.wait(lock, [&] { return !updating.count(outputPath); });
     auto it = recordings.find(outputPath);
     if (it == recordings.end()) {
         std::cerr << "No active recording found for: " << outputPath << std::endl;
         return false;
     }
-    RecordingSession& session = it->second;
-    
-    if (!session.pipeline || !GST_IS_ELEMENT(session.pipeline)) {
-        std::cerr << "Invalid pipeline for: " << outputPath << std::endl;
-        recordings.erase(it);
+    GstElement* pipeline = it->second.pipeline;
+    GstElement* video_src = it->second.video_src;
+    std::shared_ptr<GstSharedEncoder> encoder = it->second.encoder;
+    updating.insert(outputPath);
+    lock.unlock();
+
+    // Moving to another encoder may build and start one, without the lock.
+    // The other sessions sharing the encoder keep their points.
+    std::shared_ptr<GstSharedEncoder> moved = encoder->updatePoints(pipeline, video_src, points);
+
+    lock.lock();
+    updating.erase(outputPath);
+    finalized.notify_all();
+    if (!moved) {
+        std::cerr << "Failed to move the recording to its new points" << std::endl;
         return false;
     }
-    // Send EOS
-    if (!gst_element_send_event(session.pipeline, gst_event_new_eos())) {
-        std::cerr << "Failed to send EOS event" << std::endl;
-    }
-    // Wait for EOS
-    GstBus* bus = gst_element_get_bus(session.pipeline);
-    if (bus) {
-        GstMessage* msg = gst_bus_timed_pop_filtered(bus, 
-            GST_CLOCK_TIME_NONE,
-            static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
-        
-        if (msg) {
-            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
-                GError* err = nullptr;
-                gchar* debug = nullptr;
-                gst_message_parse_error(msg, &err, &debug);
-                std::cerr << "Error while stopping: " << err->message << std::endl;
-                if (debug) std::cerr << "Debug: " << debug << std::endl;
-                g_error_free(err);
-                g_free(debug);
-            }
-            gst_message_unref(msg);
-        }
-        gst_object_unref(bus);
+    it = recordings.find(outputPath);
+    if (it == recordings.end()) {
+        // Stops wait for the update, this is only in case
+        moved->detach(video_src);
+        return false;
     }
-    // Stop pipeline
-    gst_element_set_state(session.pipeline, GST_STATE_NULL);
-    g_usleep(500000); // 500ms delay to ensure proper shutdown
-    
-    // Remove from map
-    recordings.erase(it);
-    std::cout << "Successfully stopped recording: " << outputPath << std::endl;
+    it->second.encoder = moved;
     return true;
 }
 
-bool GstRecording::takeScreenshot(const std::string& outputPathSs) {
-    std::lock_guard<std::mutex> lock(mutex);
-    
-    if (recordings.empty()) {
-        std::cerr << "No active recording found for screenshot" << std::endl;
+bool GstRecording::stopRecording(const std::string& outputPath) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // Its encoder may be about to change, see updatePoints
+    finalized.wait(lock, [&] { return !updating.count(outputPath); });
+    auto it = recordings.find(outputPath);
+    if (it == recordings.end()) {
+        std::cerr << "No active recording found for: " << outputPath << std::endl;
         return false;
     }
-
-    // Get the first recording session
-    auto& session = recordings.begin()->second;
+    RecordingSession& session = it->second;
     
     if (!session.pipeline || !GST_IS_ELEMENT(session.pipeline)) {
-        std::cerr << "Invalid pipeline for screenshot" << std::endl;
-        return false;
-    }
-
-    // Create elements in NULL state
-    GstElement* queue_screenshot = gst_element_factory_make("queue", "queue_screenshot");
-    GstElement* jpegenc = gst_element_factory_make("jpegenc", "jpegenc");
-    GstElement* filesink = gst_element_factory_make("filesink", "screenshot_filesink");
-    
-    if (!queue_screenshot || !jpegenc || !filesink) {
-        std::cerr << "Failed to create screenshot elements" << std::endl;
-        if (queue_screenshot) gst_object_unref(queue_screenshot);
-        if (jpegenc) gst_object_unref(jpegenc);
-        if (filesink) gst_object_unref(filesink);
+        std::cerr << "Invalid pipeline for: " << outputPath << std::endl;
+        recordings.erase(it);
         return false;
     }
+    finalizeSession(it);
+    std::cout << "Stopping recording: " << outputPath << std::endl;
+    return true;
+}
 
-    // Configure filesink
-    g_object_set(filesink, 
-        "location", outputPathSs.c_str(),
-        "sync", FALSE,  // No need to sync for single frame
-        NULL);
-
-    // Configure jpegenc
-    g_object_set(jpegenc,
-        "quality", 85,
-        NULL);
-
-    // Add elements to pipeline before linking
-    gst_bin_add_many(GST_BIN(session.pipeline), 
-        queue_screenshot, jpegenc, filesink, 
-        NULL);
+void GstRecording::finalizeSession(std::map<std::string, RecordingSession>::iterator it) {
+    std::string outputPath = it->first;
+    RecordingSession& session = it->second;
 
-    // Link elements
-    if (!gst_element_link_many(queue_screenshot, jpegenc, filesink, NULL)) {
-        std::cerr << "Failed to link screenshot elements" << std::endl;
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
+    // Nothing is pushed once EOS is on its way, and the shared encoder and
+    // capture don't have to wait for this file to be closed
+    if (session.encoder) {
+        session.encoder->detach(session.video_src);
+        session.encoder.reset();
     }
-
-    // Get the tee element
-    GstElement* tee = gst_bin_get_by_name(GST_BIN(session.pipeline), "screenshot_tee");
-    if (!tee) {
-        std::cerr << "Failed to find tee element in pipeline" << std::endl;
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
+    if (session.capture) {
+        session.capture->detach(nullptr, session.audio_src);
+        session.capture.reset();
     }
 
-    // Request a new src pad from the tee
-    GstPad* tee_src_pad = gst_element_get_request_pad(tee, "src_%u");
-    GstPad* queue_sink_pad = gst_element_get_static_pad(queue_screenshot, "sink");
-    
-    if (!tee_src_pad || !queue_sink_pad) {
-        std::cerr << "Failed to get pads for screenshot branch" << std::endl;
-        if (tee_src_pad) gst_object_unref(tee_src_pad);
-        if (queue_sink_pad) gst_object_unref(queue_sink_pad);
-        gst_object_unref(tee);
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
-    }
+    GstElement* pipeline = session.pipeline;
+    finalizing.emplace(outputPath, std::move(session));
+    recordings.erase(it);
 
-    // Link tee to queue
-    if (gst_pad_link(tee_src_pad, queue_sink_pad) != GST_PAD_LINK_OK) {
-        std::cerr << "Failed to link tee to screenshot branch" << std::endl;
-        gst_object_unref(tee_src_pad);
-        gst_object_unref(queue_sink_pad);
-        gst_object_unref(tee);
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
-    }
+    GstFinalizer::finalize(pipeline, [this, outputPath](bool eos) {
+        StoppedCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finalizing.erase(outputPath);
+            callback = on_stopped;
+            notifying++;
+        }
+        if (eos) {
+            std::cout << "Successfully stopped recording: " << outputPath << std::endl;
+        } else {
+            std::cerr << "Recording stopped without EOS, file may be incomplete: " << outputPath << std::endl;
+        }
+        if (callback) {
+            callback(outputPath, eos);
+        }
 
-    // Set up a probe to remove the screenshot branch after capturing one frame
-    GstPad* jpegenc_sink_pad = gst_element_get_static_pad(jpegenc, "sink");
-    if (jpegenc_sink_pad) {
-        gulong probe_id = gst_pad_add_probe(jpegenc_sink_pad, 
-            GST_PAD_PROBE_TYPE_BUFFER,
-            [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
-                GstElement* pipeline = static_cast<GstElement*>(user_data);
-                
-                // Post a message to the bus to remove elements in main thread context
-                gst_element_post_message(pipeline,
-                    gst_message_new_application(GST_OBJECT(pipeline),
-                        gst_structure_new("remove-screenshot-elements",
-                            "queue", G_TYPE_STRING, "queue_screenshot",
-                            "jpegenc", G_TYPE_STRING, "jpegenc",
-                            "filesink", G_TYPE_STRING, "screenshot_filesink",
-                            NULL)));
-                
-                return GST_PAD_PROBE_REMOVE;
-            }, session.pipeline, NULL);
-        
-        gst_object_unref(jpegenc_sink_pad);
-    }
-
-    // Sync states - this must be done after linking
-    gst_element_sync_state_with_parent(queue_screenshot);
-    gst_element_sync_state_with_parent(jpegenc);
-    gst_element_sync_state_with_parent(filesink);
-
-    // Clean up references
-    gst_object_unref(tee_src_pad);
-    gst_object_unref(queue_sink_pad);
-    gst_object_unref(tee);
+        // stopAll() returns once the callbacks are done too
+        std::lock_guard<std::mutex> lock(mutex);
+        notifying--;
+        finalized.notify_all();
+    });
+}
 
-    return true;
+std::shared_ptr<GstSharedEncoder> GstRecording::getSessionEncoder(const std::string& outputPath,
+                                                                  GstClockTime& base_time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = outputPath.empty() ? recordings.begin() : recordings.find(outputPath);
+    if (it == recordings.end() || !it->second.encoder) {
+        return nullptr;
+    }
+    base_time = gst_element_get_base_time(it->second.pipeline);
+    return it->second.encoder;
+}
+
+std::shared_ptr<GstPipelineStats> GstRecording::getPipelineStats(const std::string& outputPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = recordings.find(outputPath);
+    return it == recordings.end() ? nullptr : it->second.stats;
 }
 
-bool GstRecording::createPipeline(const std::string& outputPath,
+bool GstRecording::createPipeline(RecordingSession& session,
+                                const std::string& outputPath,
                                 const std::vector<std::pair<double, double>>& points,
                                 int output_width,
                                 int output_height,
                                 const std::string& flip_mode,
-                                std::string camIndex, std::string g_audioDevIndex) {
+                                std::string camIndex, std::string g_audioDevIndex,
+                                const RecordingOptions& options) {
+    // Start-to-first-frame latency is counted from here
+    gint64 requested_us = g_get_monotonic_time();
+
     if (points.size() != 4) {
         std::cerr << "Need exactly 4 points for perspective transform" << std::endl;
         return false;
@@ -225,158 +237,189 @@ bool GstRecording::createPipeline(const std::string& outputPath,
         std::cout << "Using default resolution: 1280x720" << std::endl;
     }
 
-    const std::unordered_map<std::string, int> flip_methods = {
-        {"none", 0}, {"horizontal", 1}, {"vertical", 2}, 
-        {"clockwise", 3}, {"counterclockwise", 4}};
+    // Pooled pipelines are built for the default options
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pool.empty() && camIndex == pool_cam && g_audioDevIndex == pool_audio &&
+            !options.segmented()) {
+            session = std::move(pool.back());
+            pool.pop_back();
+            std::cout << "Using a pre-built pipeline, " << pool.size() << " left" << std::endl;
+        }
+    }
+    if (!session.pipeline && !buildSession(session, camIndex, g_audioDevIndex, options)) {
+        return false;
+    }
+
+    // Deskewed and encoded once for all the sessions with the same settings
+    EncoderSettings settings;
+    settings.points = points;
+    settings.flip_mode = flip_mode;
+    settings.width = output_width;
+    settings.height = output_height;
+    if (!options.speed_preset.empty()) {
+        settings.speed_preset = options.speed_preset;
+    }
+    session.encoder = GstSharedEncoder::get(session.capture, settings);
+    if (!session.encoder) {
+        std::cerr << "Failed to start video encoder" << std::endl;
+        return false;
+    }
+
+    std::string location = outputPath;
+    if (options.segmented()) {
+        location = options.segment_template;
+        if (location.empty()) {
+            size_t dot = outputPath.find_last_of('.');
+            size_t slash = outputPath.find_last_of('/');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+                dot = outputPath.size();
+            }
+            location = outputPath.substr(0, dot) + "_%05d" + outputPath.substr(dot);
+        }
+    }
+    g_object_set(session.filesink, "location", location.c_str(), NULL);
+    gst_element_set_locked_state(session.filesink, FALSE);
+
+    // The muxer only reads these when it starts, pooled pipelines can take
+    // them too. Segmented recordings got them when built.
+    if (!options.segmented()) {
+        GstElement* muxer = gst_bin_get_by_name(GST_BIN(session.pipeline), "muxer");
+        GstStructure* properties = muxerProperties(options);
+        gst_structure_foreach(properties,
+            [](GQuark field, const GValue* value, gpointer muxer) -> gboolean {
+                g_object_set_property(G_OBJECT(muxer), g_quark_to_string(field), value);
+                return TRUE;
+            }, muxer);
+        gst_structure_free(properties);
+        gst_object_unref(muxer);
+    }
+
+    // Pooled pipelines may have waited a while, running time starts now
+    GstCapture::useClock(session.pipeline);
+
+    session.latency = std::make_shared<StartLatency>();
+    session.latency->requested_us = requested_us;
+    watchFirstFrame(session, outputPath);
 
-    if (!flip_methods.count(flip_mode)) {
-        std::cerr << "Invalid flip mode: " << flip_mode << std::endl;
+    // Generate pipeline diagram for debugging
+    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(session.pipeline), 
+        GST_DEBUG_GRAPH_SHOW_ALL, "recording_pipeline");
+
+    // Recordings start with whatever video the encoder kept from before
+    // the command, see --preroll
+    session.encoder->attach(session.pipeline, session.video_src, true);
+    session.capture->attach(session.pipeline, nullptr, session.audio_src);
+
+    // Start pipeline
+    GstStateChangeReturn ret = gst_element_set_state(session.pipeline, GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Failed to start pipeline" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool GstRecording::buildSession(RecordingSession& session,
+                                const std::string& camIndex, const std::string& audioIndex,
+                                const RecordingOptions& options) {
+    session.capture = GstCapture::get(camIndex, audioIndex);
+    if (!session.capture) {
+        std::cerr << "Failed to open capture devices" << std::endl;
         return false;
     }
 
-    RecordingSession session;
     session.pipeline = gst_pipeline_new("recording-pipeline");
     if (!session.pipeline) {
         std::cerr << "Failed to create pipeline" << std::endl;
         return false;
     }
+    GstCapture::useClock(session.pipeline);
 
-    // Create elements
-    GstElement* src = gst_element_factory_make("avfvideosrc", "source");
-    GstElement* capsfilter = gst_element_factory_make("capsfilter", "capsfilter");
-    GstElement* convert1 = gst_element_factory_make("videoconvert", "convert1");
-    GstElement* perspective = gst_element_factory_make("perspective", "perspective");
-    GstElement* flip = gst_element_factory_make("videoflip", "flipper");
-    GstElement* convert2 = gst_element_factory_make("videoconvert", "convert2");
-    GstElement* videoscale = gst_element_factory_make("videoscale", "scaler");
-    GstElement* capsink = gst_element_factory_make("capsfilter", "capsink");
-    session.tee = gst_element_factory_make("tee", "screenshot_tee"); // Add tee here
+    // Create elements, the encoded video comes from the shared encoder and
+    // the microphone from the shared capture
+    session.video_src = GstSharedEncoder::createVideoSource("source");
+    GstElement* h264parse = gst_element_factory_make("h264parse", "h264parse");
     GstElement* queue = gst_element_factory_make("queue", "queue");
-    GstElement* encoder = gst_element_factory_make("x264enc", "encoder");
-    GstElement* muxer = gst_element_factory_make("mp4mux", "muxer");
-    session.filesink = gst_element_factory_make("filesink", "filesink");
+    GstElement* muxer = nullptr;
+    if (options.segmented()) {
+        // Muxes and writes on its own, one mp4mux per segment
+        session.filesink = gst_element_factory_make("splitmuxsink", "filesink");
+    } else {
+        muxer = gst_element_factory_make("mp4mux", "muxer");
+        session.filesink = gst_element_factory_make("filesink", "filesink");
+    }
 
     // Audio elements
-    GstElement* audio_src = gst_element_factory_make("osxaudiosrc", "audio_src");
+    session.audio_src = GstCapture::createAudioSource("audio_src");
     GstElement* audio_convert = gst_element_factory_make("audioconvert", "audio_convert");
     GstElement* audio_resample = gst_element_factory_make("audioresample", "audio_resample");
     GstElement* audio_encoder = gst_element_factory_make("avenc_aac", "audio_encoder");
     GstElement* audio_queue = gst_element_factory_make("queue", "audio_queue");
 
-    if (!src || !capsfilter || !convert1 || !videoscale || !perspective || !flip || 
-        !convert2 || !capsink || !session.tee || !queue || !encoder || !muxer || !session.filesink ||
-        !audio_src || !audio_convert || !audio_resample || !audio_encoder || !audio_queue) {
+    if (!session.video_src || !h264parse || !queue || (!muxer && !options.segmented()) || !session.filesink ||
+        !session.audio_src || !audio_convert || !audio_resample || !audio_encoder || !audio_queue) {
         std::cerr << "Failed to create one or more GStreamer elements" << std::endl;
         return false;
     }
 
-    // Configure source
-    g_object_set(src, 
-        "do-timestamp", TRUE, 
-        "device-unique-id", camIndex.c_str(),
-        "capture-screen", FALSE,
-        NULL);
-
-    // Configure caps
-    GstCaps* caps = gst_caps_new_simple("video/x-raw",
-        "format", G_TYPE_STRING, "NV12",
-        "width", G_TYPE_INT, 1280,
-        "height", G_TYPE_INT, 720,
-        "framerate", GST_TYPE_FRACTION_RANGE, 15, 1, 60, 1,
-        NULL);
-    g_object_set(capsfilter, "caps", caps, NULL);
-    gst_caps_unref(caps);
-
-    // Configure perspective transform
-    std::vector<cv::Point2f> dst_points = {
-        cv::Point2f(static_cast<float>(points[0].first), static_cast<float>(points[0].second)),
-        cv::Point2f(static_cast<float>(points[1].first), static_cast<float>(points[1].second)),
-        cv::Point2f(static_cast<float>(points[2].first), static_cast<float>(points[2].second)),
-        cv::Point2f(static_cast<float>(points[3].first), static_cast<float>(points[3].second))
-    };
-
-    std::vector<cv::Point2f> src_points = {
-        cv::Point2f(0.0f, 0.0f),
-        cv::Point2f(static_cast<float>(1280 - 1), 0.0f),
-        cv::Point2f(static_cast<float>(1280 - 1), static_cast<float>(720 - 1)),
-        cv::Point2f(0.0f, static_cast<float>(720 - 1))
-    };
-
-    cv::Mat transform = cv::getPerspectiveTransform(src_points, dst_points);
-    
-    GValueArray* matrix_array = g_value_array_new(9);
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            GValue val = G_VALUE_INIT;
-            g_value_init(&val, G_TYPE_DOUBLE);
-            g_value_set_double(&val, transform.at<double>(i, j));
-            g_value_array_append(matrix_array, &val);
-            g_value_unset(&val);
-        }
-    }
-    g_object_set(G_OBJECT(perspective), "matrix", matrix_array, NULL);
-    g_value_array_free(matrix_array);
-
-    g_object_set(flip, "method", flip_methods.at(flip_mode), NULL);
-
-    GstCaps* out_caps = gst_caps_new_simple("video/x-raw",
-        "format", G_TYPE_STRING, "I420",
-        "width", G_TYPE_INT, output_width,
-        "height", G_TYPE_INT, output_height,
-        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
-        "framerate", GST_TYPE_FRACTION_RANGE, 15, 1, 60, 1,
-        NULL);
-    g_object_set(capsink, "caps", out_caps, NULL);
-    gst_caps_unref(out_caps);
-
-    // Configure encoder
-    g_object_set(encoder,
-        "bitrate", 2000,
-        "tune", 0x00000004,  // zerolatency
-        "key-int-max", 30,
-        "speed-preset", 1,
-        NULL);
-
-    g_object_set(audio_src, "unique-id", g_audioDevIndex.c_str(), NULL);
-
     // Configure audio encoder
     g_object_set(audio_encoder,
         "bitrate", 128000,
         NULL);
 
-    // Configure filesink
-    g_object_set(session.filesink,
-        "location", outputPath.c_str(),
-        "sync", TRUE,  // Important for A/V sync
-        NULL);
+    // Configure filesink, the location is only known once the pipeline is
+    // claimed. Until then it stays in NULL so the file isn't opened.
+    if (options.segmented()) {
+        g_object_set(session.filesink,
+            "muxer-factory", "mp4mux",
+            "max-size-time", (guint64) options.segment_duration,
+            "max-size-bytes", options.segment_max_bytes,
+            "max-files", options.segment_keep,
+            // Finished segments are closed by their own muxer and sink, the
+            // next one starts right away
+            "async-finalize", TRUE,
+            NULL);
+        GstStructure* properties = muxerProperties(options);
+        g_object_set(session.filesink, "muxer-properties", properties, NULL);
+        gst_structure_free(properties);
+    } else {
+        g_object_set(session.filesink,
+            "sync", TRUE,  // Important for A/V sync
+            NULL);
+    }
+    gst_element_set_locked_state(session.filesink, TRUE);
 
-    // Build the pipeline with tee
+    // Build the pipeline
     gst_bin_add_many(GST_BIN(session.pipeline),
-        src, capsfilter, convert1, perspective,
-        flip, convert2, videoscale, capsink, session.tee, queue, encoder,
-        audio_src, audio_convert, audio_resample, audio_encoder, audio_queue,
-        muxer, session.filesink,
+        session.video_src, h264parse, queue,
+        session.audio_src, audio_convert, audio_resample, audio_encoder, audio_queue,
+        session.filesink,
         NULL);
+    if (muxer) {
+        gst_bin_add(GST_BIN(session.pipeline), muxer);
+    }
 
-    // Link video elements with tee
+    // Link video elements, h264parse turns the byte-stream into what
+    // mp4mux takes
     if (!gst_element_link_many(
-        src, capsfilter, convert1, perspective,
-        flip, convert2, videoscale, capsink, session.tee, queue, encoder, NULL)) {
+        session.video_src, h264parse, queue, NULL)) {
         std::cerr << "Failed to link video elements" << std::endl;
         return false;
     }
 
     // Link audio elements
     if (!gst_element_link_many(
-        audio_src, audio_convert, audio_resample, audio_encoder, audio_queue, NULL)) {
+        session.audio_src, audio_convert, audio_resample, audio_encoder, audio_queue, NULL)) {
         std::cerr << "Failed to link audio elements" << std::endl;
         return false;
     }
 
-    // Link to muxer
-    GstPad* video_sink_pad = gst_element_get_request_pad(muxer, "video_%u");
-    GstPad* audio_sink_pad = gst_element_get_request_pad(muxer, "audio_%u");
-    GstPad* video_src_pad = gst_element_get_static_pad(encoder, "src");
+    // Link to muxer, or straight to splitmuxsink
+    GstElement* mux = muxer ? muxer : session.filesink;
+    GstPad* video_sink_pad = gst_element_get_request_pad(mux, muxer ? "video_%u" : "video");
+    GstPad* audio_sink_pad = gst_element_get_request_pad(mux, "audio_%u");
+    GstPad* video_src_pad = gst_element_get_static_pad(queue, "src");
     GstPad* audio_src_pad = gst_element_get_static_pad(audio_queue, "src");
 
     if (gst_pad_link(video_src_pad, video_sink_pad) != GST_PAD_LINK_OK ||
@@ -395,58 +438,149 @@ bool GstRecording::createPipeline(const std::string& outputPath,
     gst_object_unref(audio_src_pad);
 
     // Link muxer to filesink
-    if (!gst_element_link(muxer, session.filesink)) {
+    if (muxer && !gst_element_link(muxer, session.filesink)) {
         std::cerr << "Failed to link muxer to filesink" << std::endl;
         return false;
     }
 
-    // Set up bus monitoring
-    GstBus* bus = gst_element_get_bus(session.pipeline);
-    gst_bus_add_watch(bus, [](GstBus* bus, GstMessage* msg, gpointer user_data) -> gboolean {
-        switch (GST_MESSAGE_TYPE(msg)) {
-            case GST_MESSAGE_ERROR: {
-                GError* err = nullptr;
-                gchar* debug = nullptr;
-                gst_message_parse_error(msg, &err, &debug);
-                std::cerr << "Error: " << err->message << std::endl;
-                if (debug) std::cerr << "Debug info: " << debug << std::endl;
-                g_error_free(err);
-                g_free(debug);
-                break;
-            }
-            case GST_MESSAGE_EOS:
-                std::cout << "End of stream" << std::endl;
-                break;
-            case GST_MESSAGE_STATE_CHANGED: {
-                if (GST_MESSAGE_SRC(msg) == GST_OBJECT(user_data)) {
-                    GstState old_state, new_state, pending;
-                    gst_message_parse_state_changed(msg, &old_state, &new_state, &pending);
-                    std::cout << "Pipeline state changed from " 
-                              << gst_element_state_get_name(old_state) 
-                              << " to " << gst_element_state_get_name(new_state) 
-                              << std::endl;
-                }
-                break;
-            }
-            default:
-                break;
+    // "mux" is where the video reaches the muxer, its age is the whole way
+    // from the camera to the file
+    session.stats = GstPipelineStats::create(session.pipeline);
+    session.stats->addElement("parse", "h264parse");
+    session.stats->addPoint("mux", "queue", "src");
+    session.stats->addQueue("queue");
+    session.stats->addQueue("audio_queue");
+
+    // EOS and errors stay queued for the finalizer
+    GstBusLog::watch(session.pipeline, "Recording",
+        static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+
+    // Elements are allocated and encoders opened now rather than on start
+    if (gst_element_set_state(session.pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Failed to prepare pipeline" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void GstRecording::watchFirstFrame(RecordingSession& session, const std::string& outputPath) {
+    // Last element before the muxer, whichever that is
+    GstElement* queue = gst_bin_get_by_name(GST_BIN(session.pipeline), "queue");
+    if (!queue) {
+        return;
+    }
+    GstPad* pad = gst_element_get_static_pad(queue, "src");
+    gst_object_unref(queue);
+    if (!pad) {
+        return;
+    }
+
+    struct Watch {
+        std::shared_ptr<StartLatency> latency;
+        std::string outputPath;
+    };
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+        [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+            Watch* watch = static_cast<Watch*>(user_data);
+            gint64 latency_us = g_get_monotonic_time() - watch->latency->requested_us;
+            watch->latency->first_frame_us = latency_us;
+            std::cout << "First frame of " << watch->outputPath << " after "
+                      << latency_us / 1000 << " ms" << std::endl;
+            return GST_PAD_PROBE_REMOVE;
+        },
+        new Watch{session.latency, outputPath},
+        [](gpointer user_data) { delete static_cast<Watch*>(user_data); });
+    gst_object_unref(pad);
+}
+
+void GstRecording::setPoolSize(int size, const std::string& camIndex, const std::string& audioIndex) {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<RecordingSession> unused;
+    if (camIndex != pool_cam || audioIndex != pool_audio) {
+        unused = std::move(pool);
+        pool.clear();
+    }
+    pool_size = std::max(size, 0);
+    pool_cam = camIndex;
+    pool_audio = audioIndex;
+    while ((int) pool.size() > pool_size) {
+        unused.push_back(std::move(pool.back()));
+        pool.pop_back();
+    }
+    fillPool();
+
+    // The first pipelines are ready when this returns, like at startup
+    pool_wake.wait(lock, [this] { return (int) pool.size() >= pool_size || pool_failed; });
+    lock.unlock();
+}
+
+void GstRecording::fillPool() {
+    pool_failed = false;
+    if ((int) pool.size() >= pool_size) {
+        return;
+    }
+    if (!pool_thread.joinable()) {
+        pool_thread = std::thread([this] { poolLoop(); });
+    }
+    pool_wake.notify_all();
+}
+
+void GstRecording::poolLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        pool_wake.wait(lock, [this] {
+            return pool_stopped || ((int) pool.size() < pool_size && !pool_failed);
+        });
+        if (pool_stopped) {
+            return;
         }
-        return TRUE;
-    }, session.pipeline);
-    gst_object_unref(bus);
 
-    // Generate pipeline diagram for debugging
-    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(session.pipeline), 
-        GST_DEBUG_GRAPH_SHOW_ALL, "recording_pipeline");
+        // Built without the lock, starts take from the pool meanwhile
+        std::string cam = pool_cam;
+        std::string audio = pool_audio;
+        lock.unlock();
+        RecordingSession session;
+        bool ok = buildSession(session, cam, audio, RecordingOptions());
+        lock.lock();
+
+        if (!ok) {
+            // Tried again on the next start
+            std::cerr << "Failed to pre-build recording pipeline" << std::endl;
+            pool_failed = true;
+        } else if (cam == pool_cam && audio == pool_audio && (int) pool.size() < pool_size) {
+            pool.push_back(std::move(session));
+        }
+        pool_wake.notify_all();
+        if (session.pipeline) {
+            // Not wanted anymore, torn down without the lock
+            lock.unlock();
+            session = RecordingSession();
+            lock.lock();
+        }
+    }
+}
 
-    // Start pipeline
-    GstStateChangeReturn ret = gst_element_set_state(session.pipeline, GST_STATE_PLAYING);
-    if (ret == GST_STATE_CHANGE_FAILURE) {
-        std::cerr << "Failed to start pipeline" << std::endl;
-        return false;
+std::string GstRecording::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string out = "[";
+    for (auto& [outputPath, session] : recordings) {
+        long latency = session.latency && session.latency->first_frame_us >= 0 ?
+            (long) (session.latency->first_frame_us / 1000) : -1;
+        out += (out.size() > 1 ? "," : "") + std::string("{\"outputPath\":") + GstPipelineStats::quote(outputPath) +
+               ",\"startLatencyMs\":" + std::to_string(latency) +
+               ",\"dropped\":{\"video\":" + std::to_string(session.encoder->dropped(session.video_src)) +
+               ",\"audio\":" + std::to_string(session.capture->dropped(session.audio_src)) + "}" +
+               ",\"encoder\":" + session.encoder->statsJson() +
+               ",\"pipeline\":" + (session.stats ? session.stats->toJson() : "{}") + "}";
     }
+    return out + "]";
+}
 
-    recordings.emplace(outputPath, std::move(session));
-    std::cout << "Started recording to: " << outputPath << std::endl;
-    return true;
-}
\ No newline at end of file
+long GstRecording::getStartLatency(const std::string& outputPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = recordings.find(outputPath);
+    if (it == recordings.end() || !it->second.latency || it->second.latency->first_frame_us < 0) {
+        return -1;
+    }
+    return it->second.latency->first_frame_us / 1000;
+}
@@ -4,12 +4,54 @@
 #include <gst/gst.h>
 #include <string>
 #include <map>
+#include <set>
 #include <mutex>
 #include <vector>
 #include <utility> // for std::pair
 #include <glib-object.h>
 #include <filesystem>
 #include <sys/wait.h>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include "gstcapture.h"
+#include "gstsharedencoder.h"
+
+// Time from the start command to the first video frame reaching the muxer
+struct StartLatency {
+    gint64 requested_us = 0;
+    std::atomic<gint64> first_frame_us{-1};
+};
+
+// How a recording is written, the defaults give one MP4 file at outputPath
+struct RecordingOptions {
+    // Segmented mode: a new, separately playable file every
+    // segment_duration and/or segment_max_bytes, cut on a keyframe
+    GstClockTime segment_duration = 0;
+    guint64 segment_max_bytes = 0;
+    // printf-style name of the segments, with one %d for the index.
+    // Defaults to outputPath with _%05d before the extension.
+    std::string segment_template;
+    // Only the newest segment_keep segments are kept, 0 keeps them all
+    guint segment_keep = 0;
+
+    // Crash-safe output, see muxerProperties(). Fragmented: the file is
+    // written as fragments of fragment_duration_ms, anything but the last
+    // one survives a crash and stopping only closes the last one.
+    guint fragment_duration_ms = 0;
+    // Robust muxing: room for the headers of up to reserved_max_duration is
+    // reserved at the start of the file and rewritten every second
+    GstClockTime reserved_max_duration = 0;
+    // Lets qtmux repair a file left by a crash, see qtmux's documentation
+    std::string moov_recovery_file;
+
+    // x264enc speed-preset of the encoder, empty for ultrafast
+    std::string speed_preset;
+
+    bool segmented() const { return segment_duration || segment_max_bytes; }
+};
 
 class GstRecording {
 public:
@@ -21,17 +63,59 @@ public:
                       int output_width,
                       int output_height,
                       const std::string& flip_mode = "none",
-                      std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null");
+                      std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null",
+                      const RecordingOptions& options = RecordingOptions());
     
+    bool updatePoints(const std::string& outputPath,
+                      const std::vector<std::pair<double, double>>& points);
+
+    // Returns as soon as EOS is sent, the file is closed in the background
     bool stopRecording(const std::string& outputPath);
 
-    bool takeScreenshot(const std::string& outputPath);  // New method
+    // Called from a worker thread once a stopped recording is finalized, ok
+    // is false when the file may be incomplete
+    using StoppedCallback = std::function<void(const std::string& outputPath, bool ok)>;
+    void setStoppedCallback(StoppedCallback callback);
+
+    // Stops every recording and returns once all of them are finalized and
+    // their stopped callbacks ran
+    void stopAll();
+
+    // Encoder of the recording at outputPath, or of the first one when
+    // empty, for screenshots. base_time is the one of the recording, whose
+    // running time is the position in the file.
+    std::shared_ptr<GstSharedEncoder> getSessionEncoder(const std::string& outputPath,
+                                                        GstClockTime& base_time);
+
+    // Keeps size recording pipelines built and in READY for the given
+    // devices, and the devices open, so that a start only has to point one
+    // at a file. 0 builds every pipeline on start. Returns once they are
+    // built, the ones starts use up are replaced in the background.
+    void setPoolSize(int size, const std::string& camIndex, const std::string& audioIndex);
+
+    // Start-to-first-frame latency of a recording in ms, -1 until its first
+    // frame is muxed
+    long getStartLatency(const std::string& outputPath);
+
+    // JSON array with the stats of every recording, its own pipeline's and
+    // its encoder's, see GstPipelineStats
+    std::string getStats();
+
+    // Stats of the recording pipeline at outputPath, from the encoder's
+    // appsrc to the file, nullptr if there is no such recording
+    std::shared_ptr<GstPipelineStats> getPipelineStats(const std::string& outputPath);
 
 private:
 struct RecordingSession {
     GstElement* pipeline = nullptr;
-    GstElement* filesink = nullptr;
-    GstElement* tee = nullptr;  // Added for screenshot functionality
+    GstElement* filesink = nullptr;  // splitmuxsink when segmented
+    // appsrcs fed by the shared encoder (video) and capture (audio)
+    std::shared_ptr<GstCapture> capture;
+    std::shared_ptr<GstSharedEncoder> encoder;
+    GstElement* video_src = nullptr;
+    GstElement* audio_src = nullptr;
+    std::shared_ptr<StartLatency> latency;
+    std::shared_ptr<GstPipelineStats> stats;
     
     RecordingSession() = default;
 
@@ -41,47 +125,105 @@ struct RecordingSession {
     
     // Move constructor
     RecordingSession(RecordingSession&& other) noexcept 
-        : pipeline(other.pipeline), filesink(other.filesink), tee(other.tee) {
+        : pipeline(other.pipeline), filesink(other.filesink),
+          capture(std::move(other.capture)), encoder(std::move(other.encoder)),
+          video_src(other.video_src), audio_src(other.audio_src),
+          latency(std::move(other.latency)), stats(std::move(other.stats)) {
         other.pipeline = nullptr;
         other.filesink = nullptr;
-        other.tee = nullptr;
+        other.video_src = nullptr;
+        other.audio_src = nullptr;
     }
     
     // Move assignment
     RecordingSession& operator=(RecordingSession&& other) noexcept {
         if (this != &other) {
+            if (encoder) {
+                encoder->detach(video_src);
+            }
+            if (capture) {
+                capture->detach(nullptr, audio_src);
+            }
             if (pipeline) {
                 gst_element_set_state(pipeline, GST_STATE_NULL);
                 gst_object_unref(pipeline);
             }
             pipeline = other.pipeline;
             filesink = other.filesink;
-            tee = other.tee;
+            capture = std::move(other.capture);
+            encoder = std::move(other.encoder);
+            video_src = other.video_src;
+            audio_src = other.audio_src;
+            latency = std::move(other.latency);
+            stats = std::move(other.stats);
             other.pipeline = nullptr;
             other.filesink = nullptr;
-            other.tee = nullptr;
+            other.video_src = nullptr;
+            other.audio_src = nullptr;
         }
         return *this;
     }
     
     ~RecordingSession() {
+        if (encoder) {
+            encoder->detach(video_src);
+        }
+        if (capture) {
+            capture->detach(nullptr, audio_src);
+        }
         if (pipeline) {
             gst_element_set_state(pipeline, GST_STATE_NULL);
             gst_object_unref(pipeline);
         }
-        // tee is part of pipeline and will be automatically unreffed
     }
 };
     
     std::map<std::string, RecordingSession> recordings;
+    // Recordings being started, without the lock, see startRecording
+    std::set<std::string> starting;
+    // Recordings changing encoder, without the lock, see updatePoints
+    std::set<std::string> updating;
+    // Stopped recordings waiting for their EOS, see GstFinalizer
+    std::map<std::string, RecordingSession> finalizing;
+    std::condition_variable finalized;
+    // Stopped callbacks running
+    int notifying = 0;
+    StoppedCallback on_stopped;
     std::mutex mutex;
+
+    // Moves a session to finalizing and ends it, called with mutex held
+    void finalizeSession(std::map<std::string, RecordingSession>::iterator it);
+
+    // Pre-built pipelines, see setPoolSize. A worker thread builds them,
+    // fillPool wakes it.
+    std::vector<RecordingSession> pool;
+    int pool_size = 0;
+    std::string pool_cam;
+    std::string pool_audio;
+    std::thread pool_thread;
+    std::condition_variable pool_wake;
+    bool pool_failed = false;  // until the next fillPool
+    bool pool_stopped = false;
+
+    // Builds a recording pipeline without output file and brings it to READY
+    bool buildSession(RecordingSession& session,
+                      const std::string& camIndex, const std::string& audioIndex,
+                      const RecordingOptions& options);
+    // Called with mutex held, returns right away
+    void fillPool();
+    void poolLoop();
+    void watchFirstFrame(RecordingSession& session, const std::string& outputPath);
     
-    bool createPipeline(const std::string& outputPath,
+    // Builds or claims the pipeline of a new recording and starts it,
+    // called without mutex
+    bool createPipeline(RecordingSession& session,
+                      const std::string& outputPath,
                       const std::vector<std::pair<double, double>>& points,
                       int output_width,
                       int output_height,
                       const std::string& flip_mode,
-                      std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null");
+                      std::string g_camDevIndex, std::string g_audioDevIndex,
+                      const RecordingOptions& options);
 };
 
 #endif // GSTRECORDING_H
\ No newline at end of file
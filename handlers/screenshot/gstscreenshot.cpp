@@ -1,126 +1,261 @@
-bool GstRecording::takeScreenshot(const std::string& outputPathSs) {
+#include "gstscreenshot.h"
+#include <gst/video/video.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// Frames waiting for or being encoded, per pool thread, before a burst
+// starts skipping frames
+static const guint MAX_PENDING_PER_THREAD = 4;
+
+GstFrameTap::GstFrameTap(GstElement* appsink, size_t capacity)
+    : appsink(GST_ELEMENT(gst_object_ref(appsink))), capacity(std::max<size_t>(capacity, 1)) {
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = onNewSample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, this, nullptr);
+}
+
+GstFrameTap::~GstFrameTap() {
+    GstAppSinkCallbacks callbacks = {};
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, nullptr, nullptr);
+    gst_object_unref(appsink);
+
+    for (auto& frame : frames) {
+        gst_sample_unref(frame.sample);
+    }
+}
+
+GstSample* GstFrameTap::latest() {
     std::lock_guard<std::mutex> lock(mutex);
-    
-    if (recordings.empty()) {
-        std::cerr << "No active recording found for screenshot" << std::endl;
-        return false;
+    return frames.empty() ? nullptr : gst_sample_ref(frames.back().sample);
+}
+
+GstSample* GstFrameTap::next(GstSample* after, GstClockTime timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // after holds a ref, so a new frame can't have its address
+    auto is_new = [&] { return !frames.empty() && frames.back().sample != after; };
+    arrived.wait_for(lock, std::chrono::nanoseconds(timeout), is_new);
+    return is_new() ? gst_sample_ref(frames.back().sample) : nullptr;
+}
+
+GstSample* GstFrameTap::nearest(GstClockTime clock_time, GstClockTime max_distance, GstClockTime timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    arrived.wait_for(lock, std::chrono::nanoseconds(timeout), [&] {
+        return !frames.empty() && frames.back().clock_time >= clock_time;
+    });
+
+    const Frame* best = nullptr;
+    GstClockTime best_distance = GST_CLOCK_TIME_NONE;
+    for (const auto& frame : frames) {
+        GstClockTime distance = frame.clock_time > clock_time ?
+            frame.clock_time - clock_time : clock_time - frame.clock_time;
+        if (distance < best_distance) {
+            best = &frame;
+            best_distance = distance;
+        }
     }
+    if (!best || best_distance > max_distance) {
+        return nullptr;
+    }
+    return gst_sample_ref(best->sample);
+}
 
-    // Get the first recording session
-    auto& session = recordings.begin()->second;
-    
-    if (!session.pipeline || !GST_IS_ELEMENT(session.pipeline)) {
-        std::cerr << "Invalid pipeline for screenshot" << std::endl;
-        return false;
+GstFlowReturn GstFrameTap::onNewSample(GstAppSink* appsink, gpointer user_data) {
+    GstFrameTap* self = static_cast<GstFrameTap*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_OK;
     }
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstSegment* segment = gst_sample_get_segment(sample);
+    GstClockTime running_time = buffer && segment ?
+        gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer)) : GST_CLOCK_TIME_NONE;
+    if (!GST_CLOCK_TIME_IS_VALID(running_time)) {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+    GstClockTime clock_time = running_time + gst_element_get_base_time(GST_ELEMENT(appsink));
 
-    // Create elements in NULL state
-    GstElement* queue_screenshot = gst_element_factory_make("queue", "queue_screenshot");
-    GstElement* jpegenc = gst_element_factory_make("jpegenc", "jpegenc");
-    GstElement* filesink = gst_element_factory_make("filesink", "screenshot_filesink");
-    
-    if (!queue_screenshot || !jpegenc || !filesink) {
-        std::cerr << "Failed to create screenshot elements" << std::endl;
-        if (queue_screenshot) gst_object_unref(queue_screenshot);
-        if (jpegenc) gst_object_unref(jpegenc);
-        if (filesink) gst_object_unref(filesink);
-        return false;
+    // Only moves refs, the frames themselves are never copied
+    GstSample* old = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (self->frames.size() == self->capacity) {
+            old = self->frames.front().sample;
+            self->frames.pop_front();
+        }
+        self->frames.push_back({sample, clock_time});
     }
+    self->arrived.notify_all();
+    if (old) {
+        gst_sample_unref(old);
+    }
+    return GST_FLOW_OK;
+}
 
-    // Configure filesink
-    g_object_set(filesink, 
-        "location", outputPathSs.c_str(),
-        "sync", FALSE,  // No need to sync for single frame
-        NULL);
-
-    // Configure jpegenc
-    g_object_set(jpegenc,
-        "quality", 85,
-        NULL);
-
-    // Add elements to pipeline before linking
-    gst_bin_add_many(GST_BIN(session.pipeline), 
-        queue_screenshot, jpegenc, filesink, 
-        NULL);
-
-    // Link elements
-    if (!gst_element_link_many(queue_screenshot, jpegenc, filesink, NULL)) {
-        std::cerr << "Failed to link screenshot elements" << std::endl;
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
+GstSample* GstScreenshot::frameAt(GstFrameTap& tap, GstClockTime timestamp, GstClockTime base_time) {
+    if (!GST_CLOCK_TIME_IS_VALID(timestamp)) {
+        return tap.latest();
     }
+    return tap.nearest(base_time + timestamp, MAX_FRAME_DISTANCE, GST_SECOND);
+}
 
-    // Get the tee element
-    GstElement* tee = gst_bin_get_by_name(GST_BIN(session.pipeline), "screenshot_tee");
-    if (!tee) {
-        std::cerr << "Failed to find tee element in pipeline" << std::endl;
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
+bool GstScreenshot::save(GstSample* frame, const std::string& path) {
+    size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    const char* media_type = extension == "png" ? "image/png" :
+                             extension == "webp" ? "image/webp" : "image/jpeg";
+
+    // Converts and encodes in a short-lived pipeline of its own
+    GstCaps* caps = gst_caps_new_empty_simple(media_type);
+    GError* error = nullptr;
+    GstSample* image = gst_video_convert_sample(frame, caps, GST_SECOND, &error);
+    gst_caps_unref(caps);
+    if (!image) {
+        std::cerr << "Failed to encode screenshot: " << (error ? error->message : "unknown error") << std::endl;
+        g_clear_error(&error);
         return false;
     }
 
-    // Request a new src pad from the tee
-    GstPad* tee_src_pad = gst_element_get_request_pad(tee, "src_%u");
-    GstPad* queue_sink_pad = gst_element_get_static_pad(queue_screenshot, "sink");
-    
-    if (!tee_src_pad || !queue_sink_pad) {
-        std::cerr << "Failed to get pads for screenshot branch" << std::endl;
-        if (tee_src_pad) gst_object_unref(tee_src_pad);
-        if (queue_sink_pad) gst_object_unref(queue_sink_pad);
-        gst_object_unref(tee);
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
+    GstMapInfo map;
+    GstBuffer* buffer = gst_sample_get_buffer(image);
+    bool ok = buffer && gst_buffer_map(buffer, &map, GST_MAP_READ);
+    if (ok) {
+        ok = g_file_set_contents(path.c_str(), (const gchar*) map.data, map.size, &error);
+        gst_buffer_unmap(buffer, &map);
+        if (!ok) {
+            std::cerr << "Failed to write screenshot: " << error->message << std::endl;
+            g_clear_error(&error);
+        }
     }
+    gst_sample_unref(image);
+    return ok;
+}
 
-    // Link tee to queue
-    if (gst_pad_link(tee_src_pad, queue_sink_pad) != GST_PAD_LINK_OK) {
-        std::cerr << "Failed to link tee to screenshot branch" << std::endl;
-        gst_object_unref(tee_src_pad);
-        gst_object_unref(queue_sink_pad);
-        gst_object_unref(tee);
-        gst_bin_remove_many(GST_BIN(session.pipeline), 
-            queue_screenshot, jpegenc, filesink, 
-            NULL);
-        return false;
+std::string GstScreenshot::formatPath(const std::string& path_template, int index) {
+    // Only %d with an optional zero-padded width, the template comes from
+    // the command and isn't handed to printf as is
+    size_t start = path_template.find('%');
+    while (start != std::string::npos) {
+        size_t end = start + 1;
+        bool zero = end < path_template.size() && path_template[end] == '0';
+        size_t digits = path_template.find_first_not_of("0123456789", end);
+        if (digits != std::string::npos && path_template[digits] == 'd') {
+            int width = 0;
+            for (size_t i = end; i < digits; i++) {
+                width = std::min(width * 10 + (path_template[i] - '0'), MAX_INDEX_WIDTH);
+            }
+            std::string number = std::to_string(index);
+            if ((int) number.size() < width) {
+                number.insert(0, width - number.size(), zero ? '0' : ' ');
+            }
+            return path_template.substr(0, start) + number + path_template.substr(digits + 1);
+        }
+        start = path_template.find('%', end);
     }
 
-    // Set up a probe to remove the screenshot branch after capturing one frame
-    GstPad* jpegenc_sink_pad = gst_element_get_static_pad(jpegenc, "sink");
-    if (jpegenc_sink_pad) {
-        gulong probe_id = gst_pad_add_probe(jpegenc_sink_pad, 
-            GST_PAD_PROBE_TYPE_BUFFER,
-            [](GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
-                GstElement* pipeline = static_cast<GstElement*>(user_data);
-                
-                // Post a message to the bus to remove elements in main thread context
-                gst_element_post_message(pipeline,
-                    gst_message_new_application(GST_OBJECT(pipeline),
-                        gst_structure_new("remove-screenshot-elements",
-                            "queue", G_TYPE_STRING, "queue_screenshot",
-                            "jpegenc", G_TYPE_STRING, "jpegenc",
-                            "filesink", G_TYPE_STRING, "screenshot_filesink",
-                            NULL)));
-                
-                return GST_PAD_PROBE_REMOVE;
-            }, session.pipeline, NULL);
-        
-        gst_object_unref(jpegenc_sink_pad);
+    // No %d, the index goes before the extension
+    size_t dot = path_template.rfind('.');
+    size_t slash = path_template.rfind('/');
+    std::string number = "_" + std::to_string(index);
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path_template + number;
     }
+    return path_template.substr(0, dot) + number + path_template.substr(dot);
+}
+
+namespace {
+
+// Frames of one burst still on the pool
+struct BurstState {
+    std::mutex mutex;
+    std::condition_variable done;
+    guint pending = 0;
+    bool failed = false;
+};
+
+struct SaveTask {
+    GstSample* frame;
+    std::string path;
+    std::shared_ptr<BurstState> state;
+};
+
+// Frames on the pool, of all bursts
+std::atomic<guint> in_flight{0};
+
+void saveTask(gpointer data, gpointer) {
+    std::unique_ptr<SaveTask> task(static_cast<SaveTask*>(data));
+    bool ok = GstScreenshot::save(task->frame, task->path);
+    gst_sample_unref(task->frame);
+    in_flight--;
 
-    // Sync states - this must be done after linking
-    gst_element_sync_state_with_parent(queue_screenshot);
-    gst_element_sync_state_with_parent(jpegenc);
-    gst_element_sync_state_with_parent(filesink);
+    std::lock_guard<std::mutex> lock(task->state->mutex);
+    task->state->pending--;
+    task->state->failed |= !ok;
+    task->state->done.notify_all();
+}
 
-    // Clean up references
-    gst_object_unref(tee_src_pad);
-    gst_object_unref(queue_sink_pad);
-    gst_object_unref(tee);
+GThreadPool* savePool() {
+    static GThreadPool* pool = g_thread_pool_new(saveTask, nullptr,
+        (gint) std::min(4u, g_get_num_processors()), FALSE, nullptr);
+    return pool;
+}
+
+} // namespace
+
+bool GstScreenshot::burst(GstFrameTap& tap, const std::string& path_template,
+                          int count, GstClockTime interval, const std::atomic<bool>* cancelled) {
+    GThreadPool* pool = savePool();
+    guint max_pending = MAX_PENDING_PER_THREAD * g_thread_pool_get_max_threads(pool);
+    auto state = std::make_shared<BurstState>();
+
+    auto start = std::chrono::steady_clock::now();
+    GstSample* previous = nullptr;
+    bool stopped = false;
+    for (int i = 0; i < count && !stopped; i++) {
+        // Sleeps in short steps so that a cancel doesn't wait for a long
+        // interval to pass
+        auto due = start + std::chrono::nanoseconds(interval * i);
+        while (!(stopped = cancelled && *cancelled) && std::chrono::steady_clock::now() < due) {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                due - std::chrono::steady_clock::now(), std::chrono::milliseconds(100)));
+        }
+        if (stopped) {
+            std::cerr << "Screenshots cancelled after " << i << " of " << count << std::endl;
+            break;
+        }
+
+        // Never the same frame twice, should frames come slower than asked
+        GstSample* frame = tap.next(previous, GST_SECOND);
+        if (previous) {
+            gst_sample_unref(previous);
+        }
+        previous = frame;
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!frame) {
+            std::cerr << "No frame for screenshot " << i << std::endl;
+            state->failed = true;
+            continue;
+        }
+        if (in_flight >= max_pending) {
+            std::cerr << "Screenshot " << i << " skipped, encoding can't keep up" << std::endl;
+            state->failed = true;
+            continue;
+        }
+        in_flight++;
+        state->pending++;
+        g_thread_pool_push(pool, new SaveTask{gst_sample_ref(frame), formatPath(path_template, i), state}, nullptr);
+    }
+    if (previous) {
+        gst_sample_unref(previous);
+    }
 
-    return true;
-}
\ No newline at end of file
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->pending == 0; });
+    return !state->failed && !stopped;
+}
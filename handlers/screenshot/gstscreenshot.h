@@ -0,0 +1,85 @@
+#ifndef GSTSCREENSHOT_H
+#define GSTSCREENSHOT_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Keeps refs to the latest raw frames an appsink receives, up to capacity.
+// The appsink is meant to sit behind a leaky queue with max-buffers=1 and
+// drop=true, so that the tap never holds up the rest of its pipeline. The
+// frames aren't copied, but they stay out of their buffer pool while kept.
+class GstFrameTap {
+public:
+    explicit GstFrameTap(GstElement* appsink, size_t capacity = 1);
+    ~GstFrameTap();
+
+    GstFrameTap(const GstFrameTap&) = delete;
+    GstFrameTap& operator=(const GstFrameTap&) = delete;
+
+    // Latest frame with a ref of its own, nullptr before the first one
+    GstSample* latest();
+    // Latest frame unless it is after, else waits up to timeout for the
+    // next one. nullptr if none came.
+    GstSample* next(GstSample* after, GstClockTime timeout);
+    // Kept frame shown closest to clock_time (a time of the pipeline clock),
+    // waiting up to timeout for it when it is still to come. nullptr when
+    // the closest is more than max_distance away.
+    GstSample* nearest(GstClockTime clock_time, GstClockTime max_distance, GstClockTime timeout);
+
+private:
+    static GstFlowReturn onNewSample(GstAppSink* appsink, gpointer user_data);
+
+    struct Frame {
+        GstSample* sample;
+        GstClockTime clock_time; // running time + base time of the pipeline
+    };
+
+    GstElement* appsink;
+    size_t capacity;
+    std::deque<Frame> frames; // oldest first
+    std::mutex mutex;
+    std::condition_variable arrived;
+};
+
+class GstScreenshot {
+public:
+    // How far from the asked time a frame may be, further means the time
+    // isn't in the tap's frames any more
+    static constexpr GstClockTime MAX_FRAME_DISTANCE = 100 * GST_MSECOND;
+
+    // Frame of tap at timestamp, a running time of a pipeline with
+    // base_time on the same clock, or the latest one with
+    // GST_CLOCK_TIME_NONE. nullptr if there is none.
+    static GstSample* frameAt(GstFrameTap& tap, GstClockTime timestamp, GstClockTime base_time);
+
+    // Encodes a raw frame to the image format of path's extension (JPEG
+    // unless it is .png) and writes it. Runs on the calling thread, never on
+    // a streaming thread of the frame's pipeline.
+    static bool save(GstSample* frame, const std::string& path);
+
+    // Saves count frames of tap, one every interval or every new frame
+    // with 0, to path_template: printf-style with one %d for the index,
+    // e.g. shot_%04d.jpg. Frames are encoded and written on a small shared
+    // pool of worker threads while the next ones are taken; frames that
+    // come while the pool is saturated are skipped rather than queued up.
+    // Returns once every file is written, false if any frame was missed or
+    // cancelled was set meanwhile. Blocks for count intervals, callers
+    // that can't wait run it on a thread of their own.
+    static bool burst(GstFrameTap& tap, const std::string& path_template,
+                      int count, GstClockTime interval,
+                      const std::atomic<bool>* cancelled = nullptr);
+
+    // Widest padding of the index, wider templates such as %0999999d get
+    // this much
+    static constexpr int MAX_INDEX_WIDTH = 32;
+
+    // path_template with its %d replaced by index
+    static std::string formatPath(const std::string& path_template, int index);
+};
+
+#endif // GSTSCREENSHOT_H
@@ -0,0 +1,33 @@
+#include "gstscreenshot.h"
+#include "unit_test.h"
+#include <string>
+
+static void testFormatPath() {
+    CHECK_EQ(GstScreenshot::formatPath("shot_%04d.jpg", 7), std::string("shot_0007.jpg"));
+    CHECK_EQ(GstScreenshot::formatPath("shot_%04d.jpg", 12345), std::string("shot_12345.jpg"));
+    CHECK_EQ(GstScreenshot::formatPath("%d", 7), std::string("7"));
+    CHECK_EQ(GstScreenshot::formatPath("%3d.png", 7), std::string("  7.png"));
+
+    // Without %d the index goes before the extension of the file name
+    CHECK_EQ(GstScreenshot::formatPath("shot.jpg", 7), std::string("shot_7.jpg"));
+    CHECK_EQ(GstScreenshot::formatPath("shot", 7), std::string("shot_7"));
+    CHECK_EQ(GstScreenshot::formatPath("dir.v/shot", 7), std::string("dir.v/shot_7"));
+    CHECK_EQ(GstScreenshot::formatPath("dir.v/shot.jpg", 7), std::string("dir.v/shot_7.jpg"));
+
+    // Anything but %d is left as is, and only the first %d is replaced
+    CHECK_EQ(GstScreenshot::formatPath("%s_%d.jpg", 7), std::string("%s_7.jpg"));
+    CHECK_EQ(GstScreenshot::formatPath("100%_%d.jpg", 7), std::string("100%_7.jpg"));
+    CHECK_EQ(GstScreenshot::formatPath("%d_%d", 7), std::string("7_%d"));
+    CHECK_EQ(GstScreenshot::formatPath("%n.jpg", 7), std::string("%n_7.jpg"));
+
+    // Widths are capped rather than allocated or overflowed
+    std::string wide = GstScreenshot::formatPath("%099999999999d", 7);
+    CHECK_EQ(wide.size(), (size_t) GstScreenshot::MAX_INDEX_WIDTH);
+    CHECK_EQ(wide, std::string(GstScreenshot::MAX_INDEX_WIDTH - 1, '0') + "7");
+}
+
+int main(int argc, char* argv[]) {
+    gst_init(&argc, &argv);
+    testFormatPath();
+    return unitTestResult();
+}
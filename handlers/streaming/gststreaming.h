@@ -5,9 +5,15 @@
 #include <string>
 #include <map>
 #include <mutex>
+#include <set>
 #include <vector>
 #include <utility>
 #include <glib-object.h>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include "gstcapture.h"
+#include "gstsharedencoder.h"
 
 class GstStreaming {
 public:
@@ -22,15 +28,36 @@ public:
                       std::string camIndex = "null",
                       std::string g_audioDevIndex = "null");
     
+    bool updatePoints(const std::string& channelName,
+                      const std::vector<std::pair<double, double>>& points);
+    // Returns as soon as EOS is sent, the stream ends in the background
     bool stopStreaming(const std::string& channelName);
-    bool takeScreenshot(const std::string& channelName, const std::string& outputPath);
+    // Encoder of the stream, for screenshots, with the base time of the
+    // stream's pipeline
+    std::shared_ptr<GstSharedEncoder> getSessionEncoder(const std::string& channelName,
+                                                        GstClockTime& base_time);
+
+    // JSON array with the stats of every stream, see GstRecording::getStats
+    std::string getStats();
+
+    // Called from a worker thread once a stopped stream is finalized
+    using StoppedCallback = std::function<void(const std::string& channelName, bool ok)>;
+    void setStoppedCallback(StoppedCallback callback);
+
+    // Stops every stream, see GstRecording::stopAll
+    void stopAll();
 
 private:
     struct StreamingSession {
         GstElement* pipeline = nullptr;
         GstElement* webrtc_sink = nullptr;
-        GstElement* video_tee = nullptr;
         GstElement* audio_tee = nullptr;
+        // appsrcs fed by the shared encoder (video) and capture (audio)
+        std::shared_ptr<GstCapture> capture;
+        std::shared_ptr<GstSharedEncoder> encoder;
+        GstElement* video_src = nullptr;
+        GstElement* audio_src = nullptr;
+        std::shared_ptr<GstPipelineStats> stats;
         bool is_active = false;
 
         StreamingSession() = default;
@@ -44,9 +71,25 @@ private:
     };
 
     std::map<std::string, StreamingSession> streaming_sessions;
+    // Streams being started, without the lock, see startStreaming
+    std::set<std::string> starting;
+    // Streams changing encoder, without the lock, see updatePoints
+    std::set<std::string> updating;
+    // Stopped streams waiting for their EOS, see GstFinalizer
+    std::map<std::string, StreamingSession> finalizing;
+    std::condition_variable finalized;
+    // Stopped callbacks running
+    int notifying = 0;
+    StoppedCallback on_stopped;
     std::mutex session_mutex;
+
+    // Moves a session to finalizing and ends it, called with session_mutex held
+    void finalizeSession(std::map<std::string, StreamingSession>::iterator it);
     
-    bool createPipeline(const std::string& channelName,
+    // Builds the pipeline of a new stream and starts it, called without
+    // session_mutex
+    bool createPipeline(StreamingSession& session,
+                      const std::string& channelName,
                       const std::vector<std::pair<double, double>>& points,
                       int output_width,
                       int output_height,
@@ -56,6 +99,12 @@ private:
 };
 
 inline GstStreaming::StreamingSession::~StreamingSession() {
+    if (encoder) {
+        encoder->detach(video_src);
+    }
+    if (capture) {
+        capture->detach(nullptr, audio_src);
+    }
     if (pipeline) {
         gst_element_set_state(pipeline, GST_STATE_NULL);
         gst_object_unref(pipeline);
@@ -66,18 +115,29 @@ inline GstStreaming::StreamingSession::~StreamingSession() {
 inline GstStreaming::StreamingSession::StreamingSession(StreamingSession&& other) noexcept 
     : pipeline(other.pipeline),
       webrtc_sink(other.webrtc_sink),
-      video_tee(other.video_tee),
       audio_tee(other.audio_tee),
+      capture(std::move(other.capture)),
+      encoder(std::move(other.encoder)),
+      video_src(other.video_src),
+      audio_src(other.audio_src),
+      stats(std::move(other.stats)),
       is_active(other.is_active) {
     other.pipeline = nullptr;
     other.webrtc_sink = nullptr;
-    other.video_tee = nullptr;
     other.audio_tee = nullptr;
+    other.video_src = nullptr;
+    other.audio_src = nullptr;
     other.is_active = false;
 }
 
 inline GstStreaming::StreamingSession& GstStreaming::StreamingSession::operator=(StreamingSession&& other) noexcept {
     if (this != &other) {
+        if (encoder) {
+            encoder->detach(video_src);
+        }
+        if (capture) {
+            capture->detach(nullptr, audio_src);
+        }
         if (pipeline) {
             gst_element_set_state(pipeline, GST_STATE_NULL);
             gst_object_unref(pipeline);
@@ -85,14 +145,19 @@ inline GstStreaming::StreamingSession& GstStreaming::StreamingSession::operator=
 
         pipeline = other.pipeline;
         webrtc_sink = other.webrtc_sink;
-        video_tee = other.video_tee;
         audio_tee = other.audio_tee;
+        capture = std::move(other.capture);
+        encoder = std::move(other.encoder);
+        video_src = other.video_src;
+        audio_src = other.audio_src;
+        stats = std::move(other.stats);
         is_active = other.is_active;
         
         other.pipeline = nullptr;
         other.webrtc_sink = nullptr;
-        other.video_tee = nullptr;
         other.audio_tee = nullptr;
+        other.video_src = nullptr;
+        other.audio_src = nullptr;
         other.is_active = false;
     }
     return *this;
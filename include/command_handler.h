@@ -5,25 +5,74 @@
 #include <vector>
 #include <utility> // for std::pair
 #include <iostream>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include "gstrecording.h"
+#include "gststreaming.h"
 
 class CommandHandler {
 public:
+    ~CommandHandler();
+
     bool startRecording(const std::string& outputPath,
                       const std::vector<std::pair<double, double>>& points,
                       int output_width = 1280,
                       int output_height = 720,
                       const std::string& flip_mode = "none",
-                      std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null");
+                      std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null",
+                      const RecordingOptions& options = RecordingOptions());
     bool startStreaming(const std::string& channelName,
                       const std::vector<std::pair<double, double>>& points,
                       int output_width = 1280,
                       int output_height = 720,
                       const std::string& flip_mode = "none",
                       std::string g_camDevIndex = "null", std::string g_audioDevIndex = "null");
-    bool takeScreenshot(const std::string& outputPathSs);
+    // Screenshot of the recording at outputPath or the stream channelName,
+    // of the first recording with neither. timestampMs is a position in the
+    // recording or stream, the frame closest to it is saved if it is still
+    // kept (see GstSharedEncoder::setScreenshotFrames); the latest frame
+    // when negative.
+    bool takeScreenshot(const std::string& outputPathSs, const std::string& outputPath = "",
+                        const std::string& channelName = "", double timestampMs = -1);
+    // Starts a burst on a thread of its own and returns, its end is
+    // reported to the stopped callback as kind "screenshots" with the
+    // template as key
+    bool takeScreenshots(const std::string& pathTemplate, int count, int intervalMs,
+                         const std::string& outputPath = "", const std::string& channelName = "");
+    bool updateRecordingPoints(const std::string& outputPath,
+                      const std::vector<std::pair<double, double>>& points);
+    bool updateStreamingPoints(const std::string& channelName,
+                      const std::vector<std::pair<double, double>>& points);
     bool stopRecording(const std::string& outputPath);
     bool stopStreaming(const std::string& channelName);
-    
+    // kind is "recording", "streaming" or "screenshots", key the
+    // outputPath, channelName or screenshot path template
+    using StoppedCallback = std::function<void(const std::string& kind, const std::string& key, bool ok)>;
+    void setStoppedCallback(StoppedCallback callback);
+    void setRecordingPoolSize(int size, std::string g_camDevIndex, std::string g_audioDevIndex);
+    long getRecordingStartLatency(const std::string& outputPath);
+    // {"recordings":[...],"streams":[...]}, see GstRecording::getStats
+    std::string getStats();
+    // Stops every recording, stream and screenshot burst, returns once
+    // they are finalized and their stopped callbacks ran
+    void stopAll();
+
+private:
+    // Encoder the screenshots of a recording or stream come from
+    std::shared_ptr<GstSharedEncoder> screenshotEncoder(const std::string& outputPath,
+        const std::string& channelName, GstClockTime& base_time);
+
+    GstRecording recorder;
+    GstStreaming streamer;
+
+    // Screenshot bursts still running, see takeScreenshots
+    int bursts = 0;
+    std::atomic<bool> cancel_bursts{false};
+    StoppedCallback on_stopped;
+    std::mutex bursts_mutex;
+    std::condition_variable bursts_done;
 };
 
 #endif
\ No newline at end of file
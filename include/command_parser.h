@@ -0,0 +1,71 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility> // for std::pair
+#include "gstrecording.h"
+
+// One command, from either protocol
+struct Command {
+    std::string id;  // echoed back in the result, JSON only
+    std::string action;
+    std::string outputPath;
+    std::string outputPathSs;
+    std::string channelName;
+    std::vector<std::pair<double, double>> points;
+    std::string flipMethod = "none";
+    // -1 keeps the size of the previous commands
+    int width = -1;
+    int height = -1;
+    RecordingOptions recordingOptions;
+    // take-screenshots: how many, and ms between them (0: every frame)
+    int count = 1;
+    int interval = 0;
+    // take-screenshot: position in ms in the recording or stream, -1 for
+    // the latest frame
+    double timestamp = -1;
+
+    // Commands on the same target must run in order, others may overlap
+    std::string target() const;
+    // Every recording and stream the command acts on or reads from, e.g.
+    // both for update-points with outputPath and channelName
+    std::vector<std::string> sessionTargets() const;
+};
+
+// What a command did, in the order the commands came in
+struct CommandResult {
+    std::string id;
+    std::string action;
+    bool ok = false;
+    std::string error;
+    double ms = 0;
+    // JSON the command returns, e.g. for stats
+    std::string data;
+};
+
+// --action=... --outputPath=... --p1=(x,y) style line
+bool parseArguments(const std::string& line, Command& command, std::string& error);
+
+// JSON lines: one command object, or an array of them run as a batch, e.g.
+// [{"id":"1","action":"start-recording","outputPath":"a.mp4",
+//   "points":[[622,77],[877,83],[900,684],[632,699]]}, ...]
+// Keys are the ones of the argument protocol without the dashes.
+bool isJsonLine(const std::string& line);
+bool parseJsonCommands(const std::string& line, std::vector<Command>& commands, std::string& error);
+
+// Runs a batch with run: commands on the same target (Command::target)
+// one after the other in their order, the others at the same time on a
+// few worker threads.
+// Commands without an id get their index. Returns once all of them are
+// done, with one result per command in the order they came in.
+std::vector<CommandResult> runCommandGroups(std::vector<Command>& commands,
+    const std::function<CommandResult(const Command& command)>& run);
+
+// One JSON line per result or event
+std::string formatResult(const CommandResult& result);
+std::string formatEvent(const std::string& event, const std::string& key,
+                        const std::string& value, bool ok);
+
+#endif
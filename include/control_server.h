@@ -0,0 +1,88 @@
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "command_parser.h"
+
+// Unix domain socket any number of clients can send commands to, in either
+// protocol, one per line. Every command gets a JSON result line back.
+// Recordings and streams belong to the client that started them: other
+// clients can't stop, retarget or take screenshots of them, and they are
+// stopped when their client disconnects. Runs its own GLib main loop on a
+// separate thread, the commands themselves run on worker threads so that a
+// slow one only holds up the client that sent it.
+class ControlServer {
+public:
+    // Runs a batch of commands, see runCommands in main.cpp
+    using Executor = std::function<std::vector<CommandResult>(std::vector<Command>& commands)>;
+
+    ControlServer(const std::string& path, Executor executor);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    bool start();
+    // Blocks until the server is stopped
+    void wait();
+
+    // Sends a line to every client, e.g. an event
+    void broadcast(const std::string& line);
+
+    // A session ended, whoever stopped it. target is its Command::target,
+    // the session is nobody's anymore.
+    void sessionStopped(const std::string& target);
+
+private:
+    struct Client {
+        int id;
+        ControlServer* server;
+        GSocketConnection* connection;
+        GDataInputStream* input;
+        std::mutex write_mutex;
+
+        ~Client();
+        void send(const std::string& line);
+    };
+
+    void run(std::promise<bool>* started);
+    void readNext(const std::shared_ptr<Client>& client);
+    void handleLine(const std::shared_ptr<Client>& client, const std::string& line);
+    void disconnect(const std::shared_ptr<Client>& client);
+
+    static gboolean onIncoming(GSocketService* service, GSocketConnection* connection,
+                               GObject* source, gpointer user_data);
+    static void onLine(GObject* source, GAsyncResult* result, gpointer user_data);
+
+    std::string path;
+    Executor executor;
+
+    GMainContext* context = nullptr;
+    bool listening = false;  // the socket at path is ours
+    GMainLoop* loop = nullptr;
+    std::thread thread;
+
+    std::map<int, std::shared_ptr<Client>> clients;
+    int next_client_id = 1;
+    std::mutex clients_mutex;
+
+    // Client id by command target (Command::target) of the sessions they own
+    std::map<std::string, int> owners;
+    std::mutex owners_mutex;
+
+    // Commands still running, the server only goes away once they're done
+    int running = 0;
+    std::condition_variable idle;
+};
+
+#endif
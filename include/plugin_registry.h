@@ -0,0 +1,38 @@
+#ifndef PLUGIN_REGISTRY_H
+#define PLUGIN_REGISTRY_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How long each startup phase took, printed once the app is ready
+class StartupTimer {
+public:
+    StartupTimer();
+
+    // Ends the current phase
+    void mark(const std::string& phase);
+    void print() const;
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    std::vector<std::pair<std::string, double>> phases;
+};
+
+// Keeps the plugin registry in cache_path instead of the per-user default.
+// When none of the plugins in plugin_dirs changed since the cache was
+// written, GStreamer is told to use it as is rather than checking every
+// plugin again; plugins are then only loaded once an element of theirs is
+// made. Returns whether the cache is up to date. Call before gst_init.
+bool usePluginRegistryCache(const std::string& cache_path, const std::vector<std::string>& plugin_dirs);
+
+// Remembers the plugins the cache was written for, call after gst_init
+void savePluginRegistryStamp(const std::string& cache_path, const std::vector<std::string>& plugin_dirs);
+
+// Registers the plugins linked into the app (STATIC_GST_PLUGINS in
+// CMakeLists.txt), they need no registry at all. Call after gst_init.
+void registerStaticPlugins();
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef UNIT_TEST_H
+#define UNIT_TEST_H
+
+#include <iostream>
+
+// Just enough for the unit tests run by ctest: failed checks are printed
+// and main returns unitTestResult(), non-zero if any failed.
+inline int& unitTestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            unitTestFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        auto a_ = (a); \
+        auto b_ = (b); \
+        if (!(a_ == b_)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " \
+                      << a_ << " != " << b_ << std::endl; \
+            unitTestFailures()++; \
+        } \
+    } while (0)
+
+inline int unitTestResult() {
+    if (unitTestFailures()) {
+        std::cerr << unitTestFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif // UNIT_TEST_H
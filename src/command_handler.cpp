@@ -1,13 +1,8 @@
 #include "command_handler.h"
-#include "gstrecording.h"
-#include "gststreaming.h"
+#include "gstscreenshot.h"
+#include <thread>
 
-static GstRecording recorder;
-static GstStreaming streamer;
-
-bool CommandHandler::startRecording(const std::string& outputPath,
-    const std::vector<std::pair<double, double>>& points,int width, int height,
-    const std::string& flip_mode, std::string g_camDevIndex, std::string g_audioDevIndex) {
+static bool checkPoints(const std::vector<std::pair<double, double>>& points) {
     // Verify we have exactly 4 points
     if (points.size() != 4) {
         std::cerr << "Error: Exactly 4 points required" << std::endl;
@@ -31,40 +26,112 @@ bool CommandHandler::startRecording(const std::string& outputPath,
         return false;
     }
 
-    return recorder.startRecording(outputPath, points, width, height, flip_mode, g_camDevIndex, g_audioDevIndex);
+    return true;
+}
+
+bool CommandHandler::startRecording(const std::string& outputPath,
+    const std::vector<std::pair<double, double>>& points,int width, int height,
+    const std::string& flip_mode, std::string g_camDevIndex, std::string g_audioDevIndex,
+    const RecordingOptions& options) {
+    if (!checkPoints(points)) {
+        return false;
+    }
+
+    return recorder.startRecording(outputPath, points, width, height, flip_mode, g_camDevIndex, g_audioDevIndex, options);
 }
 
 bool CommandHandler::startStreaming(const std::string& channelName,
     const std::vector<std::pair<double, double>>& points,int width, int height,
     const std::string& flip_mode, std::string g_camDevIndex, std::string g_audioDevIndex) {
-    // Verify we have exactly 4 points
-    if (points.size() != 4) {
-        std::cerr << "Error: Exactly 4 points required" << std::endl;
+    if (!checkPoints(points)) {
         return false;
     }
 
-    // Verify points form a valid quadrilateral
-    bool valid = false;
-    for (size_t i = 0; i < points.size(); i++) {
-        for (size_t j = i+1; j < points.size(); j++) {
-            if (points[i] != points[j]) {
-                valid = true;
-                break;
-            }
-        }
-        if (valid) break;
+    return streamer.startStreaming(channelName, points, width, height, flip_mode, g_camDevIndex, g_audioDevIndex);
+}
+
+std::shared_ptr<GstSharedEncoder> CommandHandler::screenshotEncoder(const std::string& outputPath,
+    const std::string& channelName, GstClockTime& base_time) {
+    std::shared_ptr<GstSharedEncoder> encoder = channelName.empty() ?
+        recorder.getSessionEncoder(outputPath, base_time) :
+        streamer.getSessionEncoder(channelName, base_time);
+    if (!encoder) {
+        std::cerr << "No active recording or stream found for screenshot: "
+                  << (channelName.empty() ? outputPath : channelName) << std::endl;
     }
+    return encoder;
+}
 
-    if (!valid) {
-        std::cerr << "Error: Points must form a valid quadrilateral" << std::endl;
+bool CommandHandler::takeScreenshot(const std::string& outputPathSs, const std::string& outputPath,
+    const std::string& channelName, double timestampMs) {
+    GstClockTime base_time;
+    // Held so that the frames stay valid should the session stop meanwhile
+    auto encoder = screenshotEncoder(outputPath, channelName, base_time);
+    if (!encoder) {
         return false;
     }
 
-    return streamer.startStreaming(channelName, points, width, height, flip_mode, g_camDevIndex, g_audioDevIndex);
+    GstClockTime timestamp = timestampMs < 0 ? GST_CLOCK_TIME_NONE : (GstClockTime) (timestampMs * GST_MSECOND);
+    GstSample* frame = GstScreenshot::frameAt(encoder->frameTap(), timestamp, base_time);
+    if (!frame) {
+        std::cerr << "No frame for screenshot" << (timestampMs < 0 ? "" : " at " + std::to_string(timestampMs) + " ms")
+                  << std::endl;
+        return false;
+    }
+
+    // The session keeps going untouched while the frame is encoded
+    bool ok = GstScreenshot::save(frame, outputPathSs);
+    gst_sample_unref(frame);
+    return ok;
+}
+
+bool CommandHandler::takeScreenshots(const std::string& pathTemplate, int count, int intervalMs,
+    const std::string& outputPath, const std::string& channelName) {
+    GstClockTime base_time;
+    auto encoder = screenshotEncoder(outputPath, channelName, base_time);
+    if (!encoder) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(bursts_mutex);
+    bursts++;
+    // The encoder is held so that its frames stay valid should the
+    // session stop meanwhile
+    std::thread([this, encoder, pathTemplate, count, intervalMs]() {
+        bool ok = GstScreenshot::burst(encoder->frameTap(), pathTemplate, count,
+                                       (GstClockTime) intervalMs * GST_MSECOND, &cancel_bursts);
+        StoppedCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(bursts_mutex);
+            callback = on_stopped;
+        }
+        if (callback) {
+            callback("screenshots", pathTemplate, ok);
+        }
+
+        std::lock_guard<std::mutex> lock(bursts_mutex);
+        bursts--;
+        bursts_done.notify_all();
+    }).detach();
+    return true;
 }
 
-bool CommandHandler::takeScreenshot(const std::string& outputPathSs) {
-    return recorder.takeScreenshot(outputPathSs);
+bool CommandHandler::updateRecordingPoints(const std::string& outputPath,
+    const std::vector<std::pair<double, double>>& points) {
+    if (!checkPoints(points)) {
+        return false;
+    }
+
+    return recorder.updatePoints(outputPath, points);
+}
+
+bool CommandHandler::updateStreamingPoints(const std::string& channelName,
+    const std::vector<std::pair<double, double>>& points) {
+    if (!checkPoints(points)) {
+        return false;
+    }
+
+    return streamer.updatePoints(channelName, points);
 }
 
 bool CommandHandler::stopRecording(const std::string& outputPath) {
@@ -73,4 +140,48 @@ bool CommandHandler::stopRecording(const std::string& outputPath) {
 
 bool CommandHandler::stopStreaming(const std::string& channelName) {
     return streamer.stopStreaming(channelName);
-}
\ No newline at end of file
+}
+
+void CommandHandler::setStoppedCallback(StoppedCallback callback) {
+    {
+        std::lock_guard<std::mutex> lock(bursts_mutex);
+        on_stopped = callback;
+    }
+    if (!callback) {
+        recorder.setStoppedCallback(nullptr);
+        streamer.setStoppedCallback(nullptr);
+        return;
+    }
+    recorder.setStoppedCallback([callback](const std::string& outputPath, bool ok) {
+        callback("recording", outputPath, ok);
+    });
+    streamer.setStoppedCallback([callback](const std::string& channelName, bool ok) {
+        callback("streaming", channelName, ok);
+    });
+}
+
+void CommandHandler::setRecordingPoolSize(int size, std::string g_camDevIndex, std::string g_audioDevIndex) {
+    recorder.setPoolSize(size, g_camDevIndex, g_audioDevIndex);
+}
+
+long CommandHandler::getRecordingStartLatency(const std::string& outputPath) {
+    return recorder.getStartLatency(outputPath);
+}
+
+std::string CommandHandler::getStats() {
+    return "{\"recordings\":" + recorder.getStats() + ",\"streams\":" + streamer.getStats() + "}";
+}
+
+void CommandHandler::stopAll() {
+    recorder.stopAll();
+    streamer.stopAll();
+
+    std::unique_lock<std::mutex> lock(bursts_mutex);
+    cancel_bursts = true;
+    bursts_done.wait(lock, [this] { return bursts == 0; });
+    cancel_bursts = false;
+}
+
+CommandHandler::~CommandHandler() {
+    stopAll();
+}
@@ -0,0 +1,601 @@
+#include "command_parser.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+std::string Command::target() const {
+    if (!outputPath.empty()) return "recording:" + outputPath;
+    if (!channelName.empty()) return "streaming:" + channelName;
+    if (!outputPathSs.empty()) return "screenshot:" + outputPathSs;
+    return "";
+}
+
+std::vector<std::string> Command::sessionTargets() const {
+    std::vector<std::string> targets;
+    if (!outputPath.empty()) targets.push_back("recording:" + outputPath);
+    if (!channelName.empty()) targets.push_back("streaming:" + channelName);
+    return targets;
+}
+
+// Split command into arguments (handles quotes and parentheses)
+static std::vector<std::string> splitArguments(const std::string& input) {
+    std::vector<std::string> args;
+    bool inQuotes = false;
+    bool inParentheses = false;
+    std::string current;
+
+    for (char c : input) {
+        if (c == ' ' && !inQuotes && !inParentheses) {
+            if (!current.empty()) {
+                args.push_back(current);
+                current.clear();
+            }
+        } else {
+            if (c == '"') inQuotes = !inQuotes;
+            if (c == '(') inParentheses = true;
+            if (c == ')') inParentheses = false;
+            current += c;
+        }
+    }
+
+    if (!current.empty()) {
+        args.push_back(current);
+    }
+
+    return args;
+}
+
+// "(x,y)" or "x,y"
+static bool parsePoint(std::string coords, std::pair<double, double>& point) {
+    if (!coords.empty() && coords.front() == '(' && coords.back() == ')') {
+        coords = coords.substr(1, coords.size() - 2);
+    }
+    size_t comma = coords.find(',');
+    if (comma == std::string::npos) {
+        return false;
+    }
+    try {
+        point.first = std::stod(coords.substr(0, comma));
+        point.second = std::stod(coords.substr(comma + 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Largest durations in seconds that still fit a GstClockTime
+static const double MAX_SECONDS = (double) G_MAXINT64 / GST_SECOND;
+// Largest byte count a double holds exactly
+static const double MAX_EXACT = 9007199254740992.0;
+
+static bool isNumberField(const std::string& key) {
+    static const std::set<std::string> fields = {
+        "width", "height", "count", "interval", "timestamp", "segmentDuration",
+        "segmentMaxBytes", "segmentKeep", "fragmentDuration", "reservedMaxDuration"};
+    return fields.count(key) > 0;
+}
+
+static bool inRange(double value, double min, double max) {
+    return std::isfinite(value) && value >= min && value <= max;
+}
+
+static bool isInteger(double value, double min, double max) {
+    return inRange(value, min, max) && value == std::floor(value);
+}
+
+// Sets the numeric field key of command, false if value isn't in its range
+// or isn't an integer where the field is one
+static bool setNumber(Command& command, const std::string& key, double value) {
+    RecordingOptions& options = command.recordingOptions;
+    if (key == "width" || key == "height") {
+        // -1 keeps the previous size
+        if (!(value == -1 || isInteger(value, 1, G_MAXINT16))) return false;
+        (key == "width" ? command.width : command.height) = static_cast<int>(value);
+    } else if (key == "count") {
+        if (!isInteger(value, INT_MIN, INT_MAX)) return false;
+        command.count = static_cast<int>(value);
+    } else if (key == "interval") {
+        if (!isInteger(value, INT_MIN, INT_MAX)) return false;
+        command.interval = static_cast<int>(value);
+    } else if (key == "timestamp") {
+        // -1 for the latest frame
+        if (!(value == -1 || inRange(value, 0, MAX_SECONDS * 1000))) return false;
+        command.timestamp = value;
+    } else if (key == "segmentDuration" || key == "reservedMaxDuration") {
+        if (!inRange(value, 0, MAX_SECONDS)) return false;
+        (key == "segmentDuration" ? options.segment_duration : options.reserved_max_duration) =
+            (GstClockTime) (value * GST_SECOND);
+    } else if (key == "segmentMaxBytes") {
+        if (!isInteger(value, 0, MAX_EXACT)) return false;
+        options.segment_max_bytes = static_cast<guint64>(value);
+    } else if (key == "segmentKeep" || key == "fragmentDuration") {
+        if (!isInteger(value, 0, G_MAXUINT)) return false;
+        (key == "segmentKeep" ? options.segment_keep : options.fragment_duration_ms) =
+            static_cast<guint>(value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Plain decimal, as in JSON: strtod alone would also take nan, inf or hex
+static bool isDecimal(const char* start, const char* end) {
+    for (const char* c = start; c < end; c++) {
+        if (!(*c >= '0' && *c <= '9') && *c != '-' && *c != '+' && *c != '.' && *c != 'e' && *c != 'E') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseArguments(const std::string& line, Command& command, std::string& error) {
+    for (const auto& arg : splitArguments(line)) {
+        size_t equals = arg.find('=');
+        std::string key = arg.rfind("--", 0) == 0 && equals != std::string::npos ?
+            arg.substr(2, equals - 2) : "";
+        if (isNumberField(key)) {
+            std::string text = arg.substr(equals + 1);
+            char* end = nullptr;
+            double value = std::strtod(text.c_str(), &end);
+            if (text.empty() || end != text.c_str() + text.size() ||
+                !isDecimal(text.c_str(), end) || !setNumber(command, key, value)) {
+                error = "Invalid number in: " + arg;
+                return false;
+            }
+        }
+        else if (arg.find("--action=") == 0) {
+            command.action = arg.substr(9);
+        }
+        else if (arg.find("--outputPath=") == 0) {
+            command.outputPath = arg.substr(13);
+        }
+        else if (arg.find("--outputPathSs=") == 0) {
+            command.outputPathSs = arg.substr(15);
+        }
+        else if (arg.find("--channelName=") == 0) {
+            command.channelName = arg.substr(14);
+        }
+        else if (arg.find("--p1=") == 0 || arg.find("--p2=") == 0 ||
+                 arg.find("--p3=") == 0 || arg.find("--p4=") == 0) {
+            std::pair<double, double> point;
+            if (!parsePoint(arg.substr(5), point)) {
+                error = "Invalid point: " + arg;
+                return false;
+            }
+            command.points.push_back(point);
+        }
+        else if (arg.find("--flipMethod=") == 0) {
+            command.flipMethod = arg.substr(13);
+        }
+        else if (arg.find("--segmentTemplate=") == 0) {
+            command.recordingOptions.segment_template = arg.substr(18);
+        }
+        else if (arg.find("--moovRecoveryFile=") == 0) {
+            command.recordingOptions.moov_recovery_file = arg.substr(19);
+        }
+    }
+    return true;
+}
+
+namespace {
+
+// Just enough JSON for the command protocol
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : text(text) {}
+
+    bool parse(JsonValue& value, std::string& error) {
+        if (!parseValue(value) || (skipSpace(), pos != text.size())) {
+            error = "Invalid JSON at offset " + std::to_string(pos);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                     text[pos] == '\r' || text[pos] == '\n')) {
+            pos++;
+        }
+    }
+
+    bool consume(const char* literal) {
+        size_t len = std::char_traits<char>::length(literal);
+        if (text.compare(pos, len, literal) != 0) {
+            return false;
+        }
+        pos += len;
+        return true;
+    }
+
+    bool parseValue(JsonValue& value) {
+        skipSpace();
+        if (pos >= text.size()) {
+            return false;
+        }
+        switch (text[pos]) {
+            case '{':
+            case '[': {
+                // Commands are shallow, this keeps the recursion bounded
+                if (depth == MAX_DEPTH) {
+                    return false;
+                }
+                depth++;
+                bool ok = text[pos] == '{' ? parseObject(value) : parseArray(value);
+                depth--;
+                return ok;
+            }
+            case '"': value.type = JsonValue::String; return parseString(value.string);
+            case 't': value.type = JsonValue::Bool; value.boolean = true; return consume("true");
+            case 'f': value.type = JsonValue::Bool; value.boolean = false; return consume("false");
+            case 'n': value.type = JsonValue::Null; return consume("null");
+            default: return parseNumber(value);
+        }
+    }
+
+    bool parseObject(JsonValue& value) {
+        value.type = JsonValue::Object;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == '}') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            std::string key;
+            JsonValue member;
+            skipSpace();
+            if (pos >= text.size() || text[pos] != '"' || !parseString(key)) {
+                return false;
+            }
+            skipSpace();
+            if (!consume(":") || !parseValue(member)) {
+                return false;
+            }
+            value.members.emplace_back(std::move(key), std::move(member));
+            skipSpace();
+            if (consume("}")) {
+                return true;
+            }
+            if (!consume(",")) {
+                return false;
+            }
+        }
+    }
+
+    bool parseArray(JsonValue& value) {
+        value.type = JsonValue::Array;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == ']') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            JsonValue item;
+            if (!parseValue(item)) {
+                return false;
+            }
+            value.items.push_back(std::move(item));
+            skipSpace();
+            if (consume("]")) {
+                return true;
+            }
+            if (!consume(",")) {
+                return false;
+            }
+        }
+    }
+
+    bool parseString(std::string& out) {
+        pos++;
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size()) {
+                return false;
+            }
+            switch (text[pos++]) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned cp;
+                    if (!parseHex4(cp)) {
+                        return false;
+                    }
+                    if (cp >= 0xD800 && cp <= 0xDBFF) {
+                        // Outside the BMP, the low half must follow
+                        unsigned low;
+                        if (!consume("\\u") || !parseHex4(low) || low < 0xDC00 || low > 0xDFFF) {
+                            return false;
+                        }
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                        return false;
+                    }
+                    appendUtf8(out, cp);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    bool parseHex4(unsigned& value) {
+        if (pos + 4 > text.size()) {
+            return false;
+        }
+        value = 0;
+        for (size_t end = pos + 4; pos < end; pos++) {
+            char c = text[pos];
+            int digit = c >= '0' && c <= '9' ? c - '0' :
+                        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                        c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            value = value * 16 + digit;
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool parseNumber(JsonValue& value) {
+        // strtod would also take nan, inf or hex
+        if (text[pos] != '-' && (text[pos] < '0' || text[pos] > '9')) {
+            return false;
+        }
+        const char* start = text.c_str() + pos;
+        char* end = nullptr;
+        value.type = JsonValue::Number;
+        value.number = std::strtod(start, &end);
+        if (end == start) {
+            return false;
+        }
+        if (!isDecimal(start, end)) {
+            return false;
+        }
+        pos += end - start;
+        return true;
+    }
+
+    static const int MAX_DEPTH = 16;
+
+    const std::string& text;
+    size_t pos = 0;
+    int depth = 0;
+};
+
+static std::string escape(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// [x, y] or "(x,y)"
+static bool jsonPoint(const JsonValue& value, std::pair<double, double>& point) {
+    if (value.type == JsonValue::String) {
+        return parsePoint(value.string, point);
+    }
+    if (value.type != JsonValue::Array || value.items.size() != 2 ||
+        value.items[0].type != JsonValue::Number || value.items[1].type != JsonValue::Number) {
+        return false;
+    }
+    point = {value.items[0].number, value.items[1].number};
+    return true;
+}
+
+static bool jsonCommand(const JsonValue& value, Command& command, std::string& error) {
+    if (value.type != JsonValue::Object) {
+        error = "Command must be an object";
+        return false;
+    }
+
+    for (const auto& [key, member] : value.members) {
+        bool is_string = member.type == JsonValue::String;
+        bool is_number = member.type == JsonValue::Number;
+        if (key == "id" && (is_string || is_number)) {
+            std::ostringstream id;
+            if (is_string) id << member.string; else id << member.number;
+            command.id = id.str();
+        }
+        else if (key == "action" && is_string) command.action = member.string;
+        else if (key == "outputPath" && is_string) command.outputPath = member.string;
+        else if (key == "outputPathSs" && is_string) command.outputPathSs = member.string;
+        else if (key == "channelName" && is_string) command.channelName = member.string;
+        else if (key == "flipMethod" && is_string) command.flipMethod = member.string;
+        else if (isNumberField(key) && is_number) {
+            if (!setNumber(command, key, member.number)) {
+                error = "Invalid number in: " + key;
+                return false;
+            }
+        }
+        else if (key == "points" && member.type == JsonValue::Array) {
+            for (const auto& item : member.items) {
+                std::pair<double, double> point;
+                if (!jsonPoint(item, point)) {
+                    error = "Invalid point in points";
+                    return false;
+                }
+                command.points.push_back(point);
+            }
+        }
+        else if (key == "p1" || key == "p2" || key == "p3" || key == "p4") {
+            std::pair<double, double> point;
+            if (!jsonPoint(member, point)) {
+                error = "Invalid point: " + key;
+                return false;
+            }
+            command.points.push_back(point);
+        }
+        else if (key == "segmentTemplate" && is_string) {
+            command.recordingOptions.segment_template = member.string;
+        }
+        else if (key == "moovRecoveryFile" && is_string) {
+            command.recordingOptions.moov_recovery_file = member.string;
+        }
+        else {
+            error = "Unknown or invalid field: " + key;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool isJsonLine(const std::string& line) {
+    size_t start = line.find_first_not_of(" \t");
+    return start != std::string::npos && (line[start] == '{' || line[start] == '[');
+}
+
+bool parseJsonCommands(const std::string& line, std::vector<Command>& commands, std::string& error) {
+    JsonValue value;
+    if (!JsonReader(line).parse(value, error)) {
+        return false;
+    }
+
+    if (value.type != JsonValue::Array) {
+        Command command;
+        if (!jsonCommand(value, command, error)) {
+            return false;
+        }
+        commands.push_back(std::move(command));
+        return true;
+    }
+
+    for (const auto& item : value.items) {
+        Command command;
+        if (!jsonCommand(item, command, error)) {
+            return false;
+        }
+        commands.push_back(std::move(command));
+    }
+    return true;
+}
+
+// Groups running at the same time at most
+static const size_t MAX_GROUP_WORKERS = 8;
+
+std::vector<CommandResult> runCommandGroups(std::vector<Command>& commands,
+    const std::function<CommandResult(const Command& command)>& run) {
+    std::vector<std::vector<size_t>> groups;
+    std::map<std::string, size_t> group_of_target;
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (commands[i].id.empty()) {
+            commands[i].id = std::to_string(i);
+        }
+        std::string target = commands[i].target();
+        auto it = group_of_target.find(target);
+        if (target.empty() || it == group_of_target.end()) {
+            group_of_target[target] = groups.size();
+            groups.push_back({i});
+        } else {
+            groups[it->second].push_back(i);
+        }
+    }
+
+    // A few workers take the groups in turn, however many targets the
+    // batch names
+    std::vector<CommandResult> results(commands.size());
+    std::atomic<size_t> next_group{0};
+    std::vector<std::future<void>> workers;
+    for (size_t w = 0; w < std::min(groups.size(), MAX_GROUP_WORKERS); w++) {
+        workers.push_back(std::async(std::launch::async, [&]() {
+            for (size_t g = next_group++; g < groups.size(); g = next_group++) {
+                for (size_t i : groups[g]) {
+                    results[i] = run(commands[i]);
+                }
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.wait();
+    }
+    return results;
+}
+
+std::string formatResult(const CommandResult& result) {
+    char ms[32];
+    std::snprintf(ms, sizeof(ms), "%.1f", result.ms);
+    std::string out = "{\"id\":\"" + escape(result.id) + "\",\"action\":\"" + escape(result.action) +
+                      "\",\"ok\":" + (result.ok ? "true" : "false") + ",\"ms\":" + ms;
+    if (!result.error.empty()) {
+        out += ",\"error\":\"" + escape(result.error) + "\"";
+    }
+    if (!result.data.empty()) {
+        out += ",\"data\":" + result.data;
+    }
+    return out + "}";
+}
+
+std::string formatEvent(const std::string& event, const std::string& key,
+                        const std::string& value, bool ok) {
+    return "{\"event\":\"" + escape(event) + "\",\"" + escape(key) + "\":\"" + escape(value) +
+           "\",\"ok\":" + (ok ? "true" : "false") + "}";
+}
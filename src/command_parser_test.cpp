@@ -0,0 +1,225 @@
+#include "command_parser.h"
+#include "unit_test.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+static Command parseJson(const std::string& line, bool& ok, std::string& error) {
+    std::vector<Command> commands;
+    ok = parseJsonCommands(line, commands, error) && commands.size() == 1;
+    return ok ? commands[0] : Command();
+}
+
+static bool jsonFails(const std::string& line) {
+    std::vector<Command> commands;
+    std::string error;
+    return !parseJsonCommands(line, commands, error) && !error.empty();
+}
+
+static void testArguments() {
+    Command command;
+    std::string error;
+    CHECK(parseArguments("--action=start-recording --outputPath=/tmp/a.mp4 "
+                         "--p1=(622,77) --p2=(877,83) --p3=(900,684) --p4=(632,699) --width=262",
+                         command, error));
+    CHECK_EQ(command.action, std::string("start-recording"));
+    CHECK_EQ(command.outputPath, std::string("/tmp/a.mp4"));
+    CHECK_EQ(command.points.size(), (size_t) 4);
+    CHECK(command.points[2] == std::make_pair(900.0, 684.0));
+    CHECK_EQ(command.width, 262);
+    CHECK_EQ(command.height, -1);
+    CHECK_EQ(command.target(), std::string("recording:/tmp/a.mp4"));
+    CHECK_EQ(command.sessionTargets().size(), (size_t) 1);
+
+    // Both sessions an update-points names, not only its target
+    Command both;
+    CHECK(parseArguments("--action=update-points --outputPath=a.mp4 --channelName=cam", both, error));
+    CHECK_EQ(both.target(), std::string("recording:a.mp4"));
+    CHECK_EQ(both.sessionTargets().size(), (size_t) 2);
+    CHECK_EQ(both.sessionTargets()[1], std::string("streaming:cam"));
+
+    Command bad_number;
+    CHECK(!parseArguments("--action=take-screenshots --count=many", bad_number, error));
+    CHECK(error.find("Invalid number") == 0);
+
+    // Numbers are checked against the range of their field
+    Command numbers;
+    CHECK(parseArguments("--segmentDuration=2.5 --segmentMaxBytes=1000000 --segmentKeep=3 --timestamp=-1",
+                         numbers, error));
+    CHECK_EQ(numbers.recordingOptions.segment_duration, (GstClockTime) (2.5 * GST_SECOND));
+    CHECK_EQ(numbers.recordingOptions.segment_max_bytes, (guint64) 1000000);
+    CHECK_EQ(numbers.recordingOptions.segment_keep, (guint) 3);
+    for (const char* arg : {"--segmentKeep=-5", "--count=3x", "--width=1e300", "--width=0",
+                            "--width=1.5", "--segmentMaxBytes=-1", "--segmentDuration=-5",
+                            "--fragmentDuration=0x10", "--interval=nan", "--height="}) {
+        Command bad;
+        error.clear();
+        CHECK(!parseArguments(arg, bad, error));
+        CHECK(error.find("Invalid number") == 0);
+    }
+
+    Command bad_point;
+    CHECK(!parseArguments("--action=update-points --p1=(1;2)", bad_point, error));
+    CHECK(error.find("Invalid point") == 0);
+}
+
+static void testJson() {
+    bool ok;
+    std::string error;
+    Command command = parseJson(
+        " {\"id\":7,\"action\":\"start-streaming\",\"channelName\":\"cam\","
+        "\"points\":[[1,2],[3.5,-4],\"(5,6)\",[7,8e1]],\"width\":640} ", ok, error);
+    CHECK(ok);
+    CHECK_EQ(command.id, std::string("7"));
+    CHECK_EQ(command.channelName, std::string("cam"));
+    CHECK_EQ(command.points.size(), (size_t) 4);
+    CHECK(command.points[1] == std::make_pair(3.5, -4.0));
+    CHECK(command.points[3] == std::make_pair(7.0, 80.0));
+    CHECK_EQ(command.width, 640);
+
+    std::vector<Command> batch;
+    CHECK(parseJsonCommands("[{\"action\":\"stats\"},{\"action\":\"stop-recording\",\"outputPath\":\"a.mp4\"}]",
+                            batch, error));
+    CHECK_EQ(batch.size(), (size_t) 2);
+    CHECK(isJsonLine("  [{}]"));
+    CHECK(!isJsonLine("--action=stats"));
+
+    // Escapes, \u as UTF-8, including pairs of surrogates
+    command = parseJson("{\"outputPath\":\"a\\\"b\\\\c\\/d\\n\\u00e9\\u20ac\\ud83d\\ude00\\u0041\"}", ok, error);
+    CHECK(ok);
+    CHECK_EQ(command.outputPath, std::string("a\"b\\c/d\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" "A"));
+    CHECK(jsonFails("{\"outputPath\":\"\\u00zz\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\u12\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\u 123\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\ud83d\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\ud83dx\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\ud83d\\u0041\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\ude00\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"\\x\"}"));
+    CHECK(jsonFails("{\"outputPath\":\"open"));
+
+    // Nesting: points deeper than pairs are invalid, deep input fails
+    // without running out of stack
+    CHECK(jsonFails("{\"points\":[[[1,2]],[3,4],[5,6],[7,8]]}"));
+    CHECK(jsonFails("{\"points\":[[1,2,3]]}"));
+    CHECK(jsonFails(std::string(100000, '[') + std::string(100000, ']')));
+    CHECK(jsonFails("{\"action\":{\"nested\":[1,[2,[3]]]}}"));
+
+    // Trailing garbage and broken syntax
+    CHECK(jsonFails("{\"action\":\"stats\"} x"));
+    CHECK(jsonFails("{\"action\":\"stats\"},"));
+    CHECK(jsonFails("[{\"action\":\"stats\"},]"));
+    CHECK(jsonFails("{\"action\":\"stats\",}"));
+    CHECK(jsonFails("{\"action\" \"stats\"}"));
+    CHECK(jsonFails("{\"width\":nan}"));
+    CHECK(jsonFails("{\"width\":0x10}"));
+    CHECK(jsonFails(""));
+
+    // Out of range or not an integer where the field is one
+    command = parseJson("{\"width\":-1,\"height\":720,\"segmentMaxBytes\":4e9,\"reservedMaxDuration\":0.5}",
+                        ok, error);
+    CHECK(ok);
+    CHECK_EQ(command.recordingOptions.segment_max_bytes, (guint64) 4000000000ULL);
+    CHECK(jsonFails("{\"width\":1e300}"));
+    CHECK(jsonFails("{\"width\":640.5}"));
+    CHECK(jsonFails("{\"segmentMaxBytes\":-1}"));
+    CHECK(jsonFails("{\"segmentDuration\":-5}"));
+    CHECK(jsonFails("{\"segmentKeep\":5000000000}"));
+    CHECK(jsonFails("{\"count\":1e10}"));
+    CHECK(jsonFails("{\"timestamp\":-2}"));
+
+    // Unknown keys and wrong types are errors, not ignored
+    CHECK(jsonFails("{\"action\":\"stats\",\"colour\":\"red\"}"));
+    CHECK(jsonFails("{\"width\":\"640\"}"));
+    CHECK(jsonFails("{\"outputPath\":1}"));
+    CHECK(jsonFails("[1]"));
+    CHECK(jsonFails("{\"action\":\"stats\"} "
+                    "{\"action\":\"stats\"}"));
+}
+
+// Commands are grouped by target: in order within a group, groups at the
+// same time
+static void testGroups() {
+    std::vector<Command> commands(6);
+    commands[0].action = "start-recording";
+    commands[0].outputPath = "a.mp4";
+    commands[1].action = "start-recording";
+    commands[1].outputPath = "b.mp4";
+    commands[2].action = "stop-recording";
+    commands[2].outputPath = "a.mp4";
+    commands[3].action = "stats";
+    commands[4].action = "stats";
+    commands[4].id = "mine";
+    commands[5].action = "stop-recording";
+    commands[5].outputPath = "b.mp4";
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::string> order;
+    int waiting = 0;
+    bool concurrent = false;
+
+    auto results = runCommandGroups(commands, [&](const Command& command) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (command.action == "start-recording") {
+            // Both starts are waiting at once only if the groups overlap
+            waiting++;
+            changed.notify_all();
+            concurrent |= changed.wait_for(lock, std::chrono::seconds(5), [&] { return waiting == 2; });
+        }
+        order.push_back(command.action + ":" + command.outputPath);
+        CommandResult result;
+        result.id = command.id;
+        result.action = command.action;
+        result.ok = true;
+        return result;
+    });
+
+    CHECK(concurrent);
+    CHECK_EQ(results.size(), commands.size());
+    CHECK_EQ(results[0].id, std::string("0"));
+    CHECK_EQ(results[2].action, std::string("stop-recording"));
+    CHECK_EQ(results[4].id, std::string("mine"));
+    CHECK_EQ(results[5].id, std::string("5"));
+    CHECK_EQ(order.size(), commands.size());
+
+    auto at = [&](const std::string& entry) {
+        return std::find(order.begin(), order.end(), entry) - order.begin();
+    };
+    CHECK(at("start-recording:a.mp4") < at("stop-recording:a.mp4"));
+    CHECK(at("start-recording:b.mp4") < at("stop-recording:b.mp4"));
+}
+
+// A batch naming many targets runs on a few threads, every command once
+static void testManyGroups() {
+    std::vector<Command> commands(2000);
+    for (size_t i = 0; i < commands.size(); i++) {
+        commands[i].action = "stop-streaming";
+        commands[i].channelName = "channel" + std::to_string(i);
+    }
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    auto results = runCommandGroups(commands, [&](const Command& command) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+        CommandResult result;
+        result.id = command.channelName;
+        return result;
+    });
+    CHECK(threads.size() <= 8);
+    CHECK_EQ(results.size(), commands.size());
+    CHECK_EQ(results[1999].id, std::string("channel1999"));
+}
+
+int main() {
+    testArguments();
+    testJson();
+    testGroups();
+    testManyGroups();
+    return unitTestResult();
+}
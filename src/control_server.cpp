@@ -0,0 +1,329 @@
+#include "control_server.h"
+#include <gio/gunixsocketaddress.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Sessions a command targets, with the command that ends them
+static bool isSessionTarget(const std::string& target) {
+    return target.rfind("recording:", 0) == 0 || target.rfind("streaming:", 0) == 0;
+}
+
+// Removes the socket at path, e.g. one left behind by a previous run. Anything
+// else there is left alone and false returned.
+static bool removeSocket(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        std::cerr << "Not a socket, left alone: " << path << std::endl;
+        return false;
+    }
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "Failed to remove " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+ControlServer::Client::~Client() {
+    g_object_unref(input);
+    g_object_unref(connection);
+}
+
+void ControlServer::Client::send(const std::string& line) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::string data = line + "\n";
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    // A client that went away is noticed by its reader
+    g_output_stream_write_all(output, data.data(), data.size(), nullptr, nullptr, nullptr);
+}
+
+ControlServer::ControlServer(const std::string& path, Executor executor)
+    : path(path), executor(std::move(executor)) {
+}
+
+ControlServer::~ControlServer() {
+    if (loop) {
+        g_main_loop_quit(loop);
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    std::unique_lock<std::mutex> lock(clients_mutex);
+    idle.wait(lock, [this] { return running == 0; });
+    clients.clear();
+    lock.unlock();
+
+    if (loop) {
+        g_main_loop_unref(loop);
+        g_main_context_unref(context);
+        if (listening) {
+            removeSocket(path);
+        }
+    }
+}
+
+bool ControlServer::start() {
+    context = g_main_context_new();
+    loop = g_main_loop_new(context, FALSE);
+
+    std::promise<bool> started;
+    std::future<bool> result = started.get_future();
+    thread = std::thread(&ControlServer::run, this, &started);
+    if (!result.get()) {
+        thread.join();
+        return false;
+    }
+    std::cout << "Listening for commands on " << path << std::endl;
+    return true;
+}
+
+void ControlServer::wait() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void ControlServer::run(std::promise<bool>* started) {
+    g_main_context_push_thread_default(context);
+
+    // A socket left behind by a previous run would make bind fail
+    if (!removeSocket(path)) {
+        g_main_context_pop_thread_default(context);
+        started->set_value(false);
+        return;
+    }
+
+    GError* error = nullptr;
+    GSocketService* service = g_socket_service_new();
+    GSocketAddress* address = g_unix_socket_address_new(path.c_str());
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+            G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, nullptr, nullptr, &error)) {
+        std::cerr << "Failed to listen on " << path << ": " << error->message << std::endl;
+        g_error_free(error);
+        g_object_unref(address);
+        g_object_unref(service);
+        g_main_context_pop_thread_default(context);
+        started->set_value(false);
+        return;
+    }
+    g_object_unref(address);
+
+    g_signal_connect(service, "incoming", G_CALLBACK(onIncoming), this);
+    g_socket_service_start(service);
+    listening = true;
+    started->set_value(true);
+
+    g_main_loop_run(loop);
+
+    g_socket_service_stop(service);
+    g_socket_listener_close(G_SOCKET_LISTENER(service));
+    g_object_unref(service);
+    g_main_context_pop_thread_default(context);
+}
+
+gboolean ControlServer::onIncoming(GSocketService* service, GSocketConnection* connection,
+                                   GObject* source, gpointer user_data) {
+    ControlServer* self = static_cast<ControlServer*>(user_data);
+
+    auto client = std::make_shared<Client>();
+    client->server = self;
+    client->connection = G_SOCKET_CONNECTION(g_object_ref(connection));
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    {
+        std::lock_guard<std::mutex> lock(self->clients_mutex);
+        client->id = self->next_client_id++;
+        self->clients[client->id] = client;
+    }
+    std::cout << "Control client " << client->id << " connected" << std::endl;
+
+    self->readNext(client);
+    return TRUE;
+}
+
+void ControlServer::readNext(const std::shared_ptr<Client>& client) {
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, nullptr,
+        onLine, new std::shared_ptr<Client>(client));
+}
+
+void ControlServer::onLine(GObject* source, GAsyncResult* result, gpointer user_data) {
+    std::unique_ptr<std::shared_ptr<Client>> holder(static_cast<std::shared_ptr<Client>*>(user_data));
+    std::shared_ptr<Client> client = *holder;
+    ControlServer* self = client->server;
+
+    gsize length = 0;
+    gchar* line = g_data_input_stream_read_line_finish_utf8(G_DATA_INPUT_STREAM(source), result,
+                                                            &length, nullptr);
+    if (!line) {
+        self->disconnect(client);
+        return;
+    }
+    std::string command(line, length);
+    g_free(line);
+    if (!command.empty() && command.back() == '\r') {
+        command.pop_back();
+    }
+    if (command.empty()) {
+        self->readNext(client);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(self->clients_mutex);
+        self->running++;
+    }
+    // The next line of this client is only read once this one is done,
+    // other clients go on meanwhile
+    std::thread([self, client, command]() {
+        self->handleLine(client, command);
+
+        g_main_context_invoke_full(self->context, G_PRIORITY_DEFAULT,
+            [](gpointer data) -> gboolean {
+                auto client = *static_cast<std::shared_ptr<Client>*>(data);
+                client->server->readNext(client);
+                return G_SOURCE_REMOVE;
+            },
+            new std::shared_ptr<Client>(client),
+            [](gpointer data) { delete static_cast<std::shared_ptr<Client>*>(data); });
+
+        std::lock_guard<std::mutex> lock(self->clients_mutex);
+        self->running--;
+        self->idle.notify_all();
+    }).detach();
+}
+
+void ControlServer::handleLine(const std::shared_ptr<Client>& client, const std::string& line) {
+    std::vector<Command> commands;
+    CommandResult parse_result;
+    bool parsed;
+    if (isJsonLine(line)) {
+        parsed = parseJsonCommands(line, commands, parse_result.error);
+    } else {
+        Command command;
+        parsed = parseArguments(line, command, parse_result.error);
+        commands.push_back(std::move(command));
+    }
+    if (!parsed) {
+        client->send(formatResult(parse_result));
+        return;
+    }
+
+    // Sessions of other clients are left alone, whatever the command does
+    // with them
+    std::vector<CommandResult> results(commands.size());
+    std::vector<Command> allowed;
+    std::vector<size_t> allowed_index;
+    // Sessions this line claimed, released again if their start fails
+    std::vector<std::string> claimed(commands.size());
+    {
+        std::lock_guard<std::mutex> lock(owners_mutex);
+        for (size_t i = 0; i < commands.size(); i++) {
+            std::string denied;
+            for (const auto& target : commands[i].sessionTargets()) {
+                auto it = owners.find(target);
+                if (it != owners.end() && it->second != client->id) {
+                    denied = target;
+                    break;
+                }
+            }
+            if (!denied.empty()) {
+                results[i].id = commands[i].id.empty() ? std::to_string(i) : commands[i].id;
+                results[i].action = commands[i].action;
+                results[i].error = "Owned by another client: " + denied;
+                continue;
+            }
+            // Owned before it starts, so that a session ending right away
+            // is released by sessionStopped like any other
+            std::string target = commands[i].target();
+            if (commands[i].action.rfind("start-", 0) == 0 && isSessionTarget(target) &&
+                !owners.count(target)) {
+                owners[target] = client->id;
+                claimed[i] = target;
+            }
+            allowed.push_back(commands[i]);
+            allowed_index.push_back(i);
+        }
+    }
+
+    std::vector<CommandResult> done = executor(allowed);
+
+    {
+        std::lock_guard<std::mutex> lock(owners_mutex);
+        for (size_t k = 0; k < allowed.size(); k++) {
+            size_t i = allowed_index[k];
+            results[i] = done[k];
+            if (done[k].ok || claimed[i].empty()) {
+                continue;
+            }
+            auto it = owners.find(claimed[i]);
+            if (it != owners.end() && it->second == client->id) {
+                owners.erase(it);
+            }
+        }
+    }
+
+    for (const auto& result : results) {
+        client->send(formatResult(result));
+    }
+}
+
+void ControlServer::disconnect(const std::shared_ptr<Client>& client) {
+    std::cout << "Control client " << client->id << " disconnected" << std::endl;
+
+    // Whatever it left running is stopped, so that the files get closed
+    std::vector<Command> stops;
+    {
+        std::lock_guard<std::mutex> lock(owners_mutex);
+        for (auto it = owners.begin(); it != owners.end();) {
+            if (it->second != client->id) {
+                ++it;
+                continue;
+            }
+            Command stop;
+            if (it->first.rfind("recording:", 0) == 0) {
+                stop.action = "stop-recording";
+                stop.outputPath = it->first.substr(10);
+            } else {
+                stop.action = "stop-streaming";
+                stop.channelName = it->first.substr(10);
+            }
+            stops.push_back(std::move(stop));
+            it = owners.erase(it);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    clients.erase(client->id);
+    if (!stops.empty()) {
+        running++;
+        std::thread([this, stops]() mutable {
+            executor(stops);
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            running--;
+            idle.notify_all();
+        }).detach();
+    }
+}
+
+void ControlServer::sessionStopped(const std::string& target) {
+    std::lock_guard<std::mutex> lock(owners_mutex);
+    owners.erase(target);
+}
+
+void ControlServer::broadcast(const std::string& line) {
+    std::vector<std::shared_ptr<Client>> targets;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        for (const auto& [id, client] : clients) {
+            targets.push_back(client);
+        }
+    }
+    for (const auto& client : targets) {
+        client->send(line);
+    }
+}
@@ -2,8 +2,20 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "command_handler.h"
+#include "command_parser.h"
+#include "control_server.h"
 #include "deskew_handler.h"
+#include "gstcapture.h"
+#include "gstsharedencoder.h"
+#include "plugin_registry.h"
 #include <gst/gst.h>
 #include <gst/gstmacos.h>
 
@@ -15,190 +27,370 @@ static std::string g_audioDevIndex = "null";
 static int g_width = -1;
 static int g_height = -1;
 
-// Split command into arguments (handles quotes and parentheses)
-static std::vector<std::string> splitArguments(const std::string& input) {
-    std::vector<std::string> args;
-    bool inQuotes = false;
-    bool inParentheses = false;
-    std::string current;
-    
-    for (char c : input) {
-        if (c == ' ' && !inQuotes && !inParentheses) {
-            if (!current.empty()) {
-                args.push_back(current);
-                current.clear();
-            }
-        } else {
-            if (c == '"') inQuotes = !inQuotes;
-            if (c == '(') inParentheses = true;
-            if (c == ')') inParentheses = false;
-            current += c;
-        }
+// Recording pipelines kept ready ahead of start-recording
+static int g_poolSize = 0;
+
+// Encoded video kept from before start-recording
+static double g_prerollSeconds = 0;
+static long g_prerollMaxBytes = 8 * 1024 * 1024;
+
+// Raw frames kept per encoder for screenshots at a past timestamp
+static int g_screenshotFrames = GstSharedEncoder::DEFAULT_SCREENSHOT_FRAMES;
+
+// Unix socket other processes send commands to, empty for stdin only
+static std::string g_controlSocket;
+
+// Stats written every g_statsInterval seconds as JSON lines, to
+// g_statsFile or stdout. 0 only answers the stats command.
+static double g_statsInterval = 0;
+static std::string g_statsFile;
+// GStreamer tracers, e.g. "latency(flags=element)", logged to GST_DEBUG
+static std::string g_tracers;
+
+// Plugin registry kept across launches, empty for GStreamer's default
+static std::string g_registryCache;
+static StartupTimer g_startup;
+
+// Output lines and the preview settings are shared by concurrent commands
+static std::mutex g_outputMutex;
+static std::mutex g_deskewMutex;
+static std::mutex g_sizeMutex;
+// Set once a JSON command came in, stopped events are then reported as JSON
+static std::atomic<bool> g_jsonEvents{false};
+
+static void printLine(const std::string& line) {
+    std::lock_guard<std::mutex> lock(g_outputMutex);
+    std::cout << line << std::endl;
+}
+
+// Sizes given once apply to the following commands too
+static void applySize(Command& command) {
+    std::lock_guard<std::mutex> lock(g_sizeMutex);
+    if (command.width != -1) {
+        g_width = command.width;
+        std::cout << "Set width: " << g_width << std::endl;
     }
-    
-    if (!current.empty()) {
-        args.push_back(current);
+    if (command.height != -1) {
+        g_height = command.height;
+        std::cout << "Set height: " << g_height << std::endl;
     }
-    
-    return args;
+    command.width = g_width;
+    command.height = g_height;
 }
 
-// Parse and execute a command (uses global width/height)
-static void parseAndExecuteCommand(const std::string& command, CommandHandler& cmdHandler, DeskewHandler& deskewHandler) {
-    auto args = splitArguments(command);
-    
-    std::string action;
-    std::string outputPath;
-    std::string channelName;
-    std::string outputPathSs;
-    std::vector<std::pair<double, double>> points;
-    std::string flipMethod = "none";
-    
-    for (const auto& arg : args) {
-        if (arg.find("--action=") == 0) {
-            action = arg.substr(9);
-        }
-        else if (arg.find("--outputPath=") == 0) {
-            outputPath = arg.substr(13);
-        }
-        else if (arg.find("--outputPathSs=") == 0) {
-            outputPathSs = arg.substr(15);
-        }
-        else if (arg.find("--channelName=") == 0) {
-            channelName = arg.substr(14);
+// Runs one command, error says why it failed. data is the JSON the
+// command returns, if any.
+static bool executeCommand(const Command& command, CommandHandler& cmdHandler,
+                           DeskewHandler& deskewHandler, std::string& error, std::string& data) {
+    const std::string& action = command.action;
+    const auto& points = command.points;
+
+    if (action == "start-recording") {
+        if (command.outputPath.empty()) {
+            error = "Error: outputPath is required for start-recording";
+            return false;
         }
-        else if (arg.find("--p1=") == 0) {
-            auto coords = arg.substr(5);
-            if (coords.front() == '(' && coords.back() == ')') {
-                coords = coords.substr(1, coords.size() - 2);
-            }
-            size_t comma = coords.find(',');
-            double x = std::stod(coords.substr(0, comma));
-            double y = std::stod(coords.substr(comma+1));
-            points.emplace_back(x, y);
+        if (points.size() != 4) {
+            error = "Error: Exactly 4 points (p1-p4) are required for quadrilateral cropping";
+            return false;
         }
-        else if (arg.find("--p2=") == 0) {
-            auto coords = arg.substr(5);
-            if (coords.front() == '(' && coords.back() == ')') {
-                coords = coords.substr(1, coords.size() - 2);
-            }
-            size_t comma = coords.find(',');
-            double x = std::stod(coords.substr(0, comma));
-            double y = std::stod(coords.substr(comma+1));
-            points.emplace_back(x, y);
+        bool ok = cmdHandler.startRecording(command.outputPath, points, command.width, command.height,
+            command.flipMethod, g_camDevIndex, g_audioDevIndex, command.recordingOptions);
+        if (!ok) {
+            error = "Failed to start recording: " + command.outputPath;
         }
-        else if (arg.find("--p3=") == 0) {
-            auto coords = arg.substr(5);
-            if (coords.front() == '(' && coords.back() == ')') {
-                coords = coords.substr(1, coords.size() - 2);
-            }
-            size_t comma = coords.find(',');
-            double x = std::stod(coords.substr(0, comma));
-            double y = std::stod(coords.substr(comma+1));
-            points.emplace_back(x, y);
+        std::lock_guard<std::mutex> lock(g_deskewMutex);
+        deskewHandler.updateSettings(points, command.flipMethod);
+        return ok;
+    }
+    else if (action == "start-streaming") {
+        if (command.channelName.empty()) {
+            error = "Error: channelName is required for start-streaming";
+            return false;
         }
-        else if (arg.find("--p4=") == 0) {
-            auto coords = arg.substr(5);
-            if (coords.front() == '(' && coords.back() == ')') {
-                coords = coords.substr(1, coords.size() - 2);
-            }
-            size_t comma = coords.find(',');
-            double x = std::stod(coords.substr(0, comma));
-            double y = std::stod(coords.substr(comma+1));
-            points.emplace_back(x, y);
+        if (points.size() != 4) {
+            error = "Error: Exactly 4 points (p1-p4) are required for quadrilateral cropping";
+            return false;
         }
-        else if (arg.find("--flipMethod=") == 0) {
-            flipMethod = arg.substr(13);
+        bool ok = cmdHandler.startStreaming(command.channelName, points, command.width, command.height,
+            command.flipMethod, g_camDevIndex, g_audioDevIndex);
+        if (!ok) {
+            error = "Failed to start streaming: " + command.channelName;
         }
-        else if (arg.find("--width=") == 0) {
-            g_width = std::stoi(arg.substr(8));
-            std::cout << "Set width: " << g_width << std::endl;
+        std::lock_guard<std::mutex> lock(g_deskewMutex);
+        deskewHandler.updateSettings(points, command.flipMethod);
+        return ok;
+    }
+    else if (action == "take-screenshot") {
+        if (command.outputPathSs.empty()) {
+            error = "Error: Screenshot outputPath is required for take-screenshot";
+            return false;
         }
-        else if (arg.find("--height=") == 0) {
-            g_height = std::stoi(arg.substr(9));
-            std::cout << "Set height: " << g_height << std::endl;
+        // Of the recording (outputPath) or stream (channelName) given, the
+        // first recording otherwise
+        if (!cmdHandler.takeScreenshot(command.outputPathSs, command.outputPath, command.channelName,
+                                       command.timestamp)) {
+            error = "Failed to take screenshot: " + command.outputPathSs;
+            return false;
         }
+        return true;
     }
-    
-    if (action == "start-recording") {
-        if (outputPath.empty()) {
-            std::cerr << "Error: outputPath is required for start-recording" << std::endl;
-            return;
+    else if (action == "take-screenshots") {
+        // Numbered screenshots, e.g. --count=150 --interval=200 for one
+        // every 200 ms for 30 s, or --count=10 for the next 10 frames
+        if (command.outputPathSs.empty()) {
+            error = "Error: Screenshot outputPath is required for take-screenshots";
+            return false;
         }
-        if (points.size() != 4) {
-            std::cerr << "Error: Exactly 4 points (p1-p4) are required for quadrilateral cropping" << std::endl;
-            return;
+        if (command.count < 1 || command.interval < 0) {
+            error = "Error: count must be at least 1 and interval not negative";
+            return false;
         }
-        if (!cmdHandler.startRecording(outputPath, points, g_width, g_height, flipMethod, g_camDevIndex, g_audioDevIndex)) {
-            std::cerr << "Failed to start recording: " << outputPath << std::endl;
+        if (!cmdHandler.takeScreenshots(command.outputPathSs, command.count, command.interval,
+                                        command.outputPath, command.channelName)) {
+            error = "Failed to take screenshots: " + command.outputPathSs;
+            return false;
         }
-        deskewHandler.updateSettings(points, flipMethod);
+        return true;
     }
-    else if (action == "start-streaming") {
-        if (channelName.empty()) {
-            std::cerr << "Error: channelName is required for start-streaming" << std::endl;
-            return;
+    else if (action == "update-points") {
+        // Retargets a running recording (outputPath) or stream (channelName)
+        // without restarting it
+        if (command.outputPath.empty() && command.channelName.empty()) {
+            error = "Error: outputPath or channelName is required for update-points";
+            return false;
         }
         if (points.size() != 4) {
-            std::cerr << "Error: Exactly 4 points (p1-p4) are required for quadrilateral cropping" << std::endl;
-            return;
+            error = "Error: Exactly 4 points (p1-p4) are required for quadrilateral cropping";
+            return false;
         }
-        if (!cmdHandler.startStreaming(channelName, points, g_width, g_height, flipMethod, g_camDevIndex, g_audioDevIndex)) {
-            std::cerr << "Failed to start streaming: " << channelName << std::endl;
+        bool ok = true;
+        if (!command.outputPath.empty() && !cmdHandler.updateRecordingPoints(command.outputPath, points)) {
+            error = "Failed to update points: " + command.outputPath;
+            ok = false;
         }
-        deskewHandler.updateSettings(points, flipMethod);
-    }
-    else if (action == "take-screenshot") {
-        if (outputPathSs.empty()) {
-            std::cerr << "Error: Screenshot outputPath is required for take-screenshot" << std::endl;
-            return;
-        }
-        if (!cmdHandler.takeScreenshot(outputPathSs)) {
-            std::cerr << "Failed to start recording: " << outputPathSs << std::endl;
+        if (!command.channelName.empty() && !cmdHandler.updateStreamingPoints(command.channelName, points)) {
+            error += (ok ? "" : "\n") + std::string("Failed to update points: ") + command.channelName;
+            ok = false;
         }
+        return ok;
     }
     else if (action == "stop-recording") {
-        if (outputPath.empty()) {
-            std::cerr << "Error: outputPath is required for stop-recording" << std::endl;
-            return;
+        if (command.outputPath.empty()) {
+            error = "Error: outputPath is required for stop-recording";
+            return false;
         }
-        if (!cmdHandler.stopRecording(outputPath)) {
-            std::cerr << "Failed to stop recording: " << outputPath << std::endl;
+        if (!cmdHandler.stopRecording(command.outputPath)) {
+            error = "Failed to stop recording: " + command.outputPath;
+            return false;
         }
+        return true;
     }
     else if (action == "stop-streaming") {
-        if (channelName.empty()) {
-            std::cerr << "Error: channelName is required for stop-streaming" << std::endl;
-            return;
+        if (command.channelName.empty()) {
+            error = "Error: channelName is required for stop-streaming";
+            return false;
         }
-        if (!cmdHandler.stopStreaming(channelName)) {
-            std::cerr << "Failed to stop streaming: " << std::endl;
+        if (!cmdHandler.stopStreaming(command.channelName)) {
+            error = "Failed to stop streaming: " + command.channelName;
+            return false;
         }
+        return true;
+    }
+    else if (action == "stats") {
+        data = cmdHandler.getStats();
+        return true;
     }
     else if (!action.empty()) {
-        std::cerr << "Unknown action: " << action << std::endl;
+        error = "Unknown action: " + action;
+        return false;
+    }
+    return true;
+}
+
+static CommandResult runCommand(const Command& command, CommandHandler& cmdHandler,
+                                DeskewHandler& deskewHandler) {
+    CommandResult result;
+    result.id = command.id;
+    result.action = command.action;
+    auto start = std::chrono::steady_clock::now();
+    result.ok = executeCommand(command, cmdHandler, deskewHandler, result.error, result.data);
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Commands on the same recording, stream or screenshot path run in order,
+// the others at the same time, see runCommandGroups
+static std::vector<CommandResult> runCommands(std::vector<Command>& commands, CommandHandler& cmdHandler,
+                                              DeskewHandler& deskewHandler) {
+    for (auto& command : commands) {
+        applySize(command);
+    }
+    return runCommandGroups(commands, [&](const Command& command) {
+        return runCommand(command, cmdHandler, deskewHandler);
+    });
+}
+
+// A JSON line holds one command or a batch, one result line per command is
+// printed once the whole batch is done
+static void executeJsonCommands(const std::string& line, CommandHandler& cmdHandler,
+                                DeskewHandler& deskewHandler) {
+    g_jsonEvents = true;
+
+    std::vector<Command> commands;
+    CommandResult parse_result;
+    if (!parseJsonCommands(line, commands, parse_result.error)) {
+        printLine(formatResult(parse_result));
+        return;
+    }
+
+    for (const auto& result : runCommands(commands, cmdHandler, deskewHandler)) {
+        printLine(formatResult(result));
+    }
+}
+
+// Parse and execute a command (uses global width/height)
+static void parseAndExecuteCommand(const std::string& line, CommandHandler& cmdHandler, DeskewHandler& deskewHandler) {
+    if (isJsonLine(line)) {
+        executeJsonCommands(line, cmdHandler, deskewHandler);
+        return;
+    }
+
+    Command command;
+    std::string error;
+    if (!parseArguments(line, command, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return;
+    }
+    applySize(command);
+    std::string data;
+    if (!executeCommand(command, cmdHandler, deskewHandler, error, data)) {
+        std::cerr << error << std::endl;
+    }
+    if (!data.empty()) {
+        printLine(data);
     }
 }
 
 // Parse device indices at startup
 static bool parseDeviceIndices(int argc, char* argv[]) {
+    CaptureSources sources;
+
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
-        if (arg.find("--CamDevIndex=") == 0) {
-            g_camDevIndex = arg.substr(14);
-        }
-        else if (arg.find("--AudioDevIndex=") == 0) {
-            g_audioDevIndex = arg.substr(16);  // Changed from stoi() to direct string assignment
+        try {
+            if (arg.find("--CamDevIndex=") == 0) {
+                g_camDevIndex = arg.substr(14);
+            }
+            else if (arg.find("--AudioDevIndex=") == 0) {
+                g_audioDevIndex = arg.substr(16);  // Changed from stoi() to direct string assignment
+            }
+            // Replace the camera and microphone, e.g. --videoSource="videotestsrc is-live=true"
+            else if (arg.find("--videoSource=") == 0) {
+                sources.video = arg.substr(14);
+            }
+            else if (arg.find("--audioSource=") == 0) {
+                sources.audio = arg.substr(14);
+            }
+            else if (arg.find("--poolSize=") == 0) {
+                g_poolSize = std::stoi(arg.substr(11));
+            }
+            else if (arg.find("--preroll=") == 0) {
+                g_prerollSeconds = std::stod(arg.substr(10));
+            }
+            else if (arg.find("--prerollMaxBytes=") == 0) {
+                g_prerollMaxBytes = std::stol(arg.substr(18));
+            }
+            else if (arg.find("--screenshotFrames=") == 0) {
+                g_screenshotFrames = std::stoi(arg.substr(19));
+            }
+            else if (arg.find("--controlSocket=") == 0) {
+                g_controlSocket = arg.substr(16);
+            }
+            else if (arg.find("--statsInterval=") == 0) {
+                g_statsInterval = std::stod(arg.substr(16));
+            }
+            else if (arg.find("--statsFile=") == 0) {
+                g_statsFile = arg.substr(12);
+            }
+            else if (arg.find("--tracers=") == 0) {
+                g_tracers = arg.substr(10);
+            }
+            else if (arg.find("--registryCache=") == 0) {
+                g_registryCache = arg.substr(16);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Error: Invalid number in: " << arg << std::endl;
+            return false;
         }
     }
-    
-    if (g_camDevIndex == "null" || g_audioDevIndex == "null") {
+    if (g_prerollMaxBytes < 0) {
+        std::cerr << "Error: --prerollMaxBytes can't be negative" << std::endl;
+        return false;
+    }
+    GstCapture::setSources(sources);
+    GstSharedEncoder::setScreenshotFrames(std::max(g_screenshotFrames, 1));
+    if (g_prerollSeconds > 0) {
+        GstSharedEncoder::setPreroll((GstClockTime) (g_prerollSeconds * GST_SECOND), g_prerollMaxBytes);
+    }
+
+    if ((g_camDevIndex == "null" && sources.video.empty()) ||
+        (g_audioDevIndex == "null" && sources.audio.empty())) {
         std::cerr << "Error: Both --CamDevIndex and --AudioDevIndex must be specified" << std::endl;
         return false;
     }
     return true;
 }
 
+// Writes the stats every g_statsInterval seconds until stopped
+class StatsDump {
+public:
+    explicit StatsDump(CommandHandler& cmdHandler) : cmdHandler(cmdHandler) {
+        thread = std::thread([this] { run(); });
+    }
+
+    ~StatsDump() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+private:
+    void run() {
+        std::ofstream file;
+        if (!g_statsFile.empty()) {
+            file.open(g_statsFile, std::ios::app);
+            if (!file) {
+                std::cerr << "Failed to open stats file: " << g_statsFile << std::endl;
+                return;
+            }
+        }
+
+        auto interval = std::chrono::duration<double>(g_statsInterval);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, interval, [this] { return stopped; })) {
+            auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            std::string line = "{\"event\":\"stats\",\"time\":" + std::to_string(time_ms) + "," +
+                               cmdHandler.getStats().substr(1);
+            if (file.is_open()) {
+                file << line << std::endl;
+            } else {
+                printLine(line);
+            }
+        }
+    }
+
+    CommandHandler& cmdHandler;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopped = false;
+};
+
 // Main app loop
 static int run_app(int argc, char* argv[]) {
     CommandHandler cmdHandler;
@@ -208,6 +400,47 @@ static int run_app(int argc, char* argv[]) {
         std::cerr << "Failed to setup preview pipeline!" << std::endl;
         return 1;
     }
+    g_startup.mark("preview");
+
+    std::shared_ptr<ControlServer> server;
+    if (!g_controlSocket.empty()) {
+        server = std::make_shared<ControlServer>(g_controlSocket,
+            [&](std::vector<Command>& commands) {
+                return runCommands(commands, cmdHandler, deskewHandler);
+            });
+        if (!server->start()) {
+            return 1;
+        }
+    }
+
+    // Stops and screenshot bursts finish in the background, JSON clients get
+    // an event for them
+    std::weak_ptr<ControlServer> events = server;
+    cmdHandler.setStoppedCallback([events](const std::string& kind, const std::string& key, bool ok) {
+        std::string event = kind == "screenshots" ?
+            formatEvent("screenshots-done", "outputPathSs", key, ok) :
+            formatEvent(kind + "-stopped", kind == "recording" ? "outputPath" : "channelName", key, ok);
+        if (g_jsonEvents) {
+            printLine(event);
+        }
+        if (auto server = events.lock()) {
+            if (kind != "screenshots") {
+                server->sessionStopped(kind + ":" + key);
+            }
+            server->broadcast(event);
+        }
+    });
+
+    if (g_poolSize > 0) {
+        cmdHandler.setRecordingPoolSize(g_poolSize, g_camDevIndex, g_audioDevIndex);
+        g_startup.mark("recording pool");
+    }
+
+    std::unique_ptr<StatsDump> stats_dump;
+    if (g_statsInterval > 0) {
+        stats_dump = std::make_unique<StatsDump>(cmdHandler);
+    }
+    g_startup.print();
     
     // Check if command-line args were provided directly
     if (argc > 1) {
@@ -227,7 +460,16 @@ static int run_app(int argc, char* argv[]) {
             parseAndExecuteCommand(command, cmdHandler, deskewHandler);
         }
     }
-    
+
+    // Without stdin the socket clients keep driving the recorder
+    if (server) {
+        server->wait();
+    }
+
+    // Nothing may call back into this function's state once it returned
+    stats_dump.reset();
+    cmdHandler.stopAll();
+    cmdHandler.setStoppedCallback(nullptr);
     return 0;
 }
 
@@ -237,19 +479,51 @@ int main(int argc, char* argv[]) {
     if (!parseDeviceIndices(argc, argv)) {
         return 1;
     }
+    g_startup.mark("arguments");
     
     // Set GStreamer plugin paths
     std::string build_dir = g_get_current_dir();
     std::string plugin_path = "/usr/local/lib/gstreamer-1.0:/opt/homebrew/lib/gstreamer-1.0:" + build_dir;
     setenv("GST_PLUGIN_PATH", plugin_path.c_str(), 1);
+
+    // The core tracers (latency, stats, rusage...) log through the debug
+    // system, at level 7 of the GST_TRACER category
+    if (!g_tracers.empty()) {
+        setenv("GST_TRACERS", g_tracers.c_str(), 1);
+        std::string debug = getenv("GST_DEBUG") ? getenv("GST_DEBUG") : "";
+        setenv("GST_DEBUG", (debug.empty() ? "" : debug + ",").append("GST_TRACER:7").c_str(), 1);
+    }
+
+    // With a registry cache the plugins are only looked at again when one of
+    // them changed, GST_PLUGIN_PATH already covers the build directory
+    std::vector<std::string> plugin_dirs = {
+        "/usr/local/lib/gstreamer-1.0", "/opt/homebrew/lib/gstreamer-1.0", build_dir,
+#ifdef CUSTOM_GST_PLUGIN_DIR
+        CUSTOM_GST_PLUGIN_DIR,
+#endif
+    };
+    bool registry_fresh = false;
+    if (!g_registryCache.empty()) {
+        registry_fresh = usePluginRegistryCache(g_registryCache, plugin_dirs);
+        g_startup.mark(registry_fresh ? "registry cache" : "registry cache (stale)");
+    }
     
     if (!gst_init_check(&argc, &argv, nullptr)) {
         std::cerr << "Failed to initialize GStreamer" << std::endl;
         return 1;
     }
+    g_startup.mark("gst_init");
+
+    if (g_registryCache.empty()) {
+        GstRegistry* registry = gst_registry_get();
+        gst_registry_scan_path(registry, build_dir.c_str());
+        g_startup.mark("plugin scan");
+    } else if (!registry_fresh) {
+        savePluginRegistryStamp(g_registryCache, plugin_dirs);
+    }
 
-    GstRegistry* registry = gst_registry_get();
-    gst_registry_scan_path(registry, build_dir.c_str());
+    registerStaticPlugins();
+    g_startup.mark("static plugins");
 
     return gst_macos_main((GstMainFunc)run_app, argc, argv, nullptr);
 }
\ No newline at end of file
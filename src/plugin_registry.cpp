@@ -0,0 +1,112 @@
+#include "plugin_registry.h"
+#include <gst/gst.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef GST_STATIC_PLUGIN_LIST
+#define GST_STATIC_PLUGIN(name) GST_PLUGIN_STATIC_DECLARE(name);
+GST_STATIC_PLUGIN_LIST
+#undef GST_STATIC_PLUGIN
+#endif
+
+StartupTimer::StartupTimer()
+    : start(std::chrono::steady_clock::now()), last(start) {
+}
+
+void StartupTimer::mark(const std::string& phase) {
+    auto now = std::chrono::steady_clock::now();
+    phases.emplace_back(phase, std::chrono::duration<double, std::milli>(now - last).count());
+    last = now;
+}
+
+void StartupTimer::print() const {
+    std::cout << "Startup:";
+    for (const auto& [phase, ms] : phases) {
+        char line[64];
+        snprintf(line, sizeof(line), " %s %.1f ms,", phase.c_str(), ms);
+        std::cout << line;
+    }
+    char total[64];
+    snprintf(total, sizeof(total), " total %.1f ms",
+             std::chrono::duration<double, std::milli>(last - start).count());
+    std::cout << total << std::endl;
+}
+
+// Name, size and modification time of every plugin, only stat()ed, so that
+// this stays far cheaper than the registry check it replaces
+static std::string pluginFingerprint(const std::vector<std::string>& plugin_dirs) {
+    std::ostringstream fingerprint;
+    fingerprint << GST_VERSION_MAJOR << "." << GST_VERSION_MINOR << "." << GST_VERSION_MICRO << "\n";
+
+    for (const auto& dir : plugin_dirs) {
+        DIR* handle = opendir(dir.c_str());
+        if (!handle) {
+            fingerprint << dir << " missing\n";
+            continue;
+        }
+        std::vector<std::string> entries;
+        while (struct dirent* entry = readdir(handle)) {
+            std::string name = entry->d_name;
+            if (name.find(".so") == std::string::npos && name.find(".dylib") == std::string::npos) {
+                continue;
+            }
+            struct stat info;
+            if (stat((dir + "/" + name).c_str(), &info) != 0) {
+                continue;
+            }
+            entries.push_back(name + " " + std::to_string(info.st_size) + " " +
+                              std::to_string((long long) info.st_mtime));
+        }
+        closedir(handle);
+
+        // readdir order isn't stable
+        std::sort(entries.begin(), entries.end());
+        fingerprint << dir << "\n";
+        for (const auto& entry : entries) {
+            fingerprint << entry << "\n";
+        }
+    }
+    return fingerprint.str();
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+bool usePluginRegistryCache(const std::string& cache_path, const std::vector<std::string>& plugin_dirs) {
+    setenv("GST_REGISTRY", cache_path.c_str(), 1);
+
+    struct stat info;
+    bool fresh = stat(cache_path.c_str(), &info) == 0 &&
+                 readFile(cache_path + ".stamp") == pluginFingerprint(plugin_dirs);
+    if (fresh) {
+        setenv("GST_REGISTRY_UPDATE", "no", 1);
+    } else {
+        unsetenv("GST_REGISTRY_UPDATE");
+    }
+    return fresh;
+}
+
+void savePluginRegistryStamp(const std::string& cache_path, const std::vector<std::string>& plugin_dirs) {
+    std::ofstream stamp(cache_path + ".stamp", std::ios::trunc);
+    stamp << pluginFingerprint(plugin_dirs);
+    if (!stamp) {
+        std::cerr << "Failed to write " << cache_path << ".stamp" << std::endl;
+    }
+}
+
+void registerStaticPlugins() {
+#ifdef GST_STATIC_PLUGIN_LIST
+#define GST_STATIC_PLUGIN(name) GST_PLUGIN_STATIC_REGISTER(name);
+    GST_STATIC_PLUGIN_LIST
+#undef GST_STATIC_PLUGIN
+#endif
+}
@@ -0,0 +1,405 @@
+// Headless benchmark of the recording chain: capture, deskew, encode and
+// mux, the same way recording_app runs it, from a test pattern (or any
+// source) instead of a camera. Sweeps output sizes, corner points, flip
+// modes, session counts and encoder presets and writes one CSV or JSON row
+// per combination.
+//
+//   recording_bench --sizes=1280x720,1920x1080 --quads=full,skew
+//       --flips=none,clockwise --sessions=1,4 --presets=ultrafast,veryfast
+//       --duration=10 --format=csv --output=bench.csv
+
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#include <gst/gst.h>
+#include "gstcapture.h"
+#include "gstrecording.h"
+#include "gststats.h"
+#include "plugin_registry.h"
+
+using Points = std::vector<std::pair<double, double>>;
+
+// Corner points in the 1280x720 capture, top left first and clockwise
+static const std::map<std::string, Points> quads = {
+    {"full", {{0, 0}, {1280, 0}, {1280, 720}, {0, 720}}},
+    {"center", {{320, 180}, {960, 180}, {960, 540}, {320, 540}}},
+    {"skew", {{622, 77}, {877, 83}, {900, 684}, {632, 699}}},
+};
+
+static const std::vector<std::string> presets = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow"};
+
+struct BenchConfig {
+    int width;
+    int height;
+    std::string quad;
+    std::string flip;
+    int sessions;
+    std::string preset;
+};
+
+struct BenchResult {
+    double fps = 0;          // muxed frames per second, averaged over the sessions
+    guint64 frames = 0;      // muxed frames of all sessions in the measured window
+    GstClockTime p50 = 0;    // age of the frames at the muxer, from capture
+    GstClockTime p95 = 0;
+    GstClockTime p99 = 0;
+    GstClockTime max = 0;
+    double cpu = 0;          // percent of one core
+    double rss_mb = 0;
+    bool ok = true;          // every session started and finalized
+};
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Process CPU time (user and system) in seconds
+static double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Current resident set size in MiB
+static double residentMb() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS) {
+        return info.resident_size / (1024.0 * 1024.0);
+    }
+#else
+    std::ifstream statm("/proc/self/statm");
+    long size, resident;
+    if (statm >> size >> resident) {
+        return resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+    }
+#endif
+    // Peak instead of current, in KiB on Linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+class Bench {
+public:
+    Bench(const std::string& output_dir, bool separate_encoders)
+        : output_dir(output_dir), separate_encoders(separate_encoders) {
+        recording.setStoppedCallback([this](const std::string& outputPath, bool ok) {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped++;
+            failed += ok ? 0 : 1;
+            done.notify_all();
+        });
+    }
+
+    BenchResult run(const BenchConfig& config, double warmup, double duration) {
+        BenchResult result;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = 0;
+            failed = 0;
+        }
+
+        RecordingOptions options;
+        options.speed_preset = config.preset;
+        std::vector<std::string> paths;
+        for (int i = 0; i < config.sessions; i++) {
+            // Moving the corners by a fraction of a pixel changes the
+            // encoder settings, every session then encodes on its own
+            Points points = quads.at(config.quad);
+            if (separate_encoders) {
+                points[0].first += i * 0.001;
+            }
+            std::string path = output_dir + "/bench_" + std::to_string(i) + ".mp4";
+            if (!recording.startRecording(path, points, config.width, config.height, config.flip,
+                                          "bench", "bench", options)) {
+                std::cerr << "Failed to start session " << i << std::endl;
+                result.ok = false;
+                break;
+            }
+            paths.push_back(path);
+        }
+
+        GstClock* clock = gst_system_clock_obtain();
+        std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+
+        GstClockTime since = gst_clock_get_time(clock);
+        std::vector<guint64> first_frames(paths.size(), 0);
+        for (size_t i = 0; i < paths.size(); i++) {
+            std::vector<GstClockTime> ignored;
+            auto stats = recording.getPipelineStats(paths[i]);
+            if (stats) {
+                stats->getPoint("mux", first_frames[i], ignored, GST_CLOCK_TIME_NONE);
+            }
+        }
+        double cpu_start = cpuSeconds();
+        auto wall_start = std::chrono::steady_clock::now();
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        result.cpu = 100.0 * (cpuSeconds() - cpu_start) / wall;
+        result.rss_mb = residentMb();
+
+        std::vector<GstClockTime> ages;
+        for (size_t i = 0; i < paths.size(); i++) {
+            guint64 frames = 0;
+            auto stats = recording.getPipelineStats(paths[i]);
+            if (stats && stats->getPoint("mux", frames, ages, since)) {
+                result.frames += frames - first_frames[i];
+            }
+        }
+        gst_object_unref(clock);
+        if (!paths.empty()) {
+            result.fps = result.frames / wall / paths.size();
+        }
+        result.p50 = GstPipelineStats::percentile(ages, 0.5);
+        result.p95 = GstPipelineStats::percentile(ages, 0.95);
+        result.p99 = GstPipelineStats::percentile(ages, 0.99);
+        result.max = GstPipelineStats::percentile(ages, 1.0);
+
+        for (const auto& path : paths) {
+            recording.stopRecording(path);
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!done.wait_for(lock, std::chrono::seconds(15),
+                           [&] { return stopped == (int) paths.size(); }) || failed) {
+            std::cerr << "Not every session finalized" << std::endl;
+            result.ok = false;
+        }
+        return result;
+    }
+
+private:
+    std::string output_dir;
+    bool separate_encoders;
+    std::mutex mutex;
+    std::condition_variable done;
+    int stopped = 0;
+    int failed = 0;
+    // Last, so that it's gone before what its stopped callback uses
+    GstRecording recording;
+};
+
+static std::string ms(GstClockTime time) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.2f", (double) time / GST_MSECOND);
+    return buf;
+}
+
+static std::string fixed(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f", value);
+    return buf;
+}
+
+static std::string csvRow(const BenchConfig& config, const BenchResult& result) {
+    return std::to_string(config.width) + "," + std::to_string(config.height) + "," + config.quad + "," +
+           config.flip + "," + std::to_string(config.sessions) + "," + config.preset + "," +
+           fixed(result.fps) + "," + std::to_string(result.frames) + "," + ms(result.p50) + "," +
+           ms(result.p95) + "," + ms(result.p99) + "," + ms(result.max) + "," + fixed(result.cpu) + "," +
+           fixed(result.rss_mb) + "," + (result.ok ? "1" : "0");
+}
+
+static std::string jsonRow(const BenchConfig& config, const BenchResult& result) {
+    return "{\"width\":" + std::to_string(config.width) + ",\"height\":" + std::to_string(config.height) +
+           ",\"quad\":" + GstPipelineStats::quote(config.quad) +
+           ",\"flip\":" + GstPipelineStats::quote(config.flip) +
+           ",\"sessions\":" + std::to_string(config.sessions) +
+           ",\"preset\":" + GstPipelineStats::quote(config.preset) +
+           ",\"fps\":" + fixed(result.fps) + ",\"frames\":" + std::to_string(result.frames) +
+           ",\"p50Ms\":" + ms(result.p50) + ",\"p95Ms\":" + ms(result.p95) +
+           ",\"p99Ms\":" + ms(result.p99) + ",\"maxMs\":" + ms(result.max) +
+           ",\"cpuPercent\":" + fixed(result.cpu) + ",\"rssMb\":" + fixed(result.rss_mb) +
+           ",\"ok\":" + (result.ok ? "true" : "false") + "}";
+}
+
+int main(int argc, char* argv[]) {
+    // Live so that frames come at the capture rate, ball so that every
+    // frame differs and the encoder has real work
+    CaptureSources sources;
+    sources.video = "videotestsrc is-live=true pattern=ball";
+    sources.audio = "audiotestsrc is-live=true wave=ticks";
+
+    std::vector<std::string> sizes = {"1280x720"};
+    std::vector<std::string> quad_names = {"skew"};
+    std::vector<std::string> flips = {"none"};
+    std::vector<int> session_counts = {1};
+    std::vector<std::string> preset_names = {"ultrafast"};
+    double warmup = 2;
+    double duration = 10;
+    std::string format = "csv";
+    std::string output;
+    std::string output_dir;
+    bool separate_encoders = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            // Any gst-launch description producing raw video, e.g.
+            // "filesrc location=in.mp4 ! decodebin ! videoconvert ! videoscale ! identity sync=true"
+            if (arg.find("--videoSource=") == 0) {
+                sources.video = arg.substr(14);
+            }
+            else if (arg.find("--audioSource=") == 0) {
+                sources.audio = arg.substr(14);
+            }
+            else if (arg.find("--sizes=") == 0) {
+                sizes = split(arg.substr(8));
+            }
+            else if (arg.find("--quads=") == 0) {
+                quad_names = split(arg.substr(8));
+            }
+            else if (arg.find("--flips=") == 0) {
+                flips = split(arg.substr(8));
+            }
+            else if (arg.find("--sessions=") == 0) {
+                session_counts.clear();
+                for (const auto& count : split(arg.substr(11))) {
+                    session_counts.push_back(std::max(std::stoi(count), 1));
+                }
+            }
+            else if (arg.find("--presets=") == 0) {
+                preset_names = split(arg.substr(10));
+            }
+            else if (arg.find("--warmup=") == 0) {
+                warmup = std::stod(arg.substr(9));
+            }
+            else if (arg.find("--duration=") == 0) {
+                duration = std::stod(arg.substr(11));
+            }
+            else if (arg.find("--format=") == 0) {
+                format = arg.substr(9);
+            }
+            else if (arg.find("--output=") == 0) {
+                output = arg.substr(9);
+            }
+            else if (arg.find("--outputDir=") == 0) {
+                output_dir = arg.substr(12);
+            }
+            else if (arg == "--separateEncoders") {
+                separate_encoders = true;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Error: Invalid number in: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchConfig> configs;
+    for (const auto& size : sizes) {
+        int width = 0, height = 0;
+        if (std::sscanf(size.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+            std::cerr << "Invalid size: " << size << std::endl;
+            return 1;
+        }
+        for (const auto& quad : quad_names) {
+            if (!quads.count(quad)) {
+                std::cerr << "Unknown quad: " << quad << " (full, center or skew)" << std::endl;
+                return 1;
+            }
+            for (const auto& flip : flips) {
+                for (int count : session_counts) {
+                    for (const auto& preset : preset_names) {
+                        if (std::find(presets.begin(), presets.end(), preset) == presets.end()) {
+                            std::cerr << "Unknown x264 preset: " << preset << std::endl;
+                            return 1;
+                        }
+                        configs.push_back({width, height, quad, flip, count, preset});
+                    }
+                }
+            }
+        }
+    }
+    if (format != "csv" && format != "json") {
+        std::cerr << "Invalid format: " << format << " (csv or json)" << std::endl;
+        return 1;
+    }
+
+    if (!gst_init_check(&argc, &argv, nullptr)) {
+        std::cerr << "Failed to initialize GStreamer" << std::endl;
+        return 1;
+    }
+    registerStaticPlugins();
+
+    bool remove_dir = output_dir.empty();
+    if (remove_dir) {
+        char dir_template[] = "/tmp/recording_bench_XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            std::cerr << "Failed to create a temporary directory" << std::endl;
+            return 1;
+        }
+        output_dir = dir_template;
+    }
+
+    std::ofstream file;
+    if (!output.empty()) {
+        file.open(output);
+        if (!file) {
+            std::cerr << "Failed to open output file: " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = file.is_open() ? file : std::cout;
+
+    GstCapture::setSources(sources);
+    bool all_ok = true;
+    {
+        Bench bench(output_dir, separate_encoders);
+        if (format == "csv") {
+            out << "width,height,quad,flip,sessions,preset,fps,frames,p50_ms,p95_ms,p99_ms,max_ms,"
+                   "cpu_percent,rss_mb,ok" << std::endl;
+        } else {
+            out << "[" << std::endl;
+        }
+        for (size_t i = 0; i < configs.size(); i++) {
+            const BenchConfig& config = configs[i];
+            std::cerr << "[" << i + 1 << "/" << configs.size() << "] " << config.width << "x" << config.height
+                      << " " << config.quad << " " << config.flip << " x" << config.sessions << " "
+                      << config.preset << std::endl;
+            BenchResult result = bench.run(config, warmup, duration);
+            all_ok = all_ok && result.ok;
+            if (format == "csv") {
+                out << csvRow(config, result) << std::endl;
+            } else {
+                out << "  " << jsonRow(config, result) << (i + 1 < configs.size() ? "," : "") << std::endl;
+            }
+        }
+        if (format == "json") {
+            out << "]" << std::endl;
+        }
+    }
+
+    if (remove_dir) {
+        std::error_code error;
+        std::filesystem::remove_all(output_dir, error);
+    }
+    return all_ok ? 0 : 1;
+}